@@ -3,8 +3,14 @@
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "../external/stb_image_write.h"
 
+#include "bench_harness.h"
+#include "image_stream.h"
+#include "../src/arena.h"
 #include "../src/he.h"
+#include "../src/instrument.h"
+#include "../src/keystore.h"
 #include "../src/poly_utils.h"
+#include "../src/ring_utils.h"
 
 #include <assert.h>
 #include <float.h>
@@ -63,7 +69,7 @@ static int64_t mod_inverse(int64_t a, int64_t m) {
   return result;
 }
 
-static void rgb_to_grayscale_plain(uint8_t *input, uint8_t *output, int width,
+static void rgb_to_grayscale_plain(const uint8_t *input, uint8_t *output, int width,
                                    int height, int channels) {
   for (int i = 0; i < width * height; i++) {
     if (channels >= 3) {
@@ -77,18 +83,246 @@ static void rgb_to_grayscale_plain(uint8_t *input, uint8_t *output, int width,
   }
 }
 
+// `scalars` is workspace for `total_pixels` plaintext multipliers.
 static void rgb_to_grayscale_fhe(Ciphertext *r_enc, Ciphertext *g_enc,
                                  Ciphertext *b_enc, Ciphertext *output_enc,
                                  int total_pixels, int64_t q, int64_t t,
-                                 Poly poly_mod) {
+                                 Poly poly_mod, double *scalars) {
   int64_t inv3 = mod_inverse(3, t);
   assert(inv3 != -1 &&
          "3 has no modular inverse modulo t; choose t coprime with 3");
   #pragma omp parallel for num_threads(4)
   for (int i = 0; i < total_pixels; i++) {
     Ciphertext sum = add_cipher(r_enc[i], g_enc[i], q, poly_mod);
-    sum = add_cipher(sum, b_enc[i], q, poly_mod);
-    output_enc[i] = mul_plain(sum, q, t, poly_mod, inv3);
+    output_enc[i] = add_cipher(sum, b_enc[i], q, poly_mod);
+    scalars[i] = inv3;
+  }
+  mul_plain_many(output_enc, total_pixels, q, t, &poly_mod, scalars,
+                 output_enc);
+}
+
+// Streamed inputs are cut into strips of STREAM_ROWS rows and tiles of at
+// most STREAM_TILE_PIXELS pixels, the size of a tile of the default image,
+// so memory stays bounded however large the image is.
+#define STREAM_ROWS 16
+#define STREAM_TILE_PIXELS 256
+
+// What every tile needs besides its pixels.
+typedef struct {
+  size_t n;
+  int64_t q;
+  int64_t t;
+  double q_dec;
+  Poly poly_mod;
+  SecretKey sk;
+  Arena *arena;
+  BenchHarness *bench;
+  // Slot k of store->in holds the r, g and b ciphertexts of tile k of the
+  // current strip, slot k of store->out its grayscale result. NULL to keep
+  // tiles in memory.
+  BenchTileStore *store;
+} TileContext;
+
+// A tile's working set, carved from the arena.
+typedef struct {
+  Ciphertext *rgb_enc; // r, g and b back to back
+  Ciphertext *gray_enc;
+  double *values; // plaintext values going in and out of the batched calls
+  uint8_t *gray;
+} TileBuffers;
+
+static TileBuffers tile_buffers(Arena *arena, int tile_pixels) {
+  TileBuffers b;
+  arena_reset(arena);
+  b.rgb_enc = arena_alloc_cts(arena, 3 * tile_pixels);
+  b.gray_enc = arena_alloc_cts(arena, tile_pixels);
+  b.values = arena_alloc(arena, 3 * tile_pixels * sizeof(double));
+  b.gray = arena_alloc(arena, tile_pixels);
+  return b;
+}
+
+// `rgb` points at the tile's top-left pixel in a buffer with the given row
+// stride (in bytes). The image owner holds the secret key, so that is
+// secret-key encryption, one batched call for all three channels.
+static void encrypt_tile_rgb(TileContext *ctx, const uint8_t *rgb,
+                             int rgb_stride, int channels, int tile_height,
+                             int tile_width, TileBuffers *b) {
+  int tile_pixels = tile_height * tile_width;
+  for (int r = 0; r < tile_height; r++) {
+    for (int c = 0; c < tile_width; c++) {
+      int i = r * tile_width + c;
+      const uint8_t *px = rgb + r * rgb_stride + c * channels;
+      b->values[i] = px[0];
+      b->values[tile_pixels + i] = px[1];
+      b->values[2 * tile_pixels + i] = px[2];
+    }
+  }
+  encrypt_sk_many(&ctx->sk, ctx->n, ctx->q, &ctx->poly_mod, ctx->t, b->values,
+                  3 * tile_pixels, b->rgb_enc);
+}
+
+static void eval_tile(TileContext *ctx, int tile_pixels, TileBuffers *b) {
+  rgb_to_grayscale_fhe(b->rgb_enc, b->rgb_enc + tile_pixels,
+                       b->rgb_enc + 2 * tile_pixels, b->gray_enc, tile_pixels,
+                       ctx->q, ctx->t, ctx->poly_mod, b->values);
+}
+
+// Decrypts b->gray_enc into `gray`, a buffer with the given row stride.
+static void decrypt_tile_gray(TileContext *ctx, int tile_height,
+                              int tile_width, TileBuffers *b, uint8_t *gray,
+                              int gray_stride) {
+  int tile_pixels = tile_height * tile_width;
+  int64_t t = ctx->t;
+  int64_t th1 = (t + 2) / 3;
+  int64_t th2 = (2 * t + 2) / 3;
+
+  #pragma omp parallel for num_threads(4)
+  for (int i = 0; i < tile_pixels; i++) {
+    b->gray_enc[i] = mod_switch(b->gray_enc[i], ctx->q, ctx->q_dec, ctx->n);
+  }
+  decrypt_many(&ctx->sk, ctx->n, ctx->q_dec, &ctx->poly_mod, t, b->gray_enc,
+               tile_pixels, b->values);
+  for (int i = 0; i < tile_pixels; i++) {
+    int64_t val = b->values[i];
+    if (val >= th2)
+      val -= th2;
+    else if (val >= th1)
+      val -= th1;
+    if (val > 255)
+      val = 255;
+    if (val < 0)
+      val = 0;
+    b->gray[i] = (uint8_t)val;
+  }
+
+  for (int r = 0; r < tile_height; r++) {
+    memcpy(&gray[r * gray_stride], &b->gray[r * tile_width],
+           tile_width * sizeof(uint8_t));
+  }
+}
+
+// Encrypts, converts and decrypts one tile. `rgb` and `gray` point at its
+// top-left pixel in buffers with the given row strides (in bytes).
+static void process_tile(TileContext *ctx, const uint8_t *rgb, int rgb_stride,
+                         int channels, int tile_height, int tile_width,
+                         uint8_t *gray, int gray_stride, int report) {
+  BenchHarness *bench = ctx->bench;
+  int tile_pixels = tile_height * tile_width;
+  INSTR_SPAN_BEGIN(tile_start);
+  TileBuffers b = tile_buffers(ctx->arena, tile_pixels);
+
+  bench_phase_begin(bench, PHASE_ENCRYPT);
+  encrypt_tile_rgb(ctx, rgb, rgb_stride, channels, tile_height, tile_width,
+                   &b);
+  bench_phase_end(bench, PHASE_ENCRYPT);
+
+  bench_phase_begin(bench, PHASE_EVAL);
+  eval_tile(ctx, tile_pixels, &b);
+  bench_phase_end(bench, PHASE_EVAL);
+
+  if (report) {
+    bench_report_noise(b.gray_enc, tile_pixels, &ctx->sk, ctx->n, ctx->q,
+                       ctx->t, &ctx->poly_mod);
+  }
+
+  bench_phase_begin(bench, PHASE_DECRYPT);
+  decrypt_tile_gray(ctx, tile_height, tile_width, &b, gray, gray_stride);
+  bench_phase_end(bench, PHASE_DECRYPT);
+
+  INSTR_SPAN_END(tile_start, "tile");
+}
+
+static void require_io(int rc) {
+  if (rc < 0) {
+    fprintf(stderr, "Tile store I/O failed\n");
+    exit(1);
+  }
+}
+
+// Width of tile k of a strip cut into tiles of tile_w columns.
+static int strip_tile_width(int width, int tile_w, int k) {
+  return (k + 1) * tile_w > width ? width - k * tile_w : tile_w;
+}
+
+// process_tile for every tile of a strip of the given width, through the
+// tile store: all tiles are encrypted and written out, then each is read
+// back and evaluated while the next one is read ahead and the previous
+// result written behind, then the results are read back and decrypted the
+// same way. With `report`, the noise of the first result is reported as read
+// back, which carries no estimate.
+static void process_strip_stored(TileContext *ctx, const uint8_t *rgb,
+                                 int rgb_stride, int channels,
+                                 int strip_height, int width, int tile_w,
+                                 uint8_t *gray, int gray_stride, int report) {
+  BenchTileStore *store = ctx->store;
+  BenchHarness *bench = ctx->bench;
+  int tiles = (width + tile_w - 1) / tile_w;
+  int last = tiles - 1;
+  int pixels = strip_height * tile_w; // of every tile but the last
+  int last_pixels = strip_height * strip_tile_width(width, tile_w, last);
+
+  bench_phase_begin(bench, PHASE_ENCRYPT);
+  for (int k = 0; k < tiles; k++) {
+    int count = k == last ? last_pixels : pixels;
+    TileBuffers b = tile_buffers(ctx->arena, count);
+    encrypt_tile_rgb(ctx, rgb + k * tile_w * channels, rgb_stride, channels,
+                     strip_height, count / strip_height, &b);
+    require_io(tile_file_write(&store->in, k, b.rgb_enc, 3 * count));
+  }
+  bench_phase_end(bench, PHASE_ENCRYPT);
+
+  bench_phase_begin(bench, PHASE_EVAL);
+  require_io(tile_file_prefetch(&store->in, 0,
+                                3 * (last == 0 ? last_pixels : pixels)));
+  for (int k = 0; k < tiles; k++) {
+    int count = k == last ? last_pixels : pixels;
+    TileBuffers b = tile_buffers(ctx->arena, count);
+    require_io(tile_file_read(&store->in, k, b.rgb_enc, 3 * count));
+    if (k + 1 < tiles)
+      require_io(tile_file_prefetch(
+          &store->in, k + 1, 3 * (k + 1 == last ? last_pixels : pixels)));
+    eval_tile(ctx, count, &b);
+    require_io(tile_file_write(&store->out, k, b.gray_enc, count));
+  }
+  bench_phase_end(bench, PHASE_EVAL);
+
+  bench_phase_begin(bench, PHASE_DECRYPT);
+  require_io(
+      tile_file_prefetch(&store->out, 0, last == 0 ? last_pixels : pixels));
+  for (int k = 0; k < tiles; k++) {
+    int count = k == last ? last_pixels : pixels;
+    TileBuffers b = tile_buffers(ctx->arena, count);
+    require_io(tile_file_read(&store->out, k, b.gray_enc, count));
+    if (k + 1 < tiles)
+      require_io(tile_file_prefetch(&store->out, k + 1,
+                                    k + 1 == last ? last_pixels : pixels));
+    if (report && k == 0) {
+      bench_phase_end(bench, PHASE_DECRYPT);
+      bench_report_noise(b.gray_enc, count, &ctx->sk, ctx->n, ctx->q, ctx->t,
+                         &ctx->poly_mod);
+      bench_phase_begin(bench, PHASE_DECRYPT);
+    }
+    decrypt_tile_gray(ctx, strip_height, count / strip_height, &b,
+                      gray + k * tile_w, gray_stride);
+  }
+  bench_phase_end(bench, PHASE_DECRYPT);
+}
+
+typedef struct {
+  double l2_sq;
+  int max_diff;
+  size_t num_errors;
+} ErrorStats;
+
+static void compare_gray(const uint8_t *fhe, const uint8_t *plain,
+                         size_t count, ErrorStats *stats) {
+  for (size_t i = 0; i < count; i++) {
+    int diff = abs((int)fhe[i] - (int)plain[i]);
+    if (diff > 0)
+      stats->num_errors++;
+    if (diff > stats->max_diff)
+      stats->max_diff = diff;
+    stats->l2_sq += (double)diff * (double)diff;
   }
 }
 
@@ -106,175 +340,263 @@ int main(int argc, char **argv) {
   int64_t q = 1ll << 30;
   int64_t t = 769;
 
+  // Binary PPM inputs are streamed a strip at a time and the results written
+  // as they are produced; anything else is decoded whole by stb_image.
   printf("Loading image: %s\n", input_path);
-  Image img = load_image(input_path);
-  printf("Image size: %dx%d, channels: %d\n", img.width, img.height,
-         img.channels);
+  ImageReader reader;
+  int streaming = image_reader_open(&reader, input_path) == 0;
+  Image img = {NULL, 0, 0, 0};
+  if (streaming) {
+    img.width = reader.width;
+    img.height = reader.height;
+    img.channels = reader.channels;
+    image_reader_close(&reader);
+  } else {
+    img = load_image(input_path);
+  }
+  printf("Image size: %dx%d, channels: %d%s\n", img.width, img.height,
+         img.channels, streaming ? " (streamed)" : "");
 
   if (img.channels < 3) {
     fprintf(stderr, "Error: Image must have at least 3 channels (RGB)\n");
-    free_image(img);
+    if (!streaming)
+      free_image(img);
     return 1;
   }
 
-  int total_pixels = img.width * img.height;
-
-  Poly poly_mod = create_poly();
-  set_coeff(&poly_mod, 0, 1);
-  set_coeff(&poly_mod, n, 1);
-
-  printf("Generating keys...\n");
-  KeyPair keys = keygen(n, q, poly_mod);
-  PublicKey pk = keys.pk;
-  SecretKey sk = keys.sk;
-
-  printf("Encrypting RGB channels...\n");
-
-  double enc_start = omp_get_wtime();
-
-  // Figure out how many pixels should be in each tile (by height and width)
-  int tRows = 2;
-  int tCols = 2;
-  int tile_h = (img.height + tRows - 1) / tRows;
-  int tile_w = (img.width + tCols - 1) / tCols;
-
-  uint8_t *fhe_gray = malloc(total_pixels * sizeof(uint8_t));
-
-  // Going through each tile
-  for (int tr = 0; tr < tRows; tr++) {
-    for (int tc = 0; tc < tCols; tc++) {
-      int row_start = tr * tile_h;
-      int col_start = tc * tile_w;
-      int row_end =
-          (row_start + tile_h > img.height) ? img.height : row_start + tile_h;
-      int col_end =
-          (col_start + tile_w > img.width) ? img.width : col_start + tile_w;
-
-      int tile_height = row_end - row_start;
-      int tile_width = col_end - col_start;
-      int tile_pixels = tile_height * tile_width;
-
-      Ciphertext *r_enc = malloc(tile_pixels * sizeof(Ciphertext));
-      Ciphertext *g_enc = malloc(tile_pixels * sizeof(Ciphertext));
-      Ciphertext *b_enc = malloc(tile_pixels * sizeof(Ciphertext));
-
-      #pragma omp parallel for collapse(2) num_threads(4)
-      for (int r = 0; r < tile_height; r++) {
-        for (int c = 0; c < tile_width; c++) {
-          int i = r * tile_width + c;
-          int og_image_idx =
-              (row_start + r) * img.width + (col_start + c);
-
-          uint8_t R = img.data[og_image_idx * img.channels + 0];
-          uint8_t G = img.data[og_image_idx * img.channels + 1];
-          uint8_t B = img.data[og_image_idx * img.channels + 2];
-
-          r_enc[i] = encrypt(pk, n, q, poly_mod, t, R);
-          g_enc[i] = encrypt(pk, n, q, poly_mod, t, G);
-          b_enc[i] = encrypt(pk, n, q, poly_mod, t, B);
-        }
-      }
-
-      Ciphertext *gray_enc = malloc(tile_pixels * sizeof(Ciphertext));
-
-      printf("Applying FHE grayscale conversion (R+G+B)/3...\n");
-
-      rgb_to_grayscale_fhe(r_enc, g_enc, b_enc, gray_enc, tile_pixels, q, t, poly_mod);
+  size_t total_pixels = (size_t)img.width * img.height;
+
+  Poly poly_mod = ring_modulus(n);
+
+  HEParams params = {.n = n, .q = (double)q, .t = (double)t};
+
+  // Results are mod-switched down to q_dec before decryption; only log2(t)
+  // bits plus a noise margin are needed at that point.
+  double q_dec = mod_switch_modulus(n, t);
+  printf("Decryption modulus after mod switch: 2^%.0f (from 2^%.0f)\n",
+         log2(q_dec), log2((double)q));
+
+  BenchHarness bench;
+  bench_init(&bench, "bw");
+  bench_param(&bench, "width", img.width);
+  bench_param(&bench, "height", img.height);
+  bench_param(&bench, "n", n);
+  bench_param(&bench, "log2_q", log2((double)q));
+  bench_param(&bench, "t", t);
+  bench_param(&bench, "streamed", streaming);
+  ArenaPages pages = bench_placement(&bench);
+
+  // Figure out how many pixels should be in each tile (by height and width).
+  // Tiles are processed a row of tiles (a strip) at a time.
+  int tile_h, tile_w;
+  if (streaming) {
+    tile_h = img.height < STREAM_ROWS ? img.height : STREAM_ROWS;
+    tile_w = STREAM_TILE_PIXELS / tile_h;
+    if (tile_w > img.width)
+      tile_w = img.width;
+  } else {
+    int tRows = 2;
+    int tCols = 2;
+    tile_h = (img.height + tRows - 1) / tRows;
+    tile_w = (img.width + tCols - 1) / tCols;
+  }
 
-      printf("Decrypting FHE grayscale result...\n");
+  // Whole images keep full-size results for the PNGs; streamed ones only
+  // the current strip of input and results.
+  size_t buffer_pixels = streaming ? (size_t)tile_h * img.width : total_pixels;
+  uint8_t *fhe_gray = malloc(buffer_pixels * sizeof(uint8_t));
+  uint8_t *plain_gray = malloc(buffer_pixels * sizeof(uint8_t));
+  uint8_t *strip_rgb = NULL;
+  if (streaming)
+    strip_rgb = malloc(buffer_pixels * img.channels * sizeof(uint8_t));
+  KeyPair keys;
+
+  // Working set of the largest tile: r, g, b and gray ciphertexts, the
+  // plaintext values going in and out of the batched calls and the decrypted
+  // bytes. Reset per tile instead of going back to malloc.
+  size_t max_tile_pixels = (size_t)tile_h * tile_w;
+  Arena arena;
+  if (arena_init_pages(&arena,
+                       4 * max_tile_pixels * sizeof(Ciphertext) +
+                           3 * max_tile_pixels * sizeof(double) +
+                           max_tile_pixels + 4 * ARENA_ALIGN,
+                       pages) != 0) {
+    fprintf(stderr, "Failed to allocate tile arena\n");
+    exit(1);
+  }
+  BenchTileStore tile_store;
+  int stored = bench_tile_store_open(&tile_store, &bench, n, (double)q,
+                                     3 * max_tile_pixels, max_tile_pixels);
+  if (stored < 0) {
+    fprintf(stderr, "Failed to open tile store\n");
+    exit(1);
+  }
 
-      uint8_t *fhe_gray_temp = malloc(tile_pixels * sizeof(uint8_t));
+  ErrorStats stats = {0.0, 0, 0};
+  double plain_time = 0.0;
+  uint8_t first_plain[10], first_fhe[10];
+  int first_count = img.width < 10 ? img.width : 10;
+
+  while (bench_next_trial(&bench)) {
+    printf("Loading keys...\n");
+    bench_phase_begin(&bench, PHASE_KEYGEN);
+    int generated = keystore_get(keystore_dir(), params, poly_mod, &keys, NULL);
+    bench_phase_end(&bench, PHASE_KEYGEN);
+    if (generated)
+      printf("Generated new keys\n");
+
+    TileContext ctx = {n,       q,      t,      q_dec,
+                       poly_mod, keys.sk, &arena, &bench,
+                       stored ? &tile_store : NULL};
+    ImageWriter fhe_out, plain_out;
+    if (streaming &&
+        (image_reader_open(&reader, input_path) < 0 ||
+         image_writer_open(&fhe_out, "output/fhe_grayscale.pgm", img.width,
+                           img.height, 1) < 0 ||
+         image_writer_open(&plain_out, "output/plaintext_grayscale.pgm",
+                           img.width, img.height, 1) < 0)) {
+      fprintf(stderr, "Failed to open streamed input or outputs\n");
+      exit(1);
+    }
+    stats = (ErrorStats){0.0, 0, 0};
+    plain_time = 0.0;
+
+    // Each tile is encrypted, converted and decrypted in turn, so the steps
+    // are announced once here rather than per tile.
+    printf("Encrypting RGB channels, applying FHE grayscale conversion "
+           "(R+G+B)/3 and decrypting, tile by tile...\n");
+
+    for (int row_start = 0; row_start < img.height; row_start += tile_h) {
+      int strip_height =
+          (row_start + tile_h > img.height) ? img.height - row_start : tile_h;
+      size_t row_bytes = (size_t)img.width * img.channels;
+      const uint8_t *rgb = img.data + row_start * row_bytes;
+      uint8_t *fhe = fhe_gray + (size_t)row_start * img.width;
+      uint8_t *plain = plain_gray + (size_t)row_start * img.width;
+      if (streaming) {
+        if (image_reader_rows(&reader, strip_rgb, strip_height) !=
+            strip_height) {
+          fprintf(stderr, "Truncated image: %s\n", input_path);
+          exit(1);
+        }
+        rgb = strip_rgb;
+        fhe = fhe_gray;
+        plain = plain_gray;
+      }
 
-      int64_t th1 = (t + 2) / 3;
-      int64_t th2 = (2 * t + 2) / 3;
+      // Going through each tile of the strip
+      if (stored) {
+        process_strip_stored(&ctx, rgb, (int)row_bytes, img.channels,
+                             strip_height, img.width, tile_w, fhe, img.width,
+                             row_start == 0 && bench_first_trial(&bench));
+      } else {
+        for (int col_start = 0; col_start < img.width; col_start += tile_w) {
+          int tile_width = (col_start + tile_w > img.width)
+                               ? img.width - col_start
+                               : tile_w;
+          process_tile(&ctx, rgb + col_start * img.channels, (int)row_bytes,
+                       img.channels, strip_height, tile_width,
+                       fhe + col_start, img.width,
+                       row_start == 0 && col_start == 0 &&
+                           bench_first_trial(&bench));
+        }
+      }
 
-      #pragma omp parallel for num_threads(4)
-      for (int i = 0; i < tile_pixels; i++) {
-        int64_t val = decrypt(sk, n, q, poly_mod, t, gray_enc[i]);
-        if (val >= th2)
-          val -= th2;
-        else if (val >= th1)
-          val -= th1;
-        if (val > 255)
-          val = 255;
-        if (val < 0)
-          val = 0;
-        fhe_gray_temp[i] = (uint8_t)val;
+      double plain_start = bench_now();
+      rgb_to_grayscale_plain(rgb, plain, img.width, strip_height,
+                             img.channels);
+      plain_time += bench_now() - plain_start;
+      compare_gray(fhe, plain, (size_t)strip_height * img.width, &stats);
+      if (row_start == 0) {
+        memcpy(first_plain, plain, first_count);
+        memcpy(first_fhe, fhe, first_count);
       }
 
-      for (int r = 0; r < tile_height; r++) {
-        memcpy(&fhe_gray[(row_start + r) * img.width + col_start],
-               &fhe_gray_temp[r * tile_width], tile_width * sizeof(uint8_t));
+      if (streaming &&
+          (image_writer_rows(&fhe_out, fhe, strip_height) < 0 ||
+           image_writer_rows(&plain_out, plain, strip_height) < 0)) {
+        fprintf(stderr, "Failed to write streamed outputs\n");
+        exit(1);
       }
+    }
 
-      free(r_enc);
-      free(g_enc);
-      free(b_enc);
-      free(gray_enc);
-      free(fhe_gray_temp);
+    if (streaming) {
+      image_reader_close(&reader);
+      if (image_writer_close(&fhe_out) < 0 ||
+          image_writer_close(&plain_out) < 0) {
+        fprintf(stderr, "Failed to write streamed outputs\n");
+        exit(1);
+      }
     }
   }
+  double enc_time = bench_last(&bench, PHASE_ENCRYPT) +
+                    bench_last(&bench, PHASE_EVAL) +
+                    bench_last(&bench, PHASE_DECRYPT);
 
-  double enc_end = omp_get_wtime();
-  double enc_time = enc_end - enc_start;
-
-  printf("Computing plaintext reference grayscale...\n");
-  uint8_t *plain_gray = (uint8_t *)malloc(total_pixels * sizeof(uint8_t));
-  clock_t plain_start = clock();
-  rgb_to_grayscale_plain(img.data, plain_gray, img.width, img.height,
-                         img.channels);
-  clock_t plain_end = clock();
-  double plain_time = ((double)(plain_end - plain_start)) / CLOCKS_PER_SEC;
-
-  printf("Computing L2 norm error...\n");
-  double l2_error = 0.0;
-  int max_diff = 0;
-  int num_errors = 0;
-  for (int i = 0; i < total_pixels; i++) {
-    int diff = abs((int)fhe_gray[i] - (int)plain_gray[i]);
-    if (diff > 0)
-      num_errors++;
-    if (diff > max_diff)
-      max_diff = diff;
-    l2_error += (double)diff * (double)diff;
-  }
-  l2_error = sqrt(l2_error);
+  double l2_error = sqrt(stats.l2_sq);
   double avg_error = l2_error / total_pixels;
 
   printf("First 10 pixels comparison:\n");
-  for (int i = 0; i < 10 && i < total_pixels; i++) {
-    printf("  Pixel %d: plain=%d, fhe=%d, diff=%d\n", i, plain_gray[i],
-           fhe_gray[i], abs((int)fhe_gray[i] - (int)plain_gray[i]));
+  for (int i = 0; i < first_count; i++) {
+    printf("  Pixel %d: plain=%d, fhe=%d, diff=%d\n", i, first_plain[i],
+           first_fhe[i], abs((int)first_fhe[i] - (int)first_plain[i]));
   }
 
   printf("\n=== Results ===\n");
   printf("Encryption time: %.4f s (%.2f ms/pixel)\n", enc_time,
          enc_time * 1000.0 / total_pixels);
-  printf("FHE grayscale conversion time: (included in encryption time)\n");
-  printf("Decryption time: (included in encryption time)\n");
+  printf("  of which encrypt %.4f s, FHE grayscale %.4f s, decrypt %.4f s\n",
+         bench_last(&bench, PHASE_ENCRYPT), bench_last(&bench, PHASE_EVAL),
+         bench_last(&bench, PHASE_DECRYPT));
   printf("Plaintext grayscale time: %.4f s\n", plain_time);
   printf("L2 norm error: %.4f\n", l2_error);
   printf("Average error per pixel: %.4f\n", avg_error);
-  printf("Max pixel difference: %d\n", max_diff);
-  printf("Pixels with errors: %d/%d (%.1f%%)\n", num_errors, total_pixels,
-         100.0 * num_errors / total_pixels);
-
-  save_image("output/original.png",
-             (Image){img.data, img.width, img.height, img.channels});
-  save_image("output/fhe_grayscale.png",
-             (Image){fhe_gray, img.width, img.height, 1});
-  save_image("output/plaintext_grayscale.png",
-             (Image){plain_gray, img.width, img.height, 1});
+  printf("Max pixel difference: %d\n", stats.max_diff);
+  printf("Pixels with errors: %zu/%zu (%.1f%%)\n", stats.num_errors,
+         total_pixels, 100.0 * stats.num_errors / total_pixels);
+  printf("Peak RSS: %.1f MB\n", bench_peak_rss_mb());
+  double huge_mb = bench_huge_pages_mb();
+  printf("Arena pages: %s, %.1f MB in 2 MB pages\n",
+         arena_pages_name(arena.pages), huge_mb);
+
+  bench_metric(&bench, "l2_error", l2_error);
+  bench_metric(&bench, "max_diff", stats.max_diff);
+  bench_metric(&bench, "pixel_errors", stats.num_errors);
+  bench_metric(&bench, "peak_rss_mb", bench_peak_rss_mb());
+  bench_metric(&bench, "huge_page_mb", huge_mb);
+  if (stored && bench_tile_store_close(&tile_store, &bench) < 0) {
+    fprintf(stderr, "Failed to write tile store\n");
+    exit(1);
+  }
+  bench_report(&bench);
 
   printf("\nSaved outputs:\n");
-  printf("  output/original.png             (original RGB input)\n");
-  printf("  output/fhe_grayscale.png        (FHE encrypted RGB -> grayscale -> "
-         "decrypted)\n");
-  printf("  output/plaintext_grayscale.png  (plaintext reference grayscale)\n");
+  if (streaming) {
+    printf("  output/fhe_grayscale.pgm        (FHE encrypted RGB -> grayscale "
+           "-> decrypted)\n");
+    printf("  output/plaintext_grayscale.pgm  (plaintext reference "
+           "grayscale)\n");
+  } else {
+    save_image("output/original.png",
+               (Image){img.data, img.width, img.height, img.channels});
+    save_image("output/fhe_grayscale.png",
+               (Image){fhe_gray, img.width, img.height, 1});
+    save_image("output/plaintext_grayscale.png",
+               (Image){plain_gray, img.width, img.height, 1});
+    printf("  output/original.png             (original RGB input)\n");
+    printf("  output/fhe_grayscale.png        (FHE encrypted RGB -> grayscale "
+           "-> decrypted)\n");
+    printf("  output/plaintext_grayscale.png  (plaintext reference "
+           "grayscale)\n");
+  }
 
   free(fhe_gray);
   free(plain_gray);
-  free_image(img);
+  free(strip_rgb);
+  arena_free(&arena);
+  if (!streaming)
+    free_image(img);
+  bench_free(&bench);
 
   return 0;
-}
\ No newline at end of file
+}
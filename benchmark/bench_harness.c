@@ -0,0 +1,321 @@
+#define _POSIX_C_SOURCE 200809L
+#include "bench_harness.h"
+#include "../src/affinity.h"
+#include "../src/he.h"
+#include "../src/instrument.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+static const char *phase_names[NUM_PHASES + 1] = {"keygen", "encrypt", "eval",
+                                                  "decrypt", "total"};
+
+typedef struct {
+  double mean;
+  double median;
+  double p95;
+  double stddev;
+  double min;
+  double max;
+} BenchStats;
+
+double bench_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+double bench_peak_rss_mb(void) {
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0)
+    return 0.0;
+  return usage.ru_maxrss / 1024.0; // ru_maxrss is in KB on Linux
+}
+
+double bench_huge_pages_mb(void) {
+  FILE *f = fopen("/proc/self/smaps_rollup", "r");
+  if (f == NULL)
+    return 0.0;
+  char line[256];
+  double kb = 0.0;
+  while (fgets(line, sizeof(line), f) != NULL) {
+    if (strncmp(line, "AnonHugePages:", 14) == 0)
+      kb += atof(line + 14);
+    else if (strncmp(line, "Private_Hugetlb:", 16) == 0)
+      kb += atof(line + 16);
+  }
+  fclose(f);
+  return kb / 1024.0;
+}
+
+static int env_int(const char *name, int fallback, int min) {
+  const char *value = getenv(name);
+  if (value == NULL || value[0] == '\0')
+    return fallback;
+  int v = atoi(value);
+  return v < min ? min : v;
+}
+
+void bench_init(BenchHarness *h, const char *name) {
+  memset(h, 0, sizeof(*h));
+  h->name = name;
+  h->warmup = env_int("BENCH_WARMUP", 0, 0);
+  h->trials = env_int("BENCH_TRIALS", 1, 1);
+  for (int p = 0; p <= NUM_PHASES; p++) {
+    h->samples[p] = (double *)calloc(h->trials, sizeof(double));
+  }
+}
+
+static void set_entry(BenchEntry *entries, int *count, const char *key,
+                      double value) {
+  for (int i = 0; i < *count; i++) {
+    if (strcmp(entries[i].key, key) == 0) {
+      entries[i].value = value;
+      return;
+    }
+  }
+  if (*count < BENCH_MAX_ENTRIES) {
+    entries[*count].key = key;
+    entries[*count].value = value;
+    (*count)++;
+  }
+}
+
+ArenaPages bench_placement(BenchHarness *h) {
+  int pinned = 0;
+  if (env_int("HE_PIN_THREADS", 0, 0) > 0) {
+    pinned = affinity_pin_threads(0);
+    printf("Pinned %d OpenMP threads\n", pinned);
+  }
+  const char *value = getenv("HE_HUGEPAGES");
+  ArenaPages pages = ARENA_PAGES_DEFAULT;
+  if (value != NULL && strcmp(value, "thp") == 0)
+    pages = ARENA_PAGES_THP;
+  else if (value != NULL && strcmp(value, "huge") == 0)
+    pages = ARENA_PAGES_HUGE;
+  bench_param(h, "pinned_threads", pinned > 0 ? pinned : 0);
+  bench_param(h, "huge_pages", pages);
+  return pages;
+}
+
+void bench_print_budget(const char *label, double bits) {
+  if (isnan(bits))
+    printf("%s unknown", label);
+  else
+    printf("%s %.1f bits", label, bits);
+}
+
+void bench_report_noise(const Ciphertext *cts, size_t count,
+                        const SecretKey *sk, size_t n, double q, double t,
+                        const Poly *poly_mod) {
+  double estimated = INFINITY;
+  double measured = INFINITY;
+  size_t step = count > 16 ? count / 16 : 1;
+  for (size_t i = 0; i < count; i += step) {
+    double e = noise_budget_estimate(cts[i], q, t);
+    double m = noise_budget(*sk, n, q, *poly_mod, t, cts[i]);
+    // One unknown estimate makes the lowest one unknown.
+    estimated = isnan(e) || e < estimated ? e : estimated;
+    measured = m < measured ? m : measured;
+  }
+  printf("Noise budget (first tile): ");
+  bench_print_budget("estimated", estimated);
+  printf(", measured %.1f bits\n", measured);
+}
+
+int bench_tile_store_open(BenchTileStore *s, BenchHarness *h, size_t n,
+                          double q, size_t in_cts, size_t out_cts) {
+  const char *dir = getenv("HE_TILE_STORE");
+  if (dir == NULL || dir[0] == '\0')
+    return 0;
+  const char *backend = getenv("HE_ASYNC_IO");
+  int use_uring = backend == NULL || strcmp(backend, "pread") != 0;
+  // Two tiles in flight per file.
+  if (async_io_init(&s->io, 2 * TILE_FILE_BUFFERS, use_uring) < 0)
+    return -1;
+  char in_path[4096], out_path[4096];
+  snprintf(in_path, sizeof(in_path), "%s/%s_tiles.%d.bin", dir, h->name,
+           (int)getpid());
+  snprintf(out_path, sizeof(out_path), "%s/%s_results.%d.bin", dir, h->name,
+           (int)getpid());
+  if (tile_file_open(&s->in, &s->io, in_path, n, q, in_cts) < 0) {
+    async_io_free(&s->io);
+    return -1;
+  }
+  unlink(in_path);
+  if (tile_file_open(&s->out, &s->io, out_path, n, q, out_cts) < 0) {
+    tile_file_close(&s->in);
+    async_io_free(&s->io);
+    return -1;
+  }
+  unlink(out_path);
+  printf("Spilling encrypted tiles to %s (%s)\n", dir,
+         async_io_backend(&s->io));
+  bench_param(h, "tile_store", 1);
+  return 1;
+}
+
+int bench_tile_store_close(BenchTileStore *s, BenchHarness *h) {
+  double wait = s->in.wait_seconds + s->out.wait_seconds;
+  printf("Tile store: %s, %.4f s waiting on reads\n",
+         async_io_backend(&s->io), wait);
+  bench_metric(h, "io_wait_s", wait);
+  int rc = tile_file_close(&s->in);
+  if (tile_file_close(&s->out) < 0)
+    rc = -1;
+  async_io_free(&s->io);
+  return rc;
+}
+
+void bench_param(BenchHarness *h, const char *key, double value) {
+  set_entry(h->params, &h->num_params, key, value);
+}
+
+void bench_metric(BenchHarness *h, const char *key, double value) {
+  set_entry(h->metrics, &h->num_metrics, key, value);
+}
+
+int bench_next_trial(BenchHarness *h) {
+  if (h->run > h->warmup) {
+    int idx = h->run - h->warmup - 1;
+    for (int p = 0; p < NUM_PHASES; p++) {
+      h->samples[p][idx] = h->current[p];
+    }
+    h->samples[NUM_PHASES][idx] = bench_now() - h->trial_start;
+    h->stored = idx + 1;
+  }
+  if (h->run == h->warmup + h->trials)
+    return 0;
+
+  if (h->warmup + h->trials > 1) {
+    printf("--- %s %d/%d ---\n", h->run < h->warmup ? "Warmup" : "Trial",
+           h->run < h->warmup ? h->run + 1 : h->run - h->warmup + 1,
+           h->run < h->warmup ? h->warmup : h->trials);
+  }
+  memset(h->current, 0, sizeof(h->current));
+  h->run++;
+  h->trial_start = bench_now();
+  return 1;
+}
+
+int bench_first_trial(const BenchHarness *h) { return h->run == 1; }
+
+void bench_phase_begin(BenchHarness *h, BenchPhase phase) {
+  h->phase_start[phase] = bench_now();
+}
+
+void bench_phase_end(BenchHarness *h, BenchPhase phase) {
+  h->current[phase] += bench_now() - h->phase_start[phase];
+  INSTR_SPAN_END(h->phase_start[phase], phase_names[phase]);
+}
+
+double bench_last(const BenchHarness *h, BenchPhase phase) {
+  return h->stored > 0 ? h->samples[phase][h->stored - 1] : 0.0;
+}
+
+static int cmp_double(const void *a, const void *b) {
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+static BenchStats compute_stats(const double *samples, int count) {
+  double *sorted = (double *)malloc(count * sizeof(double));
+  memcpy(sorted, samples, count * sizeof(double));
+  qsort(sorted, count, sizeof(double), cmp_double);
+
+  BenchStats s;
+  double sum = 0.0;
+  for (int i = 0; i < count; i++) {
+    sum += sorted[i];
+  }
+  s.mean = sum / count;
+  s.median = (count % 2) ? sorted[count / 2]
+                         : 0.5 * (sorted[count / 2 - 1] + sorted[count / 2]);
+  // Nearest-rank percentile.
+  int rank = (int)ceil(0.95 * count);
+  s.p95 = sorted[rank > 0 ? rank - 1 : 0];
+  double var = 0.0;
+  for (int i = 0; i < count; i++) {
+    var += (sorted[i] - s.mean) * (sorted[i] - s.mean);
+  }
+  s.stddev = count > 1 ? sqrt(var / (count - 1)) : 0.0;
+  s.min = sorted[0];
+  s.max = sorted[count - 1];
+  free(sorted);
+  return s;
+}
+
+// JSON has no NaN or infinity.
+static void write_entries(FILE *f, const BenchEntry *entries, int count) {
+  for (int i = 0; i < count; i++) {
+    fprintf(f, "%s\"%s\": ", i ? ", " : "", entries[i].key);
+    if (isfinite(entries[i].value))
+      fprintf(f, "%.17g", entries[i].value);
+    else
+      fprintf(f, "null");
+  }
+}
+
+static void write_json(BenchHarness *h, FILE *f) {
+  fprintf(f, "{\n  \"benchmark\": \"%s\",\n", h->name);
+  fprintf(f, "  \"warmup\": %d,\n  \"trials\": %d,\n", h->warmup, h->trials);
+
+  fprintf(f, "  \"params\": {");
+  write_entries(f, h->params, h->num_params);
+  fprintf(f, "},\n  \"metrics\": {");
+  write_entries(f, h->metrics, h->num_metrics);
+
+  fprintf(f, "},\n  \"phases_sec\": {\n");
+  for (int p = 0; p <= NUM_PHASES; p++) {
+    BenchStats s = compute_stats(h->samples[p], h->trials);
+    fprintf(f,
+            "    \"%s\": {\"median\": %.9f, \"p95\": %.9f, \"stddev\": %.9f, "
+            "\"mean\": %.9f, \"min\": %.9f, \"max\": %.9f, \"samples\": [",
+            phase_names[p], s.median, s.p95, s.stddev, s.mean, s.min, s.max);
+    for (int i = 0; i < h->trials; i++) {
+      fprintf(f, "%s%.9f", i ? ", " : "", h->samples[p][i]);
+    }
+    fprintf(f, "]}%s\n", p < NUM_PHASES ? "," : "");
+  }
+  fprintf(f, "  }\n}\n");
+}
+
+void bench_report(BenchHarness *h) {
+  printf("\n=== Timing: %s (%d trials, %d warmup, wall time) ===\n", h->name,
+         h->trials, h->warmup);
+  printf("%-8s %12s %12s %12s\n", "phase", "median (s)", "p95 (s)",
+         "stddev (s)");
+  for (int p = 0; p <= NUM_PHASES; p++) {
+    BenchStats s = compute_stats(h->samples[p], h->trials);
+    printf("%-8s %12.6f %12.6f %12.6f\n", phase_names[p], s.median, s.p95,
+           s.stddev);
+  }
+
+  const char *path = getenv("BENCH_JSON");
+  if (path == NULL || path[0] == '\0')
+    return;
+  if (strcmp(path, "-") == 0) {
+    write_json(h, stdout);
+    return;
+  }
+  FILE *f = fopen(path, "w");
+  if (f == NULL) {
+    fprintf(stderr, "Failed to write %s\n", path);
+    return;
+  }
+  write_json(h, f);
+  fclose(f);
+  printf("Wrote %s\n", path);
+}
+
+void bench_free(BenchHarness *h) {
+  for (int p = 0; p <= NUM_PHASES; p++) {
+    free(h->samples[p]);
+  }
+}
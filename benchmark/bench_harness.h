@@ -0,0 +1,118 @@
+#ifndef BENCH_HARNESS_H
+#define BENCH_HARNESS_H
+
+// Shared timing harness for the benchmarks. A benchmark wraps its pipeline
+// in `while (bench_next_trial(&h))` and brackets each phase with
+// bench_phase_begin/end; the harness runs BENCH_WARMUP untimed and
+// BENCH_TRIALS timed iterations (environment variables, defaults 0 and 1),
+// prints median/p95/stddev per phase and, when BENCH_JSON names a file (or
+// "-" for stdout), writes the same summary as JSON. All times are wall time.
+
+#include "../src/arena.h"
+#include "../src/tile_file.h"
+
+#define BENCH_MAX_ENTRIES 16
+
+typedef enum {
+  PHASE_KEYGEN,
+  PHASE_ENCRYPT,
+  PHASE_EVAL,
+  PHASE_DECRYPT,
+  NUM_PHASES
+} BenchPhase;
+
+typedef struct {
+  const char *key;
+  double value;
+} BenchEntry;
+
+typedef struct {
+  const char *name;
+  int warmup;
+  int trials;
+  int run;    // iterations started so far, warmup included
+  int stored; // timed iterations finished
+  double *samples[NUM_PHASES + 1]; // per timed trial; last slot is the total
+  double current[NUM_PHASES];
+  double phase_start[NUM_PHASES];
+  double trial_start;
+  BenchEntry params[BENCH_MAX_ENTRIES];
+  int num_params;
+  BenchEntry metrics[BENCH_MAX_ENTRIES];
+  int num_metrics;
+} BenchHarness;
+
+double bench_now(void);
+
+// Peak resident set size of the process so far, in MB.
+double bench_peak_rss_mb(void);
+
+// Memory currently backed by 2 MB pages, transparent or hugetlbfs, in MB.
+double bench_huge_pages_mb(void);
+
+void bench_init(BenchHarness *h, const char *name);
+
+// Records an input parameter (n, q, image size, ...) for the report.
+void bench_param(BenchHarness *h, const char *key, double value);
+
+// Thread and memory placement from the environment: HE_PIN_THREADS=1 pins
+// the OpenMP threads (affinity_pin_threads) and HE_HUGEPAGES=thp or huge
+// picks the page backing for ciphertext arenas, returned. Records both as
+// parameters. Call before the first parallel region.
+ArenaPages bench_placement(BenchHarness *h);
+
+// Prints "<label> <bits> bits", or "<label> unknown" for a NaN budget.
+void bench_print_budget(const char *label, double bits);
+
+// Prints the lowest estimated (noise_budget_estimate) and measured
+// (noise_budget) budgets over up to 16 of `count` ciphertexts, so parameter
+// choices can be checked against real headroom.
+void bench_report_noise(const Ciphertext *cts, size_t count,
+                        const SecretKey *sk, size_t n, double q, double t,
+                        const Poly *poly_mod);
+
+// Encrypted tiles spilled to disk when HE_TILE_STORE names a directory:
+// input tiles go to `in` and results to `out`, read back through `io`.
+typedef struct {
+  AsyncIO io;
+  TileFile in;
+  TileFile out;
+} BenchTileStore;
+
+// Opens the store if HE_TILE_STORE is set, with slots of in_cts and out_cts
+// ciphertexts. The files are unlinked once open, so nothing is left behind.
+// HE_ASYNC_IO=pread uses the thread pool instead of io_uring. Returns 1 if
+// the store is open, 0 if HE_TILE_STORE is unset, -1 on failure.
+int bench_tile_store_open(BenchTileStore *s, BenchHarness *h, size_t n,
+                          double q, size_t in_cts, size_t out_cts);
+
+// Prints the I/O backend and the time spent waiting on reads (recorded as
+// io_wait_s), then closes the store. Returns -1 if a write had failed.
+int bench_tile_store_close(BenchTileStore *s, BenchHarness *h);
+
+// Records a result metric (error, pixel mismatches, ...); later values for
+// the same key replace earlier ones.
+void bench_metric(BenchHarness *h, const char *key, double value);
+
+// Closes the previous iteration and starts the next. Returns 0 once all
+// warmup and timed iterations have run.
+int bench_next_trial(BenchHarness *h);
+
+// True on the first iteration, for one-off diagnostics.
+int bench_first_trial(const BenchHarness *h);
+
+void bench_phase_begin(BenchHarness *h, BenchPhase phase);
+
+// Adds the time since the matching bench_phase_begin to the current
+// iteration, so a phase may be entered once per tile. Instrumented builds
+// also record the phase as a trace span.
+void bench_phase_end(BenchHarness *h, BenchPhase phase);
+
+// Seconds spent in `phase` during the most recent timed iteration.
+double bench_last(const BenchHarness *h, BenchPhase phase);
+
+void bench_report(BenchHarness *h);
+
+void bench_free(BenchHarness *h);
+
+#endif
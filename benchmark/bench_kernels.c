@@ -0,0 +1,236 @@
+#include "bench_harness.h"
+#include "../src/he.h"
+#include "../src/poly_random.h"
+#include "../src/poly_utils.h"
+#include "../src/ring_utils.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Microbenchmarks for the primitive kernels, swept over the ring degree n and
+// the ciphertext modulus q. Each cell repeats one call until it has run for
+// at least `min_ms` and reports ns/op, ops/sec and bytes moved, counted as the
+// live coefficients (8 bytes each) read and written per call. Kernels that
+// return a Poly by value also copy the whole MAX_POLY_DEGREE struct, so the
+// memory they actually touch is larger.
+//
+// Usage: bench_kernels.exe [max_n] [min_ms]
+// BENCH_JSON=<file> (or -) also writes every cell as JSON.
+
+#define MIN_N 16
+#define MAX_N 16384
+
+static const double log_qs[] = {20, 30, 40};
+#define NUM_QS (sizeof(log_qs) / sizeof(log_qs[0]))
+
+// Inputs for one (n, q) cell, kept in static storage: every Poly is ~80 KB.
+typedef struct {
+  size_t n;
+  double q;
+  double t;
+  double p;
+  Poly poly_mod;
+  Poly a;
+  Poly b;
+  Poly wide; // a*b before reduction, degree 2n - 2
+  Poly sum;  // ring_add_mod output
+  KeyPair keys;
+  EvalKey rlk;
+  Ciphertext ct1;
+  Ciphertext ct2;
+} KernelInputs;
+
+static KernelInputs in;
+static volatile double sink;
+
+typedef struct {
+  const char *name;
+  int uses_q;
+  int wide;            // needs the unreduced 2n - 1 coefficient product
+  double coeffs_moved; // per call, in units of n
+  void (*run)(void);
+} Kernel;
+
+static void run_poly_mul(void) { sink = poly_mul(in.a, in.b).coeffs[0]; }
+
+static void run_poly_divmod(void) {
+  Poly quot, rem;
+  poly_divmod(in.wide, in.poly_mod, &quot, &rem);
+  sink = rem.coeffs[0];
+}
+
+static void run_coeff_mod(void) { sink = coeff_mod(in.wide, in.q).coeffs[0]; }
+
+static void run_ring_mul_mod(void) {
+  sink = ring_mul_mod(in.a, in.b, in.q, in.poly_mod).coeffs[0];
+}
+
+static void run_ring_add_mod(void) {
+  ring_add_mod_into(&in.sum, &in.a, &in.b, in.q, &in.poly_mod);
+  sink = in.sum.coeffs[0];
+}
+
+static void run_gen_binary(void) { sink = gen_binary_poly(in.n).coeffs[0]; }
+
+static void run_gen_uniform(void) {
+  sink = gen_uniform_poly(in.n, in.q).coeffs[0];
+}
+
+static void run_gen_normal(void) {
+  sink = gen_normal_poly(in.n, 0.0, 1.0).coeffs[0];
+}
+
+static void run_encrypt(void) {
+  sink = encrypt(in.keys.pk, in.n, in.q, in.poly_mod, in.t, 7).c0.coeffs[0];
+}
+
+static void run_decrypt(void) {
+  sink = decrypt(in.keys.sk, in.n, in.q, in.poly_mod, in.t, in.ct1);
+}
+
+static void run_mul_plain(void) {
+  sink = mul_plain(in.ct1, in.q, in.t, in.poly_mod, 3).c0.coeffs[0];
+}
+
+static void run_mul_cipher(void) {
+  sink = mul_cipher(in.ct1, in.ct2, in.q, in.t, in.p, in.poly_mod, in.rlk)
+             .c0.coeffs[0];
+}
+
+static const Kernel kernels[] = {
+    {"poly_mul", 0, 1, 4, run_poly_mul},         // a, b -> 2n product
+    {"poly_divmod", 0, 1, 4, run_poly_divmod},   // 2n -> quot, rem
+    {"coeff_mod", 1, 1, 4, run_coeff_mod},       // 2n -> 2n
+    {"ring_mul_mod", 1, 0, 3, run_ring_mul_mod}, // a, b -> n
+    {"ring_add_mod", 1, 0, 3, run_ring_add_mod}, // a, b -> n
+    {"gen_binary", 0, 0, 1, run_gen_binary},
+    {"gen_uniform", 1, 0, 1, run_gen_uniform},
+    {"gen_normal", 0, 0, 1, run_gen_normal},
+    {"encrypt", 1, 0, 4, run_encrypt},           // pk -> ct
+    {"decrypt", 1, 0, 3, run_decrypt},           // ct, sk
+    {"mul_plain", 1, 0, 4, run_mul_plain},       // ct -> ct
+    {"mul_cipher", 1, 1, 8, run_mul_cipher},     // 2 ct, rlk -> ct
+};
+#define NUM_KERNELS (sizeof(kernels) / sizeof(kernels[0]))
+
+// Products of two degree n-1 polynomials need 2n - 1 coefficients.
+static int fits_wide(size_t n) { return 2 * n - 1 <= MAX_POLY_DEGREE; }
+
+static void setup_inputs(size_t n, double q) {
+  in.n = n;
+  in.q = q;
+  in.t = 256;
+  in.p = q * q;
+  in.poly_mod = ring_modulus(n);
+  // gen_uniform_poly samples reals; the library rounds them with coeff_mod
+  // before any division, so do the same here.
+  in.a = coeff_mod(gen_uniform_poly(n, q), q);
+  in.b = coeff_mod(gen_uniform_poly(n, q), q);
+  if (fits_wide(n))
+    in.wide = poly_mul(in.a, in.b);
+  in.keys = keygen(n, q, in.poly_mod);
+  if (fits_wide(n))
+    in.rlk = evaluate_keygen(in.keys.sk, n, q, in.poly_mod, in.p);
+  in.ct1 = encrypt(in.keys.pk, n, q, in.poly_mod, in.t, 3);
+  in.ct2 = encrypt(in.keys.pk, n, q, in.poly_mod, in.t, 5);
+}
+
+// Seconds per call, repeating until `min_sec` has elapsed.
+static double time_kernel(const Kernel *k, double min_sec, long *reps_out) {
+  long reps = 0;
+  double start = bench_now();
+  double elapsed = 0.0;
+  do {
+    k->run();
+    reps++;
+    elapsed = bench_now() - start;
+  } while (elapsed < min_sec || reps < 3);
+  *reps_out = reps;
+  return elapsed / reps;
+}
+
+int main(int argc, char **argv) {
+  srand(42);
+  size_t max_n = (argc >= 2) ? (size_t)strtoull(argv[1], NULL, 10) : MAX_N;
+  double min_sec = ((argc >= 3) ? atof(argv[2]) : 100.0) / 1000.0;
+
+  FILE *json = NULL;
+  const char *json_path = getenv("BENCH_JSON");
+  if (json_path != NULL && json_path[0] != '\0') {
+    json = strcmp(json_path, "-") == 0 ? stdout : fopen(json_path, "w");
+    if (json == NULL) {
+      fprintf(stderr, "Failed to open %s\n", json_path);
+      return 1;
+    }
+  }
+
+  printf("sizeof(Poly) = %zu bytes; bytes moved count live coefficients\n",
+         sizeof(Poly));
+  printf("%-13s %6s %6s %12s %12s %12s %10s\n", "kernel", "n", "log2q",
+         "ns/op", "ops/sec", "bytes/op", "GB/s");
+
+  int first_cell = 1;
+  if (json)
+    fprintf(json, "[\n");
+  for (size_t n = MIN_N; n <= max_n && n <= MAX_N; n *= 2) {
+    if (n > MAX_POLY_DEGREE) {
+      printf("n=%zu skipped: exceeds MAX_POLY_DEGREE (%d)\n", n,
+             MAX_POLY_DEGREE);
+      continue;
+    }
+    // The ring kernels reduce as they go, so only the kernels on the
+    // unreduced product drop out when it no longer fits. mul_cipher is one
+    // of them: its relinearization modulus q*p is too wide for the reducing
+    // product, which falls back to the unreduced one.
+    if (!fits_wide(n))
+      printf("n=%zu: unreduced product kernels skipped, 2n - 1 exceeds "
+             "MAX_POLY_DEGREE (%d)\n",
+             n, MAX_POLY_DEGREE);
+    for (size_t qi = 0; qi < NUM_QS; qi++) {
+      // Products with the secret key must keep n*q below 2^53.
+      if ((double)n * ldexp(1.0, (int)log_qs[qi]) >= ldexp(1.0, 53)) {
+        printf("n=%zu log2q=%.0f skipped: n*q reaches 2^53\n", n,
+               log_qs[qi]);
+        continue;
+      }
+      setup_inputs(n, ldexp(1.0, (int)log_qs[qi]));
+      for (size_t k = 0; k < NUM_KERNELS; k++) {
+        // Kernels that ignore q run once per n.
+        if (!kernels[k].uses_q && qi > 0)
+          continue;
+        if (kernels[k].wide && !fits_wide(n))
+          continue;
+        long reps;
+        double sec = time_kernel(&kernels[k], min_sec, &reps);
+        double bytes = kernels[k].coeffs_moved * n * sizeof(double);
+        char log_q[16] = "-";
+        if (kernels[k].uses_q)
+          snprintf(log_q, sizeof(log_q), "%.0f", log_qs[qi]);
+
+        printf("%-13s %6zu %6s %12.0f %12.1f %12.0f %10.3f\n",
+               kernels[k].name, n, log_q, sec * 1e9, 1.0 / sec, bytes,
+               bytes / sec * 1e-9);
+        if (json) {
+          fprintf(json,
+                  "%s  {\"kernel\": \"%s\", \"n\": %zu, \"log2_q\": %s, "
+                  "\"ns_per_op\": %.1f, \"ops_per_sec\": %.3f, "
+                  "\"bytes_per_op\": %.0f, \"reps\": %ld}",
+                  first_cell ? "" : ",\n", kernels[k].name, n,
+                  kernels[k].uses_q ? log_q : "null", sec * 1e9, 1.0 / sec,
+                  bytes, reps);
+          first_cell = 0;
+        }
+      }
+    }
+    fflush(stdout);
+  }
+  if (json) {
+    fprintf(json, "\n]\n");
+    if (json != stdout)
+      fclose(json);
+  }
+  return 0;
+}
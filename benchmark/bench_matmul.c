@@ -1,5 +1,11 @@
+#include "bench_harness.h"
+#include "../src/ct_matrix.h"
 #include "../src/he.h"
+#include "../src/he_params.h"
+#include "../src/keystore.h"
+#include "../src/packed.h"
 #include "../src/poly_utils.h"
+#include "../src/ring_utils.h"
 
 #include <float.h>
 #include <math.h>
@@ -9,39 +15,40 @@
 #include <string.h>
 #include <time.h>
 
+// Row pointers into one contiguous row-major block, so M[0] is the whole
+// matrix as a flat array.
 static int64_t **alloc_matrix(size_t rows, size_t cols) {
   int64_t **M = (int64_t **)malloc(rows * sizeof(int64_t *));
+  int64_t *data = (int64_t *)calloc(rows * cols, sizeof(int64_t));
   for (size_t i = 0; i < rows; i++) {
-    M[i] = (int64_t *)calloc(cols, sizeof(int64_t));
+    M[i] = data + i * cols;
   }
   return M;
 }
 
-static void free_matrix(int64_t **M, size_t rows) {
-  for (size_t i = 0; i < rows; i++) {
-    free(M[i]);
-  }
+static void free_matrix(int64_t **M) {
+  free(M[0]);
   free(M);
 }
 
-static Ciphertext **alloc_ct_matrix(size_t rows, size_t cols) {
-  Ciphertext **M = (Ciphertext **)malloc(rows * sizeof(Ciphertext *));
-  for (size_t i = 0; i < rows; i++) {
-    M[i] = (Ciphertext *)malloc(cols * sizeof(Ciphertext));
+static void alloc_ct_matrix(CtMatrix *M, size_t rows, size_t cols, size_t n) {
+  if (ct_matrix_init(M, rows, cols, n) != 0) {
+    fprintf(stderr, "Failed to allocate ciphertext matrix\n");
+    exit(1);
   }
-  return M;
 }
 
-static void free_ct_matrix(Ciphertext **M, size_t rows) {
-  for (size_t i = 0; i < rows; i++) {
-    free(M[i]);
-  }
-  free(M);
-}
+static const char *mode_names[] = {"ct*pt", "ct*ct", "packed ct*pt",
+                                   "packed ct*ct"};
+static const char *bench_names[] = {"matmul_ct_pt", "matmul_ct_ct",
+                                    "matmul_packed_ct_pt",
+                                    "matmul_packed_ct_ct"};
 
 int main(int argc, char **argv) {
   srand(42);
-  int mode = 1; // 0 is ct * pt mode, 1 is ct * ct mode
+  // 0 is ct * pt mode, 1 is ct * ct mode; 2 and 3 are the same products with
+  // slot-packed columns (see src/packed.h)
+  int mode = 1;
 
   // Please report runtimes on the following parameters
   size_t dim = 32;
@@ -56,16 +63,71 @@ int main(int argc, char **argv) {
   if (argc >= 4)
     n = (size_t)strtoull(argv[3], NULL, 10);
 
+  if (mode < 0 || mode > 3) {
+    fprintf(stderr, "Unknown mode %d\n", mode);
+    return 1;
+  }
   printf("Matrix size: %zux%zu, Mode: %d (%s)\n", dim, dim, mode,
-         mode == 0 ? "ct*pt" : "ct*ct");
+         mode_names[mode]);
+
+  // Packed modes hold each column of B (and diagonal of A) in one ciphertext,
+  // padded to a power-of-two length dp that divides n/2. Slots need a prime
+  // t = 1 mod 2n, and products of whole plaintext polynomials a larger q:
+  // the largest power of two with n * q below 2^53, which keeps the products
+  // with the secret exact (2^46 for n = 64).
+  int packed = mode >= 2;
+  size_t dp = 1;
+  if (packed) {
+    while (dp < dim)
+      dp *= 2;
+    if (n < 2 * dp)
+      n = 2 * dp;
+    q = (1ll << 53) / (int64_t)(2 * n);
+    t = slot_modulus(n, 257);
+  }
 
-  Poly poly_mod = create_poly();
-  set_coeff(&poly_mod, 0, 1.0);
-  set_coeff(&poly_mod, n, 1.0);
+  // HE_AUTO_PARAMS=1 replaces n and q with the planner's choice for this
+  // circuit; HE_AUTO_PARAMS=bench also times the candidates.
+  const char *auto_params = getenv("HE_AUTO_PARAMS");
+  if (!packed && auto_params != NULL && auto_params[0] != '\0' &&
+      strcmp(auto_params, "0") != 0) {
+    CircuitSpec spec = {(double)t, mode, (int)dim,
+                        mode == 0 ? (double)(t - 1) : 0.0, 0, 1.0,
+                        strcmp(auto_params, "bench") == 0};
+    HEParams planned;
+    if (plan_params(spec, &planned) < 0) {
+      fprintf(stderr, "No parameter set fits this circuit\n");
+      return 1;
+    }
+    n = planned.n;
+    q = (int64_t)planned.q;
+    printf("Planned parameters: n=%zu, q=2^%.0f, estimated budget %.1f bits\n",
+           n, log2(planned.q), plan_budget(spec, planned));
+  }
 
-  KeyPair keys = keygen(n, q, poly_mod);
-  PublicKey pk = keys.pk;
-  SecretKey sk = keys.sk;
+  Poly poly_mod = ring_modulus(n);
+
+  double p = pow(q, 2.0);
+  HEParams params = {.n = n, .q = (double)q, .t = (double)t, .p = p};
+  // HE_RELIN_BASE=<w> relinearizes with base-w digit keys instead of p = q^2;
+  // w must be an integer >= 2.
+  // Packed modes always use digit keys (w = 256 by default), also for their
+  // rotations.
+  const char *relin_base = getenv("HE_RELIN_BASE");
+  if (packed)
+    params.w = 256.0;
+  if (mode != 0 && relin_base != NULL && relin_base[0] != '\0')
+    params.w = atof(relin_base);
+
+  BenchHarness bench;
+  bench_init(&bench, bench_names[mode]);
+  bench_param(&bench, "mode", mode);
+  bench_param(&bench, "dim", dim);
+  bench_param(&bench, "n", n);
+  bench_param(&bench, "log2_q", log2((double)q));
+  bench_param(&bench, "t", t);
+  if (params.w > 0.0)
+    bench_param(&bench, "relin_base", params.w);
 
   // Generate plaintext matrices A, B
   int64_t **A = alloc_matrix(dim, dim);
@@ -80,7 +142,7 @@ int main(int argc, char **argv) {
 
   // Plaintext reference C = A * B (mod t)
   int64_t **C_ref = alloc_matrix(dim, dim);
-  clock_t ref_start = clock();
+  double ref_start = bench_now();
 
   // Plaintext matrix multiplication
   for (size_t i = 0; i < dim; ++i) {
@@ -92,85 +154,167 @@ int main(int argc, char **argv) {
       C_ref[i][k] = acc % t;
     }
   }
-  clock_t ref_end = clock();
-  double ref_sec = ((double)(ref_end - ref_start)) / CLOCKS_PER_SEC;
+  double ref_sec = bench_now() - ref_start;
 
-  // Encrypt B (and optionally A)
-  Ciphertext **B_enc = alloc_ct_matrix(dim, dim);
-  for (size_t j = 0; j < dim; ++j) {
-    for (size_t k = 0; k < dim; ++k) {
-      B_enc[j][k] = encrypt(pk, n, q, poly_mod, t, B[j][k]);
+  CtMatrix B_enc, A_enc, C_enc;
+  if (!packed) {
+    alloc_ct_matrix(&B_enc, dim, dim, n);
+    if (mode == 1)
+      alloc_ct_matrix(&A_enc, dim, dim, n);
+    alloc_ct_matrix(&C_enc, dim, dim, n);
+  }
+  // Packed operands: A zero-padded to dp x dp and its diagonals (plaintext
+  // or encrypted), and one ciphertext per column of B and of C.
+  SlotEncoder enc;
+  PackedKeys packed_keys = {0, NULL};
+  int64_t *A_pad = NULL, *col = NULL;
+  Poly *diag_pts = NULL;
+  Ciphertext *diag_cts = NULL, *B_cols = NULL, *C_cols = NULL;
+  if (packed) {
+    if (slot_encoder_init(&enc, n, t) < 0) {
+      fprintf(stderr, "No slot encoding for n=%zu, t=%ld\n", n, t);
+      return 1;
     }
+    A_pad = (int64_t *)calloc(dp * dp, sizeof(int64_t));
+    col = (int64_t *)calloc(dp, sizeof(int64_t));
+    if (mode == 2)
+      diag_pts = (Poly *)malloc(dp * sizeof(Poly));
+    else
+      diag_cts = (Ciphertext *)malloc(dp * sizeof(Ciphertext));
+    B_cols = (Ciphertext *)malloc(dp * sizeof(Ciphertext));
+    C_cols = (Ciphertext *)malloc(dp * sizeof(Ciphertext));
+    for (size_t i = 0; i < dim; ++i)
+      for (size_t j = 0; j < dim; ++j)
+        A_pad[i * dp + j] = A[i][j];
   }
-
-  Ciphertext **A_enc = NULL;
+  // Unpacked operands, products and accumulator for the ct * ct loop; each is
+  // ~160 KB (~240 KB for a Ciphertext3).
+  Ciphertext *work = (Ciphertext *)malloc(3 * sizeof(Ciphertext));
+  Ciphertext3 *work3 = (Ciphertext3 *)malloc(2 * sizeof(Ciphertext3));
+  int64_t **C_dec = alloc_matrix(dim, dim);
+  KeyPair keys;
   EvalKey evk;
-  double p = pow(q, 2.0);
-  if (mode == 1) {
-    A_enc = alloc_ct_matrix(dim, dim);
-    for (size_t i = 0; i < dim; ++i) {
-      for (size_t j = 0; j < dim; ++j) {
-        A_enc[i][j] = encrypt(pk, n, q, poly_mod, t, A[i][j]);
+  DigitEvalKey digit_evk = {0, 0.0, NULL, NULL};
+
+  while (bench_next_trial(&bench)) {
+    bench_phase_begin(&bench, PHASE_KEYGEN);
+    keystore_get(keystore_dir(), params, poly_mod, &keys,
+                 mode == 1 && params.w == 0.0 ? &evk : NULL);
+    if (packed) {
+      packed_keys_free(&packed_keys);
+      if (packed_keygen(&packed_keys, keys.sk, dp, n, q, &poly_mod,
+                        params.w) < 0) {
+        fprintf(stderr, "Failed to create rotation keys (w = %g)\n", params.w);
+        return 1;
       }
     }
-    evk = evaluate_keygen(sk, n, q, poly_mod, p);
-  }
+    if ((mode == 1 || mode == 3) && params.w > 0.0) {
+      // Digit keys are not cached by the keystore.
+      digit_eval_key_free(&digit_evk);
+      if (evaluate_keygen_digits(&digit_evk, keys.sk, n, q, poly_mod,
+                                 params.w) < 0) {
+        fprintf(stderr, "Failed to create relinearization key (w = %g)\n",
+                params.w);
+        return 1;
+      }
+    }
+    bench_phase_end(&bench, PHASE_KEYGEN);
+    PublicKey pk = keys.pk;
+    SecretKey sk = keys.sk;
 
-  // Encrypted matmul
-  Ciphertext **C_enc = alloc_ct_matrix(dim, dim);
-  clock_t enc_start = clock();
+    // Encrypt B (and optionally A)
+    bench_phase_begin(&bench, PHASE_ENCRYPT);
+    for (size_t k = 0; packed && k < dp; ++k) {
+      for (size_t j = 0; j < dp; ++j)
+        col[j] = j < dim && k < dim ? B[j][k] : 0;
+      packed_encrypt(&B_cols[k], &enc, &pk, q, &poly_mod, col, dp);
+    }
+    if (mode == 2)
+      packed_encode_diagonals(diag_pts, &enc, A_pad, dp);
+    if (mode == 3)
+      packed_encrypt_diagonals(diag_cts, &enc, &pk, q, &poly_mod, A_pad, dp);
 
-  if (mode == 0) {
-    // Mode 0: ct * pt matmul: C_enc[i][k] = sum_j A[i][j] * Enc(B[j][k])
-    for (size_t i = 0; i < dim; ++i) {
+    for (size_t j = 0; !packed && j < dim; ++j) {
       for (size_t k = 0; k < dim; ++k) {
-        int first = 1;
-        Ciphertext acc_ct;
+        work[0] = encrypt(pk, n, q, poly_mod, t, B[j][k]);
+        ct_matrix_store(&B_enc, j, k, &work[0]);
+      }
+    }
 
+    if (mode == 1) {
+      for (size_t i = 0; i < dim; ++i) {
         for (size_t j = 0; j < dim; ++j) {
-          Ciphertext term = mul_plain(B_enc[j][k], q, t, poly_mod, A[i][j]);
-          if (first) {
-            acc_ct = term;
-            first = 0;
-          } else {
-            acc_ct = add_cipher(acc_ct, term, q, poly_mod);
-          }
+          work[0] = encrypt(pk, n, q, poly_mod, t, A[i][j]);
+          ct_matrix_store(&A_enc, i, j, &work[0]);
         }
-        C_enc[i][k] = acc_ct;
       }
     }
-  } else {
-    // Mode 1: ct * ct matmul: C_enc[i][k] = sum_j Enc(A[i][j]) * Enc(B[j][k])
-    for (size_t i = 0; i < dim; ++i) {
-      for (size_t k = 0; k < dim; ++k) {
-        int first = 1;
-        Ciphertext acc_ct;
 
-        for (size_t j = 0; j < dim; ++j) {
-          Ciphertext term =
-              mul_cipher(A_enc[i][j], B_enc[j][k], q, t, p, poly_mod, evk);
-          if (first) {
-            acc_ct = term;
-            first = 0;
-          } else {
-            acc_ct = add_cipher(acc_ct, term, q, poly_mod);
+    bench_phase_end(&bench, PHASE_ENCRYPT);
+
+    // Encrypted matmul
+    bench_phase_begin(&bench, PHASE_EVAL);
+
+    if (mode == 0) {
+      // Mode 0: ct * pt matmul: C_enc[i][k] = sum_j A[i][j] * Enc(B[j][k])
+      ct_gemm_plain(&C_enc, A[0], &B_enc, q, t);
+    } else if (mode == 2) {
+      // Mode 2: packed ct * pt, one diagonal-method product per column of B.
+      for (size_t k = 0; k < dp; ++k)
+        packed_matvec_plain(&C_cols[k], diag_pts, &B_cols[k], &packed_keys, q,
+                            t, &poly_mod);
+    } else if (mode == 3) {
+      // Mode 3: packed ct * ct with encrypted diagonals of A.
+      for (size_t k = 0; k < dp; ++k)
+        packed_matvec(&C_cols[k], diag_cts, &B_cols[k], &packed_keys,
+                      &digit_evk, q, t, &poly_mod);
+    } else {
+      // Mode 1: ct * ct matmul: C_enc[i][k] = sum_j Enc(A[i][j]) * Enc(B[j][k])
+      // The products are summed before relinearization, so each output is
+      // relinearized once instead of once per term.
+      Ciphertext *a_ct = &work[0], *b_ct = &work[1], *c_ct = &work[2];
+      Ciphertext3 *term = &work3[0], *acc_ct = &work3[1];
+      for (size_t i = 0; i < dim; ++i) {
+        for (size_t k = 0; k < dim; ++k) {
+          for (size_t j = 0; j < dim; ++j) {
+            ct_matrix_load(&A_enc, i, j, a_ct);
+            ct_matrix_load(&B_enc, j, k, b_ct);
+            if (j == 0) {
+              mul_cipher_no_relin(acc_ct, a_ct, b_ct, q, t, &poly_mod);
+            } else {
+              mul_cipher_no_relin(term, a_ct, b_ct, q, t, &poly_mod);
+              add_cipher3(acc_ct, term, q, &poly_mod);
+            }
           }
+          if (params.w > 0.0)
+            relinearize_digits(c_ct, acc_ct, q, &poly_mod, &digit_evk);
+          else
+            relinearize(c_ct, acc_ct, q, p, &poly_mod, &evk);
+          ct_matrix_store(&C_enc, i, k, c_ct);
         }
-        C_enc[i][k] = acc_ct;
       }
     }
-  }
 
-  // Decrypt result matrix
-  int64_t **C_dec = alloc_matrix(dim, dim);
-  for (size_t i = 0; i < dim; ++i) {
-    for (size_t k = 0; k < dim; ++k) {
-      C_dec[i][k] = decrypt(sk, n, q, poly_mod, t, C_enc[i][k]);
+    bench_phase_end(&bench, PHASE_EVAL);
+
+    // Decrypt result matrix
+    bench_phase_begin(&bench, PHASE_DECRYPT);
+    for (size_t k = 0; packed && k < dim; ++k) {
+      packed_decrypt(col, dp, &enc, &sk, q, &poly_mod, &C_cols[k]);
+      for (size_t i = 0; i < dim; ++i)
+        C_dec[i][k] = col[i];
+    }
+    for (size_t i = 0; !packed && i < dim; ++i) {
+      for (size_t k = 0; k < dim; ++k) {
+        ct_matrix_load(&C_enc, i, k, &work[0]);
+        C_dec[i][k] = decrypt(sk, n, q, poly_mod, t, work[0]);
+      }
     }
-  }
 
-  clock_t enc_end = clock();
-  double enc_sec = ((double)(enc_end - enc_start)) / CLOCKS_PER_SEC;
+    bench_phase_end(&bench, PHASE_DECRYPT);
+  }
+  double enc_sec =
+      bench_last(&bench, PHASE_EVAL) + bench_last(&bench, PHASE_DECRYPT);
 
   // Relative error (Frobenius): ||C_dec - C_ref||_F / ||C_ref||_F
   long double diff_acc = 0.0L;
@@ -194,6 +338,15 @@ int main(int argc, char **argv) {
 
   printf("ref_time_sec=%f, enc_time_sec=%f, rel_err=%f\n", ref_sec, enc_sec,
          rel_err);
+  if (packed)
+    work[0] = C_cols[0];
+  else
+    ct_matrix_load(&C_enc, 0, 0, &work[0]);
+  printf("Noise budget of C[0][0]: ");
+  bench_print_budget("estimated", noise_budget_estimate(work[0], q, t));
+  printf(", measured %.1f bits\n",
+         noise_budget(keys.sk, n, q, poly_mod, t, work[0]));
+  bench_metric(&bench, "rel_err", rel_err);
 
   size_t show = (3 < dim) ? 3 : dim;
   printf("C_ref (top %zux%zu):\n", show, show);
@@ -216,15 +369,32 @@ int main(int argc, char **argv) {
     printf("\n");
   }
 
-  free_matrix(A, dim);
-  free_matrix(B, dim);
-  free_matrix(C_ref, dim);
-  free_matrix(C_dec, dim);
-  free_ct_matrix(B_enc, dim);
-  free_ct_matrix(C_enc, dim);
+  bench_report(&bench);
+
+  free_matrix(A);
+  free_matrix(B);
+  free_matrix(C_ref);
+  free_matrix(C_dec);
+  if (packed) {
+    slot_encoder_free(&enc);
+    packed_keys_free(&packed_keys);
+    free(A_pad);
+    free(col);
+    free(diag_pts);
+    free(diag_cts);
+    free(B_cols);
+    free(C_cols);
+  } else {
+    ct_matrix_free(&B_enc);
+    ct_matrix_free(&C_enc);
+  }
   if (mode == 1) {
-    free_ct_matrix(A_enc, dim);
+    ct_matrix_free(&A_enc);
   }
+  free(work);
+  free(work3);
+  digit_eval_key_free(&digit_evk);
+  bench_free(&bench);
 
   return 0;
 }
\ No newline at end of file
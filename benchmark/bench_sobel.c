@@ -1,19 +1,29 @@
+#define _POSIX_C_SOURCE 200809L
 #define STB_IMAGE_IMPLEMENTATION
 #include "../external/stb_image.h"
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "../external/stb_image_write.h"
 
+#include "bench_harness.h"
+#include "../src/circuit.h"
 #include "../src/he.h"
+#include "../src/instrument.h"
+#include "../src/keystore.h"
+#include "../src/net_utils.h"
 #include "../src/poly_utils.h"
+#include "../src/ring_utils.h"
 
 #include <assert.h>
 #include <float.h>
 #include <math.h>
+#include <signal.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/wait.h>
 #include <time.h>
+#include <unistd.h>
 #include <omp.h>
 
 typedef struct {
@@ -90,66 +100,329 @@ static void sobel_plain(uint8_t *input, uint8_t *output, int width,
   }
 }
 
-Ciphertext encode_zero(int64_t q, Poly poly_mod) {
+Ciphertext encode_zero(int64_t q) {
   Ciphertext ct;
   ct.c0 = encode_plain_integer(q, 0);
   ct.c1 = encode_plain_integer(q, 0);
+  ct.noise = 0.0;
   return ct;
 }
 
-static void sobel_fhe(Ciphertext *input_enc, Ciphertext *output_enc, int width,
-                      int height, int64_t q, int64_t t, Poly poly_mod) {
-
-  #pragma omp parallel for collapse(2) num_threads(4)
-  for (int y = 1; y < height - 1; y++) {
-    for (int x = 1; x < width - 1; x++) {
-      Ciphertext gx = encode_zero(q, poly_mod);
-      Ciphertext gy = encode_zero(q, poly_mod);
-
+// Sobel as a circuit over the tile's pixels. Recorded as written, gx and gy
+// take twelve scalings and twelve additions per pixel; circuit_optimize folds
+// the two kernels into one with coefficients {-2, 2} and leaves two scalings
+// and five additions. The border outputs scale by 0 and become one zero.
+static int sobel_record(Circuit *c, int width, int height, int64_t t) {
+  circuit_init(c);
+  for (int i = 0; i < width * height; i++)
+    circuit_input(c);
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      if (y == 0 || x == 0 || y == height - 1 || x == width - 1) {
+        circuit_output(c, circuit_scale(c, y * width + x, 0));
+        continue;
+      }
+      int gx = -1, gy = -1;
       for (int ky = -1; ky <= 1; ky++) {
         for (int kx = -1; kx <= 1; kx++) {
-          Ciphertext pixel = input_enc[(y + ky) * width + (x + kx)];
+          int pixel = (y + ky) * width + (x + kx);
+          int tx = circuit_scale(c, pixel, sobel_gx[ky + 1][kx + 1]);
+          int ty = circuit_scale(c, pixel, sobel_gy[ky + 1][kx + 1]);
+          gx = gx < 0 ? tx : circuit_add(c, gx, tx);
+          gy = gy < 0 ? ty : circuit_add(c, gy, ty);
+        }
+      }
+      circuit_output(c, circuit_add(c, gx, gy));
+    }
+  }
+  return circuit_optimize(c, (double)t);
+}
 
-          int coeff_gx = sobel_gx[ky + 1][kx + 1];
-          int coeff_gy = sobel_gy[ky + 1][kx + 1];
+// Optimized Sobel circuits by buffered tile shape. Tiles differ only in
+// whether they have a border row or column on each side and in the size of
+// the last row and column, so a run sees at most nine shapes; each is
+// recorded and optimized once and then run on every tile of that shape.
+#define SOBEL_SHAPES 9
 
-          if (coeff_gx != 0) {
-            Ciphertext term = mul_plain(pixel, q, t, poly_mod, coeff_gx);
-            gx = add_cipher(gx, term, q, poly_mod);
-          }
+typedef struct {
+  int width[SOBEL_SHAPES];
+  int height[SOBEL_SHAPES];
+  Circuit circuit[SOBEL_SHAPES];
+  int count;
+} SobelCircuits;
+
+static void sobel_circuits_free(SobelCircuits *s) {
+  for (int i = 0; i < s->count; i++)
+    circuit_free(&s->circuit[i]);
+  s->count = 0;
+}
 
-          if (coeff_gy != 0) {
-            Ciphertext term = mul_plain(pixel, q, t, poly_mod, coeff_gy);
-            gy = add_cipher(gy, term, q, poly_mod);
-          }
-        }
-      }
+static void sobel_fhe(SobelCircuits *s, Ciphertext *input_enc,
+                      Ciphertext *output_enc, int width, int height, int64_t q,
+                      int64_t t, Poly poly_mod) {
+  int i = 0;
+  while (i < s->count && (s->width[i] != width || s->height[i] != height))
+    i++;
+  if (i == s->count) {
+    assert(s->count < SOBEL_SHAPES);
+    s->width[i] = width;
+    s->height[i] = height;
+    s->count++;
+    if (sobel_record(&s->circuit[i], width, height, t) < 0) {
+      fprintf(stderr, "Sobel circuit failed\n");
+      exit(1);
+    }
+  }
+
+  CircuitEval eval = {(double)q, (double)t, &poly_mod, 0.0, NULL, NULL, 4};
+  if (circuit_run(&s->circuit[i], &eval, input_enc, output_enc) < 0) {
+    fprintf(stderr, "Sobel circuit failed\n");
+    exit(1);
+  }
+}
+
+typedef struct {
+  int row_start;
+  int col_start;
+  int tile_height;
+  int tile_width;
+  int buffer[4]; // top, bottom, left, right halo rows/cols
+  int buffered_height;
+  int buffered_width;
+} Tile;
+
+static Tile tile_at(int tr, int tc, int tile_h, int tile_w, int width,
+                    int height) {
+  Tile tile;
+  tile.row_start = tr * tile_h;
+  tile.col_start = tc * tile_w;
+  int row_end = (tile.row_start + tile_h > height) ? height : tile.row_start + tile_h;
+  int col_end = (tile.col_start + tile_w > width)  ? width  : tile.col_start + tile_w;
+
+  tile.tile_height = row_end - tile.row_start;
+  tile.tile_width = col_end - tile.col_start;
+
+  tile.buffer[0] = (tile.row_start > 0) ? 1 : 0;  // top
+  tile.buffer[1] = (row_end < height) ? 1 : 0;    // bottom
+  tile.buffer[2] = (tile.col_start > 0) ? 1 : 0;  // left
+  tile.buffer[3] = (col_end < width) ? 1 : 0;     // right
+
+  tile.buffered_height = tile.tile_height + tile.buffer[0] + tile.buffer[1];
+  tile.buffered_width = tile.tile_width + tile.buffer[2] + tile.buffer[3];
+  return tile;
+}
+
+static size_t tile_count(Tile tile) {
+  return (size_t)tile.buffered_width * tile.buffered_height;
+}
 
-      output_enc[y * width + x] = add_cipher(gx, gy, q, poly_mod);
+static void require_io(int rc) {
+  if (rc < 0) {
+    fprintf(stderr, "Tile store I/O failed\n");
+    exit(1);
+  }
+}
+
+// The image owner holds the secret key, so tiles use secret-key encryption.
+// `values` stages the buffered tile for the batched call, which runs on at
+// most four threads like the other tile loops: with workers, the coordinator
+// encrypts the next tile while they evaluate theirs.
+static void encrypt_tile(Tile tile, uint8_t *gray, int width, double *values,
+                         Ciphertext *gray_enc, SecretKey sk, size_t n,
+                         int64_t q, int64_t t, Poly poly_mod) {
+  for (int r = 0; r < tile.buffered_height; r++) {
+    for (int c = 0; c < tile.buffered_width; c++) {
+      int og_image_idx = (tile.row_start - tile.buffer[0] + r) * width + (tile.col_start - tile.buffer[2] + c);
+      values[r * tile.buffered_width + c] = gray[og_image_idx];
     }
   }
+  size_t count = (size_t)tile.buffered_width * tile.buffered_height;
+  int threads = omp_get_max_threads();
+  omp_set_num_threads(threads < 4 ? threads : 4);
+  encrypt_sk_many(&sk, n, q, &poly_mod, t, values, count, gray_enc);
+  omp_set_num_threads(threads);
+}
 
-  Ciphertext zero = encode_zero(q, poly_mod);
-  #pragma omp parallel for num_threads(4)
-  for (int x = 0; x < width; x++) {
-    output_enc[x] = zero;
-    output_enc[(height - 1) * width + x] = zero;
+// `sobel_enc` is indexed with `stride` columns starting at (`top`, `left`).
+static void decrypt_tile(Tile tile, Ciphertext *sobel_enc, int stride,
+                         int top, int left, uint8_t *fhe_sobel, int width,
+                         SecretKey sk, size_t n, int64_t q, int64_t t,
+                         Poly poly_mod) {
+  #pragma omp parallel for collapse(2) num_threads(4)
+  for (int r = 0; r < tile.tile_height; r++) {
+    for (int c = 0; c < tile.tile_width; c++) {
+      int idx = (r + top) * stride + (c + left);
+
+      int64_t val = decrypt(sk, n, q, poly_mod, t, sobel_enc[idx]);
+      if (val > t / 2)
+        val = t - val;
+      if (val > 255)
+        val = 255;
+      fhe_sobel[(tile.row_start + r) * width + tile.col_start + c] = (uint8_t)val;
+    }
   }
-  #pragma omp parallel for num_threads(4)
-  for (int y = 0; y < height; y++) {
-    output_enc[y * width] = zero;
-    output_enc[y * width + (width - 1)] = zero;
+}
+
+// Coordinator/worker protocol. After connecting, a worker receives one
+// WorkerParams message, then any number of (TileHeader, buffered ciphertexts)
+// requests, each answered with the tile's interior Sobel ciphertexts
+// mod-switched down to q_out. A header with buffered_width == 0 asks the
+// worker to exit.
+typedef struct {
+  uint64_t n;
+  double q;
+  double t;
+  double q_out;
+} WorkerParams;
+
+typedef struct {
+  int32_t buffered_width;
+  int32_t buffered_height;
+  int32_t top;
+  int32_t left;
+  int32_t tile_width;
+  int32_t tile_height;
+} TileHeader;
+
+static int run_sobel_worker(const char *addr) {
+  int fd = -1;
+  struct timespec retry = {0, 100000000};
+  for (int attempt = 0; attempt < 100 && fd < 0; attempt++) {
+    fd = net_connect(addr);
+    if (fd < 0)
+      nanosleep(&retry, NULL);
+  }
+  if (fd < 0) {
+    fprintf(stderr, "Worker failed to connect to %s\n", addr);
+    return 1;
+  }
+
+  WorkerParams params;
+  if (net_recv_all(fd, &params, sizeof(params)) < 0) {
+    net_close(fd);
+    return 1;
   }
+  size_t n = (size_t)params.n;
+  int64_t q = (int64_t)params.q;
+  int64_t t = (int64_t)params.t;
+
+  Poly poly_mod = ring_modulus(n);
+
+  size_t ct_bytes = ciphertext_wire_size(n, q);
+  size_t capacity = 0;
+  Ciphertext *in_enc = NULL;
+  Ciphertext *out_enc = NULL;
+  uint8_t *wire = NULL;
+  SobelCircuits circuits = {.count = 0};
+
+  TileHeader hdr;
+  while (net_recv_all(fd, &hdr, sizeof(hdr)) == 0 && hdr.buffered_width > 0) {
+    size_t count = (size_t)hdr.buffered_width * hdr.buffered_height;
+    if (count > capacity) {
+      free(in_enc);
+      free(out_enc);
+      free(wire);
+      in_enc = (Ciphertext *)malloc(count * sizeof(Ciphertext));
+      out_enc = (Ciphertext *)malloc(count * sizeof(Ciphertext));
+      wire = (uint8_t *)malloc(count * ct_bytes);
+      capacity = count;
+    }
+    if (net_recv_all(fd, wire, count * ct_bytes) < 0)
+      break;
+    INSTR_SPAN_BEGIN(tile_start);
+    deserialize_ciphertexts(wire, count, n, q, in_enc);
+
+    sobel_fhe(&circuits, in_enc, out_enc, hdr.buffered_width,
+              hdr.buffered_height, q, t, poly_mod);
+
+    // Compact the interior into in_enc, switching to the smaller modulus.
+    #pragma omp parallel for collapse(2) num_threads(4)
+    for (int r = 0; r < hdr.tile_height; r++) {
+      for (int c = 0; c < hdr.tile_width; c++) {
+        Ciphertext ct = out_enc[(r + hdr.top) * hdr.buffered_width + hdr.left + c];
+        in_enc[r * hdr.tile_width + c] = mod_switch(ct, q, params.q_out, n);
+      }
+    }
+    size_t interior = (size_t)hdr.tile_width * hdr.tile_height;
+    uint8_t *out = wire + serialize_ciphertexts(in_enc, interior, n, params.q_out, wire);
+    INSTR_SPAN_END(tile_start, "worker tile");
+    if (net_send_all(fd, wire, (size_t)(out - wire)) < 0)
+      break;
+  }
+
+  sobel_circuits_free(&circuits);
+  free(in_enc);
+  free(out_enc);
+  free(wire);
+  net_close(fd);
+  return 0;
+}
+
+// Forked workers still running. Registered with atexit so that every exit
+// path of the coordinator, including exit(1) in the helpers above, kills and
+// reaps them instead of leaving them blocked on the socket.
+static pid_t *live_workers;
+static int live_worker_count;
+
+static void stop_workers(void) {
+  for (int w = 0; w < live_worker_count; w++) {
+    kill(live_workers[w], SIGKILL);
+    waitpid(live_workers[w], NULL, 0);
+  }
+  live_worker_count = 0;
 }
 
 int main(int argc, char **argv) {
   srand(42);
+  if (argc >= 3 && strcmp(argv[1], "--worker") == 0) {
+    return run_sobel_worker(argv[2]);
+  }
   if (argc < 2) {
-    fprintf(stderr, "Usage: %s <input_image>\n", argv[0]);
+    fprintf(stderr, "Usage: %s <input_image> [workers] [address]\n", argv[0]);
+    fprintf(stderr, "       %s --worker <address>\n", argv[0]);
     return 1;
   }
 
   const char *input_path = argv[1];
+  int num_workers = (argc >= 3) ? atoi(argv[2]) : 0;
+  char worker_addr[108];
+  if (argc >= 4) {
+    snprintf(worker_addr, sizeof(worker_addr), "%s", argv[3]);
+  } else {
+    snprintf(worker_addr, sizeof(worker_addr), "/tmp/bench_sobel.%d.sock",
+             (int)getpid());
+  }
+
+  // Workers are forked before any OpenMP region runs in this process, since
+  // the OpenMP runtime does not survive fork() in the child.
+  int listen_fd = -1;
+  int *worker_fds = NULL;
+  pid_t *worker_pids = NULL;
+  if (num_workers > 0) {
+    listen_fd = net_listen(worker_addr);
+    if (listen_fd < 0) {
+      fprintf(stderr, "Failed to listen on %s\n", worker_addr);
+      return 1;
+    }
+    worker_fds = (int *)malloc(num_workers * sizeof(int));
+    worker_pids = (pid_t *)malloc(num_workers * sizeof(pid_t));
+    live_workers = worker_pids;
+    atexit(stop_workers);
+    for (int w = 0; w < num_workers; w++) {
+      worker_pids[w] = fork();
+      if (worker_pids[w] < 0) {
+        fprintf(stderr, "Failed to start worker %d\n", w);
+        exit(1);
+      }
+      if (worker_pids[w] == 0) {
+        // The handler is inherited; a worker must not stop its siblings.
+        live_worker_count = 0;
+        net_close(listen_fd);
+        exit(run_sobel_worker(worker_addr));
+      }
+      live_worker_count = w + 1;
+    }
+  }
 
   // Please report runtimes on the following parameters
   size_t n = 1u << 4;
@@ -166,103 +439,287 @@ int main(int argc, char **argv) {
 
   int total_pixels = img.width * img.height;
 
-  Poly poly_mod = create_poly();
-  set_coeff(&poly_mod, 0, 1);
-  set_coeff(&poly_mod, n, 1);
-
-  printf("Generating keys...\n");
-  KeyPair keys = keygen(n, q, poly_mod);
-  PublicKey pk = keys.pk;
-  SecretKey sk = keys.sk;
+  Poly poly_mod = ring_modulus(n);
 
-  uint8_t *fhe_sobel = malloc(total_pixels * sizeof(uint8_t));
+  HEParams params = {.n = n, .q = (double)q, .t = (double)t};
 
-  printf("Encrypting grayscale image...\n");
+  BenchHarness bench;
+  bench_init(&bench, num_workers > 0 ? "sobel_workers" : "sobel");
+  bench_param(&bench, "width", img.width);
+  bench_param(&bench, "height", img.height);
+  bench_param(&bench, "n", n);
+  bench_param(&bench, "log2_q", log2((double)q));
+  bench_param(&bench, "t", t);
+  bench_param(&bench, "workers", num_workers);
+  ArenaPages pages = bench_placement(&bench);
 
-  double enc_start = omp_get_wtime();
+  uint8_t *fhe_sobel = malloc(total_pixels * sizeof(uint8_t));
 
+  // The tiling follows the image, not the worker count: the tiles are handed
+  // out round-robin, so workers beyond the tile count stay idle.
   int tRows = 2;
   int tCols = 2;
   int tile_h = (img.height + tRows - 1) / tRows;
   int tile_w = (img.width  + tCols - 1) / tCols;
 
-  Ciphertext *gray_enc  = (Ciphertext *)malloc((size_t)(tile_h+2) * (tile_w+2) * sizeof(Ciphertext));
-  Ciphertext *sobel_enc = (Ciphertext *)malloc((size_t)(tile_h+2) * (tile_w+2) * sizeof(Ciphertext));
-  uint8_t *fhe_sobel_temp = (uint8_t *)malloc((size_t)(tile_h*tile_w) * sizeof(uint8_t));
-
-  for (int tr = 0; tr < tRows; tr++) {
-    for (int tc = 0; tc < tCols; tc++) {
-      int row_start = tr * tile_h;
-      int col_start = tc * tile_w;
-      int row_end = (row_start + tile_h > img.height) ? img.height : row_start + tile_h;
-      int col_end = (col_start + tile_w > img.width)  ? img.width  : col_start + tile_w;
-
-      int tile_height = row_end - row_start;
-      int tile_width = col_end - col_start;
-      int tile_pixels = tile_height * tile_width;
-
-      int buffer[4] = {
-          (row_start > 0) ? 1 : 0,  // top
-          (row_end   < img.height) ? 1 : 0,  // bottom
-          (col_start > 0) ? 1 : 0,  // left
-          (col_end   < img.width) ? 1 : 0   // right
-      };
-
-      int buffered_height = tile_height + buffer[0] + buffer[1];
-      int buffered_width = tile_width  + buffer[2] + buffer[3];
-
-      #pragma omp parallel for collapse(2) num_threads(4)
-      for (int r = 0; r < buffered_height; r++) {
-        for (int c = 0; c < buffered_width; c++) {
-          int og_image_idx = (row_start - buffer[0] + r) * img.width + (col_start - buffer[2] + c);
-          int buffered_idx = r * buffered_width + c;
-          gray_enc[buffered_idx] = encrypt(pk, n, q, poly_mod, t, gray[og_image_idx]);
-        }
+  // The two ciphertext arrays of a buffered tile.
+  size_t tile_cts = (size_t)(tile_h + 2) * (tile_w + 2);
+  Arena arena;
+  if (arena_init_pages(&arena, 2 * tile_cts * sizeof(Ciphertext) + 2 * ARENA_ALIGN,
+                       pages) != 0) {
+    fprintf(stderr, "Failed to allocate tile arena\n");
+    return 1;
+  }
+  Ciphertext *gray_enc  = arena_alloc_cts(&arena, tile_cts);
+  Ciphertext *sobel_enc = arena_alloc_cts(&arena, tile_cts);
+  BenchTileStore tile_store;
+  // Workers receive their tiles over the socket instead.
+  int stored = num_workers == 0
+                   ? bench_tile_store_open(&tile_store, &bench, n, (double)q,
+                                           tile_cts, tile_cts)
+                   : 0;
+  if (stored < 0) {
+    fprintf(stderr, "Failed to open tile store\n");
+    return 1;
+  }
+  double *gray_values = (double *)malloc((size_t)(tile_h+2) * (tile_w+2) * sizeof(double));
+
+  double q_out = mod_switch_modulus(n, t);
+  uint8_t *wire = NULL;
+  Tile *round_tiles = NULL;
+  if (num_workers > 0) {
+    WorkerParams worker_params = {(uint64_t)n, (double)q, (double)t, q_out};
+    for (int w = 0; w < num_workers; w++) {
+      worker_fds[w] = net_accept(listen_fd);
+      if (worker_fds[w] < 0 ||
+          net_send_all(worker_fds[w], &worker_params, sizeof(worker_params)) < 0) {
+        fprintf(stderr, "Failed to set up worker %d\n", w);
+        return 1;
+      }
+    }
+    net_close(listen_fd);
+    unlink(worker_addr);
+
+    size_t wire_bytes = (size_t)(tile_h + 2) * (tile_w + 2) * ciphertext_wire_size(n, q);
+    wire = (uint8_t *)malloc(wire_bytes);
+    round_tiles = (Tile *)malloc(num_workers * sizeof(Tile));
+  }
+
+  SobelCircuits circuits = {.count = 0};
+  KeyPair keys;
+  while (bench_next_trial(&bench)) {
+    printf("Loading keys...\n");
+    bench_phase_begin(&bench, PHASE_KEYGEN);
+    int generated = keystore_get(keystore_dir(), params, poly_mod, &keys, NULL);
+    bench_phase_end(&bench, PHASE_KEYGEN);
+    if (generated)
+      printf("Generated new keys\n");
+    SecretKey sk = keys.sk;
+
+    printf("Encrypting grayscale image...\n");
+
+    if (num_workers == 0 && stored) {
+      // Every tile is encrypted and written out, then read back and
+      // evaluated with the next one read ahead and the previous result
+      // written behind, then the results are read back and decrypted the
+      // same way. The first result's noise is reported as read back, which
+      // carries no estimate.
+      int total_tiles = tRows * tCols;
+      for (int idx = 0; idx < total_tiles; idx++) {
+        Tile tile = tile_at(idx / tCols, idx % tCols, tile_h, tile_w,
+                            img.width, img.height);
+        bench_phase_begin(&bench, PHASE_ENCRYPT);
+        encrypt_tile(tile, gray, img.width, gray_values, gray_enc, sk, n, q,
+                     t, poly_mod);
+        require_io(tile_file_write(&tile_store.in, idx, gray_enc,
+                                   tile_count(tile)));
+        bench_phase_end(&bench, PHASE_ENCRYPT);
       }
 
       printf("Applying FHE Sobel edge detection...\n");
-      sobel_fhe(gray_enc, sobel_enc, buffered_width, buffered_height, q, t, poly_mod);
+      bench_phase_begin(&bench, PHASE_EVAL);
+      require_io(tile_file_prefetch(
+          &tile_store.in, 0,
+          tile_count(tile_at(0, 0, tile_h, tile_w, img.width, img.height))));
+      for (int idx = 0; idx < total_tiles; idx++) {
+        Tile tile = tile_at(idx / tCols, idx % tCols, tile_h, tile_w,
+                            img.width, img.height);
+        require_io(tile_file_read(&tile_store.in, idx, gray_enc,
+                                  tile_count(tile)));
+        if (idx + 1 < total_tiles) {
+          Tile next = tile_at((idx + 1) / tCols, (idx + 1) % tCols, tile_h,
+                              tile_w, img.width, img.height);
+          require_io(tile_file_prefetch(&tile_store.in, idx + 1,
+                                        tile_count(next)));
+        }
+        sobel_fhe(&circuits, gray_enc, sobel_enc, tile.buffered_width,
+                  tile.buffered_height, q, t, poly_mod);
+        require_io(tile_file_write(&tile_store.out, idx, sobel_enc,
+                                   tile_count(tile)));
+      }
+      bench_phase_end(&bench, PHASE_EVAL);
 
       printf("Decrypting FHE Sobel result...\n");
-      #pragma omp parallel for collapse(2) num_threads(4)
-      for (int r = 0; r < tile_height; r++) {
-        for (int c = 0; c < tile_width; c++) {
-          int buffered_idx = (r + buffer[0]) * buffered_width + (c + buffer[2]);
-
-          int64_t val = decrypt(sk, n, q, poly_mod, t, sobel_enc[buffered_idx]);
-          if (val > t / 2)
-            val = t - val;
-          if (val > 255)
-            val = 255;
-          fhe_sobel_temp[r * tile_width + c] = (uint8_t)val;
+      bench_phase_begin(&bench, PHASE_DECRYPT);
+      require_io(tile_file_prefetch(
+          &tile_store.out, 0,
+          tile_count(tile_at(0, 0, tile_h, tile_w, img.width, img.height))));
+      for (int idx = 0; idx < total_tiles; idx++) {
+        Tile tile = tile_at(idx / tCols, idx % tCols, tile_h, tile_w,
+                            img.width, img.height);
+        require_io(tile_file_read(&tile_store.out, idx, sobel_enc,
+                                  tile_count(tile)));
+        if (idx + 1 < total_tiles) {
+          Tile next = tile_at((idx + 1) / tCols, (idx + 1) % tCols, tile_h,
+                              tile_w, img.width, img.height);
+          require_io(tile_file_prefetch(&tile_store.out, idx + 1,
+                                        tile_count(next)));
+        }
+        if (idx == 0 && bench_first_trial(&bench)) {
+          bench_phase_end(&bench, PHASE_DECRYPT);
+          bench_report_noise(sobel_enc, tile_count(tile), &sk, n, q, t,
+                             &poly_mod);
+          bench_phase_begin(&bench, PHASE_DECRYPT);
         }
+        decrypt_tile(tile, sobel_enc, tile.buffered_width, tile.buffer[0],
+                     tile.buffer[2], fhe_sobel, img.width, sk, n, q, t,
+                     poly_mod);
       }
+      bench_phase_end(&bench, PHASE_DECRYPT);
+    } else if (num_workers == 0) {
+      for (int tr = 0; tr < tRows; tr++) {
+        for (int tc = 0; tc < tCols; tc++) {
+          INSTR_SPAN_BEGIN(tile_start);
+          Tile tile = tile_at(tr, tc, tile_h, tile_w, img.width, img.height);
+
+          bench_phase_begin(&bench, PHASE_ENCRYPT);
+          encrypt_tile(tile, gray, img.width, gray_values, gray_enc, sk, n, q,
+                       t, poly_mod);
+          bench_phase_end(&bench, PHASE_ENCRYPT);
+
+          printf("Applying FHE Sobel edge detection...\n");
+          bench_phase_begin(&bench, PHASE_EVAL);
+          sobel_fhe(&circuits, gray_enc, sobel_enc, tile.buffered_width,
+                    tile.buffered_height, q, t, poly_mod);
+          bench_phase_end(&bench, PHASE_EVAL);
+
+          if (tr == 0 && tc == 0 && bench_first_trial(&bench)) {
+            bench_report_noise(sobel_enc,
+                               tile.buffered_width * tile.buffered_height, &sk,
+                               n, q, t, &poly_mod);
+          }
 
-      for (int r = 0; r < tile_height; r++) {
-        memcpy(&fhe_sobel[(row_start + r) * img.width + col_start], &fhe_sobel_temp[r * tile_width], (size_t)tile_width * sizeof(uint8_t));
+          printf("Decrypting FHE Sobel result...\n");
+          bench_phase_begin(&bench, PHASE_DECRYPT);
+          decrypt_tile(tile, sobel_enc, tile.buffered_width, tile.buffer[0],
+                       tile.buffer[2], fhe_sobel, img.width, sk, n, q, t, poly_mod);
+          bench_phase_end(&bench, PHASE_DECRYPT);
+          INSTR_SPAN_END(tile_start, "tile");
+        }
+      }
+    } else {
+      // Tiles go out in rounds of one per worker; a worker evaluates its tile
+      // while the coordinator encrypts and sends the next worker's tile. The
+      // eval phase covers serialization and the round trip to the workers.
+      int total_tiles = tRows * tCols;
+      for (int first = 0; first < total_tiles; first += num_workers) {
+        int round = total_tiles - first;
+        if (round > num_workers)
+          round = num_workers;
+
+        printf("Distributing FHE Sobel tiles %d-%d to %d workers...\n", first,
+               first + round - 1, round);
+        for (int w = 0; w < round; w++) {
+          int idx = first + w;
+          Tile tile = tile_at(idx / tCols, idx % tCols, tile_h, tile_w,
+                              img.width, img.height);
+          round_tiles[w] = tile;
+
+          bench_phase_begin(&bench, PHASE_ENCRYPT);
+          encrypt_tile(tile, gray, img.width, gray_values, gray_enc, sk, n, q,
+                       t, poly_mod);
+          bench_phase_end(&bench, PHASE_ENCRYPT);
+
+          bench_phase_begin(&bench, PHASE_EVAL);
+          TileHeader hdr = {tile.buffered_width, tile.buffered_height,
+                            tile.buffer[0],      tile.buffer[2],
+                            tile.tile_width,     tile.tile_height};
+          size_t count = (size_t)tile.buffered_width * tile.buffered_height;
+          size_t len = serialize_ciphertexts(gray_enc, count, n, q, wire);
+          if (net_send_all(worker_fds[w], &hdr, sizeof(hdr)) < 0 ||
+              net_send_all(worker_fds[w], wire, len) < 0) {
+            fprintf(stderr, "Failed to send tile to worker %d\n", w);
+            return 1;
+          }
+          bench_phase_end(&bench, PHASE_EVAL);
+        }
+
+        for (int w = 0; w < round; w++) {
+          Tile tile = round_tiles[w];
+          size_t count = (size_t)tile.tile_width * tile.tile_height;
+          size_t len = count * ciphertext_wire_size(n, q_out);
+          bench_phase_begin(&bench, PHASE_EVAL);
+          if (net_recv_all(worker_fds[w], wire, len) < 0) {
+            fprintf(stderr, "Failed to receive tile from worker %d\n", w);
+            return 1;
+          }
+          deserialize_ciphertexts(wire, count, n, q_out, sobel_enc);
+          bench_phase_end(&bench, PHASE_EVAL);
+
+          bench_phase_begin(&bench, PHASE_DECRYPT);
+          decrypt_tile(tile, sobel_enc, tile.tile_width, 0, 0, fhe_sobel,
+                       img.width, sk, n, q_out, t, poly_mod);
+          bench_phase_end(&bench, PHASE_DECRYPT);
+        }
       }
     }
   }
-  free(gray_enc);
-  free(sobel_enc);
-  free(fhe_sobel_temp);
 
-  double enc_end = omp_get_wtime();
-  double enc_time = enc_end - enc_start;
+  if (num_workers > 0) {
+    TileHeader done = {0, 0, 0, 0, 0, 0};
+    for (int w = 0; w < num_workers; w++) {
+      net_send_all(worker_fds[w], &done, sizeof(done));
+      net_close(worker_fds[w]);
+      waitpid(worker_pids[w], NULL, 0);
+    }
+    live_worker_count = 0;
+    free(wire);
+    free(round_tiles);
+    free(worker_fds);
+    free(worker_pids);
+  }
+  if (stored && bench_tile_store_close(&tile_store, &bench) < 0) {
+    fprintf(stderr, "Failed to write tile store\n");
+    return 1;
+  }
+  sobel_circuits_free(&circuits);
+  double huge_mb = bench_huge_pages_mb();
+  pages = arena.pages;
+  arena_free(&arena);
+  free(gray_values);
+
+  double enc_time = bench_last(&bench, PHASE_ENCRYPT) +
+                    bench_last(&bench, PHASE_EVAL) +
+                    bench_last(&bench, PHASE_DECRYPT);
 
   printf("Computing plaintext Sobel edge detection...\n");
   uint8_t *plain_sobel = (uint8_t *)calloc(total_pixels, sizeof(uint8_t));
-  double plain_start = omp_get_wtime();
+  double plain_start = bench_now();
   sobel_plain(gray, plain_sobel, img.width, img.height);
-  double plain_end = omp_get_wtime();
-  double plain_time = plain_end - plain_start;
+  double plain_time = bench_now() - plain_start;
 
   printf("\n=== Results ===\n");
   printf("Encryption time: %.4f s (%.2f ms/pixel)\n", enc_time,
          enc_time * 1000.0 / total_pixels);
-  printf("FHE Sobel time (included in encryption time)\n");
-  printf("Decryption time (included in encryption time)\n");
+  printf("  of which encrypt %.4f s, FHE Sobel %.4f s, decrypt %.4f s\n",
+         bench_last(&bench, PHASE_ENCRYPT), bench_last(&bench, PHASE_EVAL),
+         bench_last(&bench, PHASE_DECRYPT));
   printf("Plaintext Sobel time: %.4f s\n", plain_time);
+  printf("Arena pages: %s, %.1f MB in 2 MB pages\n", arena_pages_name(pages),
+         huge_mb);
+
+  bench_metric(&bench, "huge_page_mb", huge_mb);
+  bench_report(&bench);
 
   save_image("output/sobel_fhe.png",
              (Image){fhe_sobel, img.width, img.height, 1});
@@ -279,6 +736,7 @@ int main(int argc, char **argv) {
   free(plain_sobel);
   free(gray);
   free_image(img);
+  bench_free(&bench);
 
   return 0;
 }
\ No newline at end of file
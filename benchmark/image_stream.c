@@ -0,0 +1,102 @@
+#include "image_stream.h"
+
+#include <ctype.h>
+
+// Next header integer, skipping whitespace and '#' comments.
+static int read_header_int(FILE *f, int *value) {
+  int c = fgetc(f);
+  for (;;) {
+    while (c != EOF && isspace(c))
+      c = fgetc(f);
+    if (c != '#')
+      break;
+    while (c != EOF && c != '\n')
+      c = fgetc(f);
+  }
+  if (c == EOF || !isdigit(c))
+    return -1;
+  long v = 0;
+  while (c != EOF && isdigit(c)) {
+    v = v * 10 + (c - '0');
+    if (v > 1 << 30)
+      return -1;
+    c = fgetc(f);
+  }
+  // Exactly one whitespace byte separates the header from the raster.
+  if (c == EOF || !isspace(c))
+    return -1;
+  *value = (int)v;
+  return 0;
+}
+
+int image_reader_open(ImageReader *r, const char *path) {
+  r->f = fopen(path, "rb");
+  if (r->f == NULL)
+    return -1;
+  int maxval;
+  char magic[2];
+  if (fread(magic, 1, 2, r->f) != 2 || magic[0] != 'P' ||
+      (magic[1] != '5' && magic[1] != '6') ||
+      read_header_int(r->f, &r->width) < 0 ||
+      read_header_int(r->f, &r->height) < 0 ||
+      read_header_int(r->f, &maxval) < 0 || maxval != 255 || r->width <= 0 ||
+      r->height <= 0) {
+    fclose(r->f);
+    r->f = NULL;
+    return -1;
+  }
+  r->channels = magic[1] == '5' ? 1 : 3;
+  r->rows_read = 0;
+  return 0;
+}
+
+int image_reader_rows(ImageReader *r, uint8_t *rows, int count) {
+  if (count > r->height - r->rows_read)
+    count = r->height - r->rows_read;
+  size_t row_bytes = (size_t)r->width * r->channels;
+  if (count > 0 && fread(rows, row_bytes, count, r->f) != (size_t)count)
+    return -1;
+  r->rows_read += count;
+  return count;
+}
+
+void image_reader_close(ImageReader *r) {
+  if (r->f != NULL)
+    fclose(r->f);
+  r->f = NULL;
+}
+
+int image_writer_open(ImageWriter *w, const char *path, int width, int height,
+                      int channels) {
+  w->f = fopen(path, "wb");
+  if (w->f == NULL)
+    return -1;
+  w->width = width;
+  w->height = height;
+  w->channels = channels;
+  w->rows_written = 0;
+  if (fprintf(w->f, "P%c\n%d %d\n255\n", channels == 1 ? '5' : '6', width,
+              height) < 0) {
+    fclose(w->f);
+    w->f = NULL;
+    return -1;
+  }
+  return 0;
+}
+
+int image_writer_rows(ImageWriter *w, const uint8_t *rows, int count) {
+  size_t row_bytes = (size_t)w->width * w->channels;
+  if (count > w->height - w->rows_written ||
+      fwrite(rows, row_bytes, count, w->f) != (size_t)count)
+    return -1;
+  w->rows_written += count;
+  return 0;
+}
+
+int image_writer_close(ImageWriter *w) {
+  if (w->f == NULL)
+    return -1;
+  int rc = fclose(w->f) == 0 && w->rows_written == w->height ? 0 : -1;
+  w->f = NULL;
+  return rc;
+}
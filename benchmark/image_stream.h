@@ -0,0 +1,49 @@
+#ifndef IMAGE_STREAM_H
+#define IMAGE_STREAM_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Row-at-a-time access to binary PNM images (P5 grayscale, P6 RGB, maxval
+// 255). Unlike stbi_load, which decodes the whole file up front, a reader
+// hands out the next strip of rows and a writer appends strips, so a
+// pipeline's memory is bounded by the strip and not by the image.
+typedef struct {
+  FILE *f;
+  int width;
+  int height;
+  int channels;
+  int rows_read;
+} ImageReader;
+
+typedef struct {
+  FILE *f;
+  int width;
+  int height;
+  int channels;
+  int rows_written;
+} ImageWriter;
+
+// Returns 0 on success, -1 if the file cannot be opened or is not a binary
+// PNM with maxval 255.
+int image_reader_open(ImageReader *r, const char *path);
+
+// Reads up to `count` rows into `rows` (width * channels bytes each).
+// Returns the number of rows read, 0 at the end of the image, -1 on a
+// truncated file.
+int image_reader_rows(ImageReader *r, uint8_t *rows, int count);
+
+void image_reader_close(ImageReader *r);
+
+// channels is 1 (P5) or 3 (P6). Returns 0 on success, -1 on failure.
+int image_writer_open(ImageWriter *w, const char *path, int width, int height,
+                      int channels);
+
+// Appends `count` rows. Returns 0 on success, -1 on failure.
+int image_writer_rows(ImageWriter *w, const uint8_t *rows, int count);
+
+// Returns 0 if every row was written and the file closed cleanly, -1
+// otherwise.
+int image_writer_close(ImageWriter *w);
+
+#endif
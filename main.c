@@ -1,5 +1,7 @@
 #include "src/he.h"
+#include "src/keystore.h"
 #include "src/poly_utils.h"
+#include "src/ring_utils.h"
 
 #include <math.h>
 #include <stdint.h>
@@ -14,18 +16,20 @@ int main() {
   int64_t t = 1ll << 8;
 
   // poly_mod = X^n + 1
-  Poly poly_mod = create_poly();
-  set_coeff(&poly_mod, 0, 1.0);
-  set_coeff(&poly_mod, n, 1.0);
+  Poly poly_mod = ring_modulus(n);
 
-  KeyPair keys = keygen(n, q, poly_mod);
+  int64_t p = q * q;
+  HEParams params = {.n = n, .q = (double)q, .t = (double)t, .p = (double)p};
+  KeyPair keys;
+  EvalKey rlk;
+  keystore_get(keystore_dir(), params, poly_mod, &keys, &rlk);
   PublicKey pk = keys.pk;
   SecretKey sk = keys.sk;
 
   printf("[+] Public Key:\n\n");
   printf("\t pk.b: [");
   int first = 1;
-  for (int i = 0; i < MAX_POLY_DEGREE; i++) {
+  for (int i = 0; i <= pk.b.max_degree; i++) {
     if (fabs(pk.b.coeffs[i]) > 1e-9) {
       if (!first)
         printf(", ");
@@ -37,7 +41,7 @@ int main() {
 
   printf("\t pk.a: [");
   first = 1;
-  for (int i = 0; i < MAX_POLY_DEGREE; i++) {
+  for (int i = 0; i <= pk.a.max_degree; i++) {
     if (fabs(pk.a.coeffs[i]) > 1e-9) {
       if (!first)
         printf(", ");
@@ -58,7 +62,7 @@ int main() {
   printf("[+] Ciphertext ct1(%ld):\n\n", pt1);
   printf("\t ct1_0: [");
   first = 1;
-  for (int i = 0; i < MAX_POLY_DEGREE; i++) {
+  for (int i = 0; i <= ct1.c0.max_degree; i++) {
     if (fabs(ct1.c0.coeffs[i]) > 1e-9) {
       if (!first)
         printf(", ");
@@ -70,7 +74,7 @@ int main() {
 
   printf("\t ct1_1: [");
   first = 1;
-  for (int i = 0; i < MAX_POLY_DEGREE; i++) {
+  for (int i = 0; i <= ct1.c1.max_degree; i++) {
     if (fabs(ct1.c1.coeffs[i]) > 1e-9) {
       if (!first)
         printf(", ");
@@ -83,7 +87,7 @@ int main() {
   printf("[+] Ciphertext ct2(%ld):\n\n", pt2);
   printf("\t ct2_0: [");
   first = 1;
-  for (int i = 0; i < MAX_POLY_DEGREE; i++) {
+  for (int i = 0; i <= ct2.c0.max_degree; i++) {
     if (fabs(ct2.c0.coeffs[i]) > 1e-9) {
       if (!first)
         printf(", ");
@@ -95,7 +99,7 @@ int main() {
 
   printf("\t ct2_1: [");
   first = 1;
-  for (int i = 0; i < MAX_POLY_DEGREE; i++) {
+  for (int i = 0; i <= ct2.c1.max_degree; i++) {
     if (fabs(ct2.c1.coeffs[i]) > 1e-9) {
       if (!first)
         printf(", ");
@@ -118,8 +122,6 @@ int main() {
   printf("[+] Decrypted ct5(ct1 + %ld + %ld * ct2): %ld\n", cst1, cst2, d5);
 
   int64_t expected = ((pt1 % t) * (pt2 % t)) % t;
-  int64_t p = q * q;
-  EvalKey rlk = evaluate_keygen(sk, n, q, poly_mod, p);
   Ciphertext ct7 = mul_cipher(ct1, ct2, q, t, p, poly_mod, rlk);
   int64_t d7 = decrypt(sk, n, q, poly_mod, t, ct7);
   printf("[+] Decrypted ct7(relin_v2 ct1*ct2): %ld (expected %ld)\n", d7,
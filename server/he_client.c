@@ -0,0 +1,336 @@
+#define _POSIX_C_SOURCE 200809L
+#include "../src/enc_pool.h"
+#include "../src/he.h"
+#include "../src/keystore.h"
+#include "../src/net_utils.h"
+#include "../src/poly_utils.h"
+#include "../src/ring_utils.h"
+#include "protocol.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Load generator for he_server. Fetches the server's parameters, loads or
+// generates its own key pair for them from the keystore, then submits
+// `jobs` random jobs of one kind from `concurrency` connections, checks every
+// decrypted result against a plaintext reference and reports latencies.
+// HE_ENC_POOL=<capacity> encrypts from a pool of encryptions of zero that
+// HE_ENC_POOL_THREADS (default 1) background threads keep filled.
+
+static const int sobel_gx[3][3] = {{-1, 0, 1}, {-2, 0, 2}, {-1, 0, 1}};
+static const int sobel_gy[3][3] = {{-1, -2, -1}, {0, 0, 0}, {1, 2, 1}};
+
+static const char *addr;
+static uint32_t kind;
+static size_t size;
+static int jobs_per_conn;
+
+static size_t n;
+static int64_t q;
+static int64_t t;
+static Poly poly_mod;
+static KeyPair keys;
+
+static EncPool pool;
+static int use_pool = 0;
+
+// Latencies of the jobs that completed, in completion order.
+static double *rtt_ms;
+static double *enc_ms;
+static int completed = 0;
+static int failures = 0;
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static double now_sec(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int64_t mod_t(int64_t v) { return ((v % t) + t) % t; }
+
+static int64_t mod_inverse(int64_t a, int64_t m) {
+  for (int64_t x = 1; x < m; x++) {
+    if ((a * x) % m == 1)
+      return x;
+  }
+  return -1;
+}
+
+// Fills `plain_in` (and `matrix` for matmul) with random values and computes
+// the expected decrypted outputs. Returns the number of input ciphertexts.
+static size_t make_job(int64_t *plain_in, int64_t *matrix, int64_t *expected) {
+  size_t pixels = size * size;
+  switch (kind) {
+  case JOB_GRAYSCALE: {
+    int64_t inv3 = mod_inverse(3, t);
+    for (size_t i = 0; i < pixels; i++) {
+      int64_t r = rand() % 256, g = rand() % 256, b = rand() % 256;
+      plain_in[i] = r;
+      plain_in[pixels + i] = g;
+      plain_in[2 * pixels + i] = b;
+      expected[i] = mod_t((r + g + b) * inv3);
+    }
+    return 3 * pixels;
+  }
+  case JOB_SOBEL:
+    for (size_t i = 0; i < pixels; i++) {
+      plain_in[i] = rand() % 256;
+    }
+    for (size_t y = 0; y < size; y++) {
+      for (size_t x = 0; x < size; x++) {
+        int64_t acc = 0;
+        if (y > 0 && x > 0 && y < size - 1 && x < size - 1) {
+          for (int ky = -1; ky <= 1; ky++) {
+            for (int kx = -1; kx <= 1; kx++) {
+              int coeff = sobel_gx[ky + 1][kx + 1] + sobel_gy[ky + 1][kx + 1];
+              acc += coeff * plain_in[(y + ky) * size + (x + kx)];
+            }
+          }
+        }
+        expected[y * size + x] = mod_t(acc);
+      }
+    }
+    return pixels;
+  default:
+    for (size_t i = 0; i < pixels; i++) {
+      matrix[i] = rand() % t;
+      plain_in[i] = rand() % t;
+    }
+    for (size_t r = 0; r < size; r++) {
+      for (size_t k = 0; k < size; k++) {
+        int64_t acc = 0;
+        for (size_t j = 0; j < size; j++) {
+          acc += matrix[r * size + j] * plain_in[j * size + k];
+        }
+        expected[r * size + k] = mod_t(acc);
+      }
+    }
+    return pixels;
+  }
+}
+
+static void *client_main(void *arg) {
+  int conn = (int)(intptr_t)arg;
+  int fd = net_connect(addr);
+  if (fd < 0) {
+    fprintf(stderr, "Failed to connect to %s\n", addr);
+    pthread_mutex_lock(&stats_lock);
+    failures += jobs_per_conn;
+    pthread_mutex_unlock(&stats_lock);
+    return NULL;
+  }
+
+  size_t pixels = size * size;
+  size_t ct_bytes = ciphertext_wire_size(n, q);
+  int64_t *plain_in = (int64_t *)malloc(3 * pixels * sizeof(int64_t));
+  int64_t *matrix = (int64_t *)malloc(pixels * sizeof(int64_t));
+  int64_t *expected = (int64_t *)malloc(pixels * sizeof(int64_t));
+  Ciphertext *cts = (Ciphertext *)malloc(3 * pixels * sizeof(Ciphertext));
+  uint8_t *wire = (uint8_t *)malloc(3 * pixels * ct_bytes);
+
+  for (int j = 0; j < jobs_per_conn; j++) {
+    uint64_t job_id = (uint64_t)conn * jobs_per_conn + j;
+    size_t in_count = make_job(plain_in, matrix, expected);
+    double enc_start = now_sec();
+    for (size_t i = 0; i < in_count; i++) {
+      if (use_pool)
+        encrypt_pooled(&cts[i], &pool, plain_in[i]);
+      else
+        cts[i] = encrypt(keys.pk, n, q, poly_mod, t, plain_in[i]);
+    }
+    double enc = (now_sec() - enc_start) * 1000.0;
+    size_t len = serialize_ciphertexts(cts, in_count, n, q, wire);
+
+    RequestHeader hdr = {OP_JOB, kind, (uint32_t)size, (uint32_t)size, job_id};
+    double start = now_sec();
+    int rc = net_send_all(fd, &hdr, sizeof(hdr));
+    if (rc == 0 && kind == JOB_MATMUL)
+      rc = net_send_all(fd, matrix, pixels * sizeof(int64_t));
+    if (rc == 0)
+      rc = net_send_all(fd, wire, len);
+
+    ResponseHeader resp;
+    if (rc == 0)
+      rc = net_recv_all(fd, &resp, sizeof(resp));
+    if (rc == 0 && resp.status != STATUS_OK)
+      rc = -1;
+    if (rc == 0)
+      rc = net_recv_all(fd, wire,
+                        resp.count * ciphertext_wire_size(n, resp.result_q));
+    double rtt = (now_sec() - start) * 1000.0;
+    if (rc < 0) {
+      fprintf(stderr, "job %llu failed\n", (unsigned long long)job_id);
+      pthread_mutex_lock(&stats_lock);
+      failures++;
+      pthread_mutex_unlock(&stats_lock);
+      break;
+    }
+
+    deserialize_ciphertexts(wire, resp.count, n, resp.result_q, cts);
+    size_t wrong = 0;
+    for (size_t i = 0; i < resp.count; i++) {
+      int64_t val =
+          (int64_t)decrypt(keys.sk, n, resp.result_q, poly_mod, t, cts[i]);
+      if (val != expected[i])
+        wrong++;
+    }
+
+    pthread_mutex_lock(&stats_lock);
+    rtt_ms[completed] = rtt;
+    enc_ms[completed] = enc;
+    completed++;
+    if (wrong > 0)
+      failures++;
+    printf("job %llu: batch of %u, queue %.2f ms, exec %.2f ms, "
+           "round trip %.2f ms, %zu/%u wrong\n",
+           (unsigned long long)job_id, resp.batch_jobs, resp.queue_ms,
+           resp.exec_ms, rtt, wrong, resp.count);
+    pthread_mutex_unlock(&stats_lock);
+  }
+
+  free(plain_in);
+  free(matrix);
+  free(expected);
+  free(cts);
+  free(wire);
+  net_close(fd);
+  return NULL;
+}
+
+static int cmp_double(const void *a, const void *b) {
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+// Nearest-rank percentile `p` (0-100] of `count` sorted values.
+static double percentile(const double *sorted, int count, int p) {
+  int rank = (count * p + 99) / 100;
+  return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+static void usage(const char *prog) {
+  fprintf(stderr,
+          "Usage: %s <address> <grayscale|sobel|matmul|shutdown> [jobs] "
+          "[size] [concurrency]\n",
+          prog);
+}
+
+int main(int argc, char **argv) {
+  srand(time(NULL));
+  if (argc < 3) {
+    usage(argv[0]);
+    return 1;
+  }
+  addr = argv[1];
+
+  if (strcmp(argv[2], "shutdown") == 0) {
+    int fd = net_connect(addr);
+    if (fd < 0) {
+      fprintf(stderr, "Failed to connect to %s\n", addr);
+      return 1;
+    }
+    RequestHeader hdr = {OP_SHUTDOWN, 0, 0, 0, 0};
+    net_send_all(fd, &hdr, sizeof(hdr));
+    net_close(fd);
+    return 0;
+  }
+
+  if (strcmp(argv[2], "grayscale") == 0) {
+    kind = JOB_GRAYSCALE;
+  } else if (strcmp(argv[2], "sobel") == 0) {
+    kind = JOB_SOBEL;
+  } else if (strcmp(argv[2], "matmul") == 0) {
+    kind = JOB_MATMUL;
+  } else {
+    fprintf(stderr, "Unknown job kind: %s\n", argv[2]);
+    return 1;
+  }
+  int jobs = (argc >= 4) ? atoi(argv[3]) : 8;
+  size = (argc >= 5) ? (size_t)strtoull(argv[4], NULL, 10) : 8;
+  int concurrency = (argc >= 6) ? atoi(argv[5]) : 4;
+  if (jobs < 1 || size < 1 || concurrency < 1) {
+    usage(argv[0]);
+    return 1;
+  }
+  if (jobs < concurrency)
+    concurrency = jobs;
+  jobs_per_conn = (jobs + concurrency - 1) / concurrency;
+
+  int fd = net_connect(addr);
+  if (fd < 0) {
+    fprintf(stderr, "Failed to connect to %s\n", addr);
+    return 1;
+  }
+  RequestHeader hdr = {OP_GET_PARAMS, 0, 0, 0, 0};
+  ServerParams params;
+  if (net_send_all(fd, &hdr, sizeof(hdr)) < 0 ||
+      net_recv_all(fd, &params, sizeof(params)) < 0) {
+    fprintf(stderr, "Failed to fetch parameters\n");
+    return 1;
+  }
+  net_close(fd);
+  n = (size_t)params.n;
+  q = (int64_t)params.q;
+  t = (int64_t)params.t;
+
+  poly_mod = ring_modulus(n);
+
+  HEParams he_params = {.n = n, .q = (double)q, .t = (double)t};
+  keystore_get(keystore_dir(), he_params, poly_mod, &keys, NULL);
+
+  int total_jobs = jobs_per_conn * concurrency;
+  rtt_ms = (double *)calloc(total_jobs, sizeof(double));
+  enc_ms = (double *)calloc(total_jobs, sizeof(double));
+
+  const char *pool_env = getenv("HE_ENC_POOL");
+  if (pool_env != NULL && atoi(pool_env) > 0) {
+    const char *threads_env = getenv("HE_ENC_POOL_THREADS");
+    size_t fillers = threads_env != NULL ? (size_t)atoi(threads_env) : 1;
+    if (enc_pool_init(&pool, &keys.pk, n, q, &poly_mod, t,
+                      (size_t)atoi(pool_env), fillers) < 0) {
+      fprintf(stderr, "Failed to start the encryption pool\n");
+      return 1;
+    }
+    use_pool = 1;
+  }
+
+  pthread_t *threads = (pthread_t *)malloc(concurrency * sizeof(pthread_t));
+  for (int c = 0; c < concurrency; c++) {
+    pthread_create(&threads[c], NULL, client_main, (void *)(intptr_t)c);
+  }
+  for (int c = 0; c < concurrency; c++) {
+    pthread_join(threads[c], NULL);
+  }
+
+  // Jobs that never got a reply have no latency to report.
+  qsort(rtt_ms, completed, sizeof(double), cmp_double);
+  qsort(enc_ms, completed, sizeof(double), cmp_double);
+  printf("\n=== Client summary ===\n");
+  printf("jobs=%d completed=%d failures=%d", total_jobs, completed, failures);
+  if (completed > 0)
+    printf(" round trip p50=%.2f ms p99=%.2f ms max=%.2f ms",
+           percentile(rtt_ms, completed, 50), percentile(rtt_ms, completed, 99),
+           rtt_ms[completed - 1]);
+  printf("\n");
+  if (completed > 0)
+    printf("encrypt per job p50=%.3f ms max=%.3f ms",
+           percentile(enc_ms, completed, 50), enc_ms[completed - 1]);
+  else
+    printf("encrypt per job: no jobs completed");
+  if (use_pool) {
+    printf(" (pool of %zu, %zu empty pops)", pool.capacity, pool.misses);
+    enc_pool_free(&pool);
+  }
+  printf("\n");
+
+  free(threads);
+  free(rtt_ms);
+  free(enc_ms);
+  return failures == 0 ? 0 : 1;
+}
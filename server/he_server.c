@@ -0,0 +1,427 @@
+#define _POSIX_C_SOURCE 200809L
+#include "../src/he.h"
+#include "../src/net_utils.h"
+#include "../src/poly_utils.h"
+#include "../src/ring_utils.h"
+#include "protocol.h"
+
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include <omp.h>
+
+// Long-running evaluation daemon. It holds no keys: clients encrypt under
+// their own key pairs and the jobs here need only additions and plaintext
+// products. Each client connection gets its own thread that reads jobs into a shared queue.
+// A single scheduler thread drains the queue, grouping every queued job of the
+// same kind into one batch, and evaluates the batch's ciphertexts together on
+// an OpenMP worker pool.
+
+#define MAX_BATCH_JOBS 64
+#define MAX_JOB_ITEMS (1 << 16)
+// Cap on a job's input and output Ciphertext buffers. A Ciphertext is
+// sizeof(Ciphertext) (~160 KB) whatever n is, so this, not MAX_JOB_ITEMS,
+// is what bounds the memory a client can make the server allocate.
+#define MAX_JOB_BYTES ((size_t)1 << 30)
+
+typedef struct Job {
+  RequestHeader hdr;
+  int64_t *plain;
+  Ciphertext *in;
+  Ciphertext *out;
+  size_t in_count;
+  size_t out_count;
+  double enqueue_time;
+  double start_time;
+  double end_time;
+  int batch_jobs;
+  int done;
+  pthread_cond_t done_cv;
+  struct Job *next;
+} Job;
+
+static const char *kind_names[NUM_JOB_KINDS] = {"grayscale", "sobel",
+                                                "matmul"};
+
+static const int sobel_gx[3][3] = {{-1, 0, 1}, {-2, 0, 2}, {-1, 0, 1}};
+static const int sobel_gy[3][3] = {{-1, -2, -1}, {0, 0, 0}, {1, 2, 1}};
+
+static size_t n;
+static int64_t q;
+static int64_t t;
+static int64_t inv3;
+static double q_out;
+static int num_threads;
+static Poly poly_mod;
+static ServerParams wire_params;
+
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cv = PTHREAD_COND_INITIALIZER;
+static Job *queue_head = NULL;
+static Job *queue_tail = NULL;
+static int running = 1;
+static int listen_fd = -1;
+
+static size_t jobs_done[NUM_JOB_KINDS];
+static double latency_sum_ms[NUM_JOB_KINDS];
+static double latency_max_ms[NUM_JOB_KINDS];
+
+static double now_sec(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int64_t mod_inverse(int64_t a, int64_t m) {
+  for (int64_t x = 1; x < m; x++) {
+    if ((a * x) % m == 1)
+      return x;
+  }
+  return -1;
+}
+
+static Ciphertext zero_cipher(void) {
+  Ciphertext ct;
+  ct.c0 = create_poly();
+  ct.c1 = create_poly();
+  ct.noise = 0.0;
+  return ct;
+}
+
+// Evaluates output ciphertext `i` of `job`.
+static void eval_output(Job *job, size_t i) {
+  size_t width = job->hdr.width;
+  size_t height = job->hdr.height;
+
+  switch (job->hdr.kind) {
+  case JOB_GRAYSCALE: {
+    size_t pixels = width * height;
+    Ciphertext sum = add_cipher(job->in[i], job->in[pixels + i], q, poly_mod);
+    sum = add_cipher(sum, job->in[2 * pixels + i], q, poly_mod);
+    job->out[i] = mul_plain(sum, q, t, poly_mod, inv3);
+    break;
+  }
+  case JOB_SOBEL: {
+    size_t y = i / width;
+    size_t x = i % width;
+    if (y == 0 || x == 0 || y == height - 1 || x == width - 1) {
+      job->out[i] = zero_cipher();
+      break;
+    }
+    Ciphertext acc = zero_cipher();
+    for (int ky = -1; ky <= 1; ky++) {
+      for (int kx = -1; kx <= 1; kx++) {
+        int coeff = sobel_gx[ky + 1][kx + 1] + sobel_gy[ky + 1][kx + 1];
+        if (coeff == 0)
+          continue;
+        Ciphertext pixel = job->in[(y + ky) * width + (x + kx)];
+        Ciphertext term = mul_plain(pixel, q, t, poly_mod, coeff);
+        acc = add_cipher(acc, term, q, poly_mod);
+      }
+    }
+    job->out[i] = acc;
+    break;
+  }
+  case JOB_MATMUL: {
+    size_t dim = width;
+    size_t r = i / dim;
+    size_t k = i % dim;
+    Ciphertext acc;
+    for (size_t j = 0; j < dim; j++) {
+      Ciphertext term =
+          mul_plain(job->in[j * dim + k], q, t, poly_mod, job->plain[r * dim + j]);
+      acc = (j == 0) ? term : add_cipher(acc, term, q, poly_mod);
+    }
+    job->out[i] = acc;
+    break;
+  }
+  }
+}
+
+static void eval_item(Job *job, size_t i) {
+  eval_output(job, i);
+  job->out[i] = mod_switch(job->out[i], q, q_out, n);
+}
+
+static void run_batch(Job **batch, int count) {
+  size_t offsets[MAX_BATCH_JOBS + 1];
+  offsets[0] = 0;
+  for (int j = 0; j < count; j++) {
+    offsets[j + 1] = offsets[j] + batch[j]->out_count;
+  }
+
+  double start = now_sec();
+  for (int j = 0; j < count; j++) {
+    batch[j]->start_time = start;
+  }
+
+  size_t total = offsets[count];
+  #pragma omp parallel for schedule(dynamic, 4) num_threads(num_threads)
+  for (size_t i = 0; i < total; i++) {
+    int j = 0;
+    while (i >= offsets[j + 1])
+      j++;
+    eval_item(batch[j], i - offsets[j]);
+  }
+
+  double end = now_sec();
+  for (int j = 0; j < count; j++) {
+    batch[j]->end_time = end;
+    batch[j]->batch_jobs = count;
+  }
+}
+
+static void *scheduler_main(void *arg) {
+  (void)arg;
+  Job *batch[MAX_BATCH_JOBS];
+  for (;;) {
+    pthread_mutex_lock(&queue_lock);
+    while (queue_head == NULL && running) {
+      pthread_cond_wait(&queue_cv, &queue_lock);
+    }
+    if (queue_head == NULL) {
+      pthread_mutex_unlock(&queue_lock);
+      break;
+    }
+
+    // Take the oldest job and every queued job of the same kind.
+    uint32_t kind = queue_head->hdr.kind;
+    int count = 0;
+    Job **link = &queue_head;
+    queue_tail = NULL;
+    while (*link != NULL) {
+      Job *job = *link;
+      if (job->hdr.kind == kind && count < MAX_BATCH_JOBS) {
+        batch[count++] = job;
+        *link = job->next;
+      } else {
+        queue_tail = job;
+        link = &job->next;
+      }
+    }
+    pthread_mutex_unlock(&queue_lock);
+
+    run_batch(batch, count);
+
+    pthread_mutex_lock(&queue_lock);
+    for (int j = 0; j < count; j++) {
+      batch[j]->done = 1;
+      pthread_cond_signal(&batch[j]->done_cv);
+    }
+    pthread_mutex_unlock(&queue_lock);
+  }
+  return NULL;
+}
+
+static void submit_and_wait(Job *job) {
+  pthread_cond_init(&job->done_cv, NULL);
+  job->done = 0;
+  job->next = NULL;
+
+  pthread_mutex_lock(&queue_lock);
+  job->enqueue_time = now_sec();
+  if (queue_tail)
+    queue_tail->next = job;
+  else
+    queue_head = job;
+  queue_tail = job;
+  pthread_cond_signal(&queue_cv);
+  while (!job->done) {
+    pthread_cond_wait(&job->done_cv, &queue_lock);
+  }
+  pthread_mutex_unlock(&queue_lock);
+  pthread_cond_destroy(&job->done_cv);
+}
+
+static int send_status(int fd, RequestHeader *hdr, uint32_t status) {
+  ResponseHeader resp;
+  memset(&resp, 0, sizeof(resp));
+  resp.job_id = hdr->job_id;
+  resp.status = status;
+  return net_send_all(fd, &resp, sizeof(resp));
+}
+
+// Reads one job's payload, runs it through the scheduler and replies.
+// Returns -1 if the connection should be dropped.
+static int handle_job(int fd, RequestHeader *hdr) {
+  size_t width = hdr->width;
+  size_t height = hdr->height;
+  if (hdr->kind >= NUM_JOB_KINDS || width == 0 || height == 0 ||
+      width * height > MAX_JOB_ITEMS ||
+      (hdr->kind == JOB_MATMUL && width != height)) {
+    send_status(fd, hdr, STATUS_BAD_REQUEST);
+    return -1;
+  }
+
+  Job job;
+  memset(&job, 0, sizeof(job));
+  job.hdr = *hdr;
+  job.out_count = width * height;
+  job.in_count = (hdr->kind == JOB_GRAYSCALE) ? 3 * job.out_count : job.out_count;
+  if ((job.in_count + job.out_count) * sizeof(Ciphertext) > MAX_JOB_BYTES) {
+    send_status(fd, hdr, STATUS_BAD_REQUEST);
+    return -1;
+  }
+
+  size_t ct_bytes = ciphertext_wire_size(n, q);
+  size_t wire_len = job.in_count * ct_bytes;
+  uint8_t *wire = (uint8_t *)malloc(wire_len);
+  job.in = (Ciphertext *)malloc(job.in_count * sizeof(Ciphertext));
+  job.out = (Ciphertext *)malloc(job.out_count * sizeof(Ciphertext));
+  if (hdr->kind == JOB_MATMUL)
+    job.plain = (int64_t *)malloc(job.out_count * sizeof(int64_t));
+
+  int rc = 0;
+  if (wire == NULL || job.in == NULL || job.out == NULL ||
+      (hdr->kind == JOB_MATMUL && job.plain == NULL)) {
+    // The payload is still unread, so the connection cannot continue.
+    send_status(fd, hdr, STATUS_NO_MEMORY);
+    rc = -1;
+  }
+  if (rc == 0 && hdr->kind == JOB_MATMUL)
+    rc = net_recv_all(fd, job.plain, job.out_count * sizeof(int64_t));
+  if (rc == 0)
+    rc = net_recv_all(fd, wire, wire_len);
+
+  if (rc == 0) {
+    deserialize_ciphertexts(wire, job.in_count, n, q, job.in);
+    submit_and_wait(&job);
+
+    ResponseHeader resp;
+    memset(&resp, 0, sizeof(resp));
+    resp.job_id = hdr->job_id;
+    resp.status = STATUS_OK;
+    resp.count = (uint32_t)job.out_count;
+    resp.batch_jobs = (uint32_t)job.batch_jobs;
+    resp.queue_ms = (job.start_time - job.enqueue_time) * 1000.0;
+    resp.exec_ms = (job.end_time - job.start_time) * 1000.0;
+    resp.result_q = q_out;
+
+    size_t len = serialize_ciphertexts(job.out, job.out_count, n, q_out, wire);
+    rc = net_send_all(fd, &resp, sizeof(resp));
+    if (rc == 0)
+      rc = net_send_all(fd, wire, len);
+
+    double total_ms = resp.queue_ms + resp.exec_ms;
+    pthread_mutex_lock(&queue_lock);
+    jobs_done[hdr->kind]++;
+    latency_sum_ms[hdr->kind] += total_ms;
+    if (total_ms > latency_max_ms[hdr->kind])
+      latency_max_ms[hdr->kind] = total_ms;
+    pthread_mutex_unlock(&queue_lock);
+
+    printf("job %llu: %s %zux%zu, batch of %u, queue %.2f ms, exec %.2f ms, "
+           "total %.2f ms\n",
+           (unsigned long long)hdr->job_id, kind_names[hdr->kind], width,
+           height, resp.batch_jobs, resp.queue_ms, resp.exec_ms, total_ms);
+    fflush(stdout);
+  }
+
+  free(wire);
+  free(job.in);
+  free(job.out);
+  free(job.plain);
+  return rc;
+}
+
+static void *connection_main(void *arg) {
+  int fd = (int)(intptr_t)arg;
+  RequestHeader hdr;
+  while (net_recv_all(fd, &hdr, sizeof(hdr)) == 0) {
+    if (hdr.op == OP_GET_PARAMS) {
+      if (net_send_all(fd, &wire_params, sizeof(wire_params)) < 0)
+        break;
+    } else if (hdr.op == OP_JOB) {
+      if (handle_job(fd, &hdr) < 0)
+        break;
+    } else if (hdr.op == OP_SHUTDOWN) {
+      pthread_mutex_lock(&queue_lock);
+      running = 0;
+      pthread_cond_broadcast(&queue_cv);
+      pthread_mutex_unlock(&queue_lock);
+      shutdown(listen_fd, SHUT_RDWR);
+      break;
+    } else {
+      break;
+    }
+  }
+  net_close(fd);
+  return NULL;
+}
+
+int main(int argc, char **argv) {
+  srand(time(NULL));
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s <address> [threads] [n] [log2 q] [t]\n", argv[0]);
+    return 1;
+  }
+  const char *addr = argv[1];
+
+  n = 1u << 4;
+  q = 1ll << 30;
+  t = 769;
+  num_threads = omp_get_max_threads();
+  if (argc >= 3)
+    num_threads = atoi(argv[2]);
+  if (argc >= 4)
+    n = (size_t)strtoull(argv[3], NULL, 10);
+  if (argc >= 5)
+    q = 1ll << atoi(argv[4]);
+  if (argc >= 6)
+    t = strtoll(argv[5], NULL, 10);
+
+  inv3 = mod_inverse(3, t);
+  if (inv3 < 0) {
+    fprintf(stderr, "t must be coprime with 3 for grayscale jobs\n");
+    return 1;
+  }
+
+  poly_mod = ring_modulus(n);
+  q_out = mod_switch_modulus(n, t);
+
+  wire_params.n = (uint64_t)n;
+  wire_params.q = (double)q;
+  wire_params.t = (double)t;
+  printf("Parameters n=%zu, q=2^%.0f, t=%lld\n", n, log2((double)q),
+         (long long)t);
+
+  listen_fd = net_listen(addr);
+  if (listen_fd < 0) {
+    fprintf(stderr, "Failed to listen on %s\n", addr);
+    return 1;
+  }
+  printf("Listening on %s with %d worker threads\n", addr, num_threads);
+  fflush(stdout);
+
+  pthread_t scheduler;
+  pthread_create(&scheduler, NULL, scheduler_main, NULL);
+
+  for (;;) {
+    int fd = net_accept(listen_fd);
+    if (fd < 0)
+      break;
+    pthread_t conn;
+    pthread_create(&conn, NULL, connection_main, (void *)(intptr_t)fd);
+    pthread_detach(conn);
+  }
+
+  pthread_join(scheduler, NULL);
+  net_close(listen_fd);
+  if (strncmp(addr, "tcp:", 4) != 0)
+    unlink(addr);
+
+  printf("\n=== Server summary ===\n");
+  for (int k = 0; k < NUM_JOB_KINDS; k++) {
+    if (jobs_done[k] == 0)
+      continue;
+    printf("%-10s jobs=%zu mean=%.2f ms max=%.2f ms\n", kind_names[k],
+           jobs_done[k], latency_sum_ms[k] / jobs_done[k], latency_max_ms[k]);
+  }
+  return 0;
+}
@@ -0,0 +1,57 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <stdint.h>
+
+// Wire protocol between he_client and he_server. Every request starts with a
+// RequestHeader and every reply with a ResponseHeader; ciphertexts and
+// polynomials that follow use the he_serialize.c format for the server's q,
+// except job results, which are mod-switched down to ResponseHeader.result_q.
+// Clients bring their own keys; the server never sees a secret key.
+
+#define OP_GET_PARAMS 1 // reply: ServerParams
+#define OP_JOB 2        // reply: ResponseHeader, then `count` ciphertexts
+#define OP_SHUTDOWN 3   // no reply
+
+// Job payloads (after the header):
+//   JOB_GRAYSCALE  width*height ciphertexts each for R, G and B.
+//                  Result: width*height ciphertexts of (R+G+B)/3 mod t.
+//   JOB_SOBEL      width*height grayscale ciphertexts.
+//                  Result: width*height ciphertexts of Gx+Gy, zero borders.
+//   JOB_MATMUL     width*width int64 plaintext matrix A, then width*width
+//                  ciphertexts of B. Result: width*width ciphertexts of A*B.
+#define JOB_GRAYSCALE 0
+#define JOB_SOBEL 1
+#define JOB_MATMUL 2
+#define NUM_JOB_KINDS 3
+
+#define STATUS_OK 0
+#define STATUS_BAD_REQUEST 1 // malformed or larger than the server accepts
+#define STATUS_NO_MEMORY 2   // the server could not allocate the job
+
+typedef struct {
+  uint32_t op;
+  uint32_t kind;
+  uint32_t width;
+  uint32_t height;
+  uint64_t job_id;
+} RequestHeader;
+
+typedef struct {
+  uint64_t n;
+  double q;
+  double t;
+} ServerParams;
+
+typedef struct {
+  uint64_t job_id;
+  uint32_t status;
+  uint32_t count;
+  uint32_t batch_jobs; // number of jobs evaluated together with this one
+  uint32_t reserved;
+  double queue_ms;     // time spent waiting in the request queue
+  double exec_ms;      // wall time of the batch this job ran in
+  double result_q;     // modulus of the returned ciphertexts
+} ResponseHeader;
+
+#endif
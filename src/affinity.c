@@ -0,0 +1,28 @@
+#define _GNU_SOURCE
+#include "affinity.h"
+#include <omp.h>
+#include <sched.h>
+
+int affinity_pin_threads(int threads) {
+  cpu_set_t allowed;
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+    return -1;
+  int cpus[CPU_SETSIZE];
+  int count = 0;
+  for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    if (CPU_ISSET(cpu, &allowed))
+      cpus[count++] = cpu;
+  if (count == 0)
+    return -1;
+  if (threads <= 0)
+    threads = omp_get_max_threads();
+  int pinned = 0;
+#pragma omp parallel num_threads(threads) reduction(+ : pinned)
+  {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpus[omp_get_thread_num() % count], &set);
+    pinned += sched_setaffinity(0, sizeof(set), &set) == 0;
+  }
+  return pinned;
+}
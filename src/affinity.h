@@ -0,0 +1,14 @@
+#ifndef AFFINITY_H
+#define AFFINITY_H
+
+// Pins the OpenMP threads of a team of `threads` (0 for the OpenMP default)
+// one per CPU, thread i on the i-th CPU the process may run on, wrapping
+// around when there are more threads than CPUs. Consecutive threads share a
+// socket on the usual CPU numbering, so the static shares of a loop stay on
+// one node, next to the pages they first touched (see arena_init). Later
+// parallel regions reuse the same threads and keep the pinning, including
+// the calling thread. Call it before any fork(), which the OpenMP runtime
+// does not survive. Returns the number of threads pinned, or -1.
+int affinity_pin_threads(int threads);
+
+#endif
@@ -0,0 +1,179 @@
+#define _DEFAULT_SOURCE
+#include "arena.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+// Deepest nesting of temporaries in the HE kernels is well below this.
+#define SCRATCH_POLYS 32
+
+#define SMALL_PAGE ((size_t)4096)
+#define HUGE_PAGE ((size_t)2 << 20)
+
+// Zeroes [base, base + size) a page at a time from the OpenMP threads, so
+// each page is first touched, and placed, by the thread whose static share
+// it falls in.
+static void first_touch(unsigned char *base, size_t size, size_t page) {
+  long pages = (long)((size + page - 1) / page);
+#pragma omp parallel for schedule(static)
+  for (long i = 0; i < pages; i++) {
+    size_t offset = (size_t)i * page;
+    memset(base + offset, 0, size - offset < page ? size - offset : page);
+  }
+}
+
+// A HUGE_PAGE aligned anonymous mapping of `size` bytes (a multiple of
+// HUGE_PAGE) with transparent huge pages requested, or NULL.
+static void *map_thp(size_t size) {
+  // Over-map by one huge page and trim to an aligned window.
+  size_t span = size + HUGE_PAGE;
+  unsigned char *p = (unsigned char *)mmap(NULL, span, PROT_READ | PROT_WRITE,
+                                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED)
+    return NULL;
+  size_t head = (HUGE_PAGE - (size_t)p % HUGE_PAGE) % HUGE_PAGE;
+  if (head > 0)
+    munmap(p, head);
+  munmap(p + head + size, span - head - size);
+#ifdef MADV_HUGEPAGE
+  madvise(p + head, size, MADV_HUGEPAGE);
+#endif
+  return p + head;
+}
+
+int arena_init_pages(Arena *arena, size_t size, ArenaPages pages) {
+  void *base = NULL;
+  size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+  if (size == 0)
+    return -1;
+  if (pages != ARENA_PAGES_DEFAULT) {
+    size = (size + HUGE_PAGE - 1) & ~(HUGE_PAGE - 1);
+#ifdef MAP_HUGETLB
+    if (pages == ARENA_PAGES_HUGE) {
+      base = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+      if (base == MAP_FAILED)
+        base = NULL;
+    }
+#endif
+    if (base == NULL) {
+      pages = ARENA_PAGES_THP;
+      base = map_thp(size);
+    }
+    if (base == NULL)
+      return -1;
+  } else if (posix_memalign(&base, ARENA_ALIGN, size) != 0) {
+    return -1;
+  }
+  // Touch every page now rather than in the hot loop.
+  first_touch((unsigned char *)base, size,
+              pages == ARENA_PAGES_DEFAULT ? SMALL_PAGE : HUGE_PAGE);
+  arena->base = (unsigned char *)base;
+  arena->size = size;
+  arena->used = 0;
+  arena->pages = pages;
+  return 0;
+}
+
+int arena_init(Arena *arena, size_t size) {
+  return arena_init_pages(arena, size, ARENA_PAGES_DEFAULT);
+}
+
+const char *arena_pages_name(ArenaPages pages) {
+  switch (pages) {
+  case ARENA_PAGES_THP:
+    return "thp";
+  case ARENA_PAGES_HUGE:
+    return "huge";
+  default:
+    return "default";
+  }
+}
+
+void *arena_alloc(Arena *arena, size_t size) {
+  size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+  if (size > arena->size - arena->used)
+    return NULL;
+  void *p = arena->base + arena->used;
+  arena->used += size;
+  return p;
+}
+
+Ciphertext *arena_alloc_cts(Arena *arena, size_t count) {
+  return (Ciphertext *)arena_alloc(arena, count * sizeof(Ciphertext));
+}
+
+void arena_reset(Arena *arena) { arena->used = 0; }
+
+void arena_free(Arena *arena) {
+  if (arena->pages != ARENA_PAGES_DEFAULT)
+    munmap(arena->base, arena->size);
+  else
+    free(arena->base);
+  arena->base = NULL;
+  arena->size = 0;
+  arena->used = 0;
+  arena->pages = ARENA_PAGES_DEFAULT;
+}
+
+// Byte stack; every allocation starts on an ARENA_ALIGN boundary.
+#define SCRATCH_BYTES (SCRATCH_POLYS * (sizeof(Poly) + ARENA_ALIGN))
+
+typedef struct {
+  unsigned char *base;
+  size_t used;
+} Scratch;
+
+static pthread_key_t scratch_key;
+static pthread_once_t scratch_once = PTHREAD_ONCE_INIT;
+static __thread Scratch *thread_scratch = NULL;
+
+static void scratch_destroy(void *ptr) {
+  Scratch *s = (Scratch *)ptr;
+  free(s->base);
+  free(s);
+}
+
+static void scratch_key_init(void) {
+  pthread_key_create(&scratch_key, scratch_destroy);
+}
+
+static Scratch *get_scratch(void) {
+  if (thread_scratch == NULL) {
+    pthread_once(&scratch_once, scratch_key_init);
+    Scratch *s = (Scratch *)malloc(sizeof(Scratch));
+    void *base = NULL;
+    if (s == NULL || posix_memalign(&base, ARENA_ALIGN, SCRATCH_BYTES)) {
+      fprintf(stderr, "Failed to allocate scratch space\n");
+      abort();
+    }
+    s->base = (unsigned char *)base;
+    s->used = 0;
+    // Freed when the thread exits.
+    pthread_setspecific(scratch_key, s);
+    thread_scratch = s;
+  }
+  return thread_scratch;
+}
+
+size_t scratch_mark(void) { return get_scratch()->used; }
+
+void *scratch_bytes(size_t size) {
+  Scratch *s = get_scratch();
+  size_t start = (s->used + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+  if (size > SCRATCH_BYTES || start > SCRATCH_BYTES - size) {
+    fprintf(stderr, "Scratch space exhausted (%zu bytes)\n",
+            (size_t)SCRATCH_BYTES);
+    abort();
+  }
+  s->used = start + size;
+  return s->base + start;
+}
+
+Poly *scratch_polys(size_t count) {
+  return (Poly *)scratch_bytes(count * sizeof(Poly));
+}
+
+void scratch_release(size_t mark) { get_scratch()->used = mark; }
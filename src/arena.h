@@ -0,0 +1,73 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include "types.h"
+#include <stddef.h>
+
+// Bump allocator for ciphertext working sets. One block is allocated and
+// pre-faulted up front; arena_alloc hands out 64-byte aligned slices of it
+// and arena_reset makes the whole block available again, so a tile loop that
+// resets once per tile does no allocator calls and takes no page faults
+// after the first tile.
+#define ARENA_ALIGN 64
+
+// Page backing for an arena block. With 160 KB ciphertexts a tile's working
+// set spans thousands of 4 KB pages; 2 MB pages cut the TLB misses.
+// ARENA_PAGES_THP maps the block 2 MB aligned and asks for transparent huge
+// pages (madvise), which the kernel grants when it can. ARENA_PAGES_HUGE maps
+// it from the reserved hugetlbfs pool (MAP_HUGETLB, see
+// /proc/sys/vm/nr_hugepages) and falls back to ARENA_PAGES_THP when the pool
+// is short.
+typedef enum {
+  ARENA_PAGES_DEFAULT,
+  ARENA_PAGES_THP,
+  ARENA_PAGES_HUGE,
+} ArenaPages;
+
+typedef struct {
+  unsigned char *base;
+  size_t size;
+  size_t used;
+  ArenaPages pages; // the backing obtained; anything but default is mmap'd
+} Arena;
+
+// Returns 0 on success, -1 if the block could not be allocated. The block is
+// zeroed by the OpenMP threads under a static schedule, so on a NUMA host its
+// pages are first touched, and placed, across the nodes of the threads that
+// work on it rather than all on the calling thread's node.
+int arena_init(Arena *arena, size_t size);
+
+// arena_init with the given page backing.
+int arena_init_pages(Arena *arena, size_t size, ArenaPages pages);
+
+// "default", "thp" or "huge".
+const char *arena_pages_name(ArenaPages pages);
+
+// Returns NULL when the arena is out of space. Every request is rounded up
+// to ARENA_ALIGN bytes, which callers sizing an arena should allow for.
+void *arena_alloc(Arena *arena, size_t size);
+
+Ciphertext *arena_alloc_cts(Arena *arena, size_t count);
+
+void arena_reset(Arena *arena);
+
+void arena_free(Arena *arena);
+
+// Per-thread stack of Poly temporaries for the ring and HE kernels, so they
+// keep their intermediates off the (OpenMP worker) thread stack. Callers take
+// a mark, allocate, and release back to the mark before returning:
+//
+//   size_t mark = scratch_mark();
+//   Poly *tmp = scratch_polys(2);
+//   ...
+//   scratch_release(mark);
+size_t scratch_mark(void);
+
+Poly *scratch_polys(size_t count);
+
+// Raw workspace from the same stack, ARENA_ALIGN aligned.
+void *scratch_bytes(size_t size);
+
+void scratch_release(size_t mark);
+
+#endif
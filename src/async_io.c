@@ -0,0 +1,303 @@
+#define _GNU_SOURCE
+#include "async_io.h"
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Pool threads for the pread fallback; more would only queue on the device.
+#define ASYNC_IO_MAX_THREADS 4
+
+// Moves the rest of req's buffer with pread/pwrite, starting `done` bytes
+// in. Returns the total transferred or -errno.
+static ssize_t transfer(const AsyncRequest *req, size_t done) {
+  unsigned char *buf = (unsigned char *)req->buf;
+  while (done < req->len) {
+    ssize_t r = req->write ? pwrite(req->fd, buf + done, req->len - done,
+                                    req->offset + (off_t)done)
+                           : pread(req->fd, buf + done, req->len - done,
+                                   req->offset + (off_t)done);
+    if (r < 0 && errno == EINTR)
+      continue;
+    if (r < 0)
+      return -errno;
+    if (r == 0)
+      break;
+    done += (size_t)r;
+  }
+  return (ssize_t)done;
+}
+
+static int uring_enter(int fd, unsigned submit, unsigned wait) {
+  long r;
+  do {
+    r = syscall(__NR_io_uring_enter, fd, submit, wait,
+                wait > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+  } while (r < 0 && errno == EINTR);
+  return r < 0 ? -1 : 0;
+}
+
+static void uring_reap(AsyncIO *io) {
+  const struct io_uring_cqe *cqes = (const struct io_uring_cqe *)io->cqes;
+  unsigned head = *io->cq_head;
+  unsigned tail = __atomic_load_n(io->cq_tail, __ATOMIC_ACQUIRE);
+  for (; head != tail; head++) {
+    const struct io_uring_cqe *cqe = &cqes[head & *io->cq_mask];
+    AsyncRequest *req = (AsyncRequest *)(uintptr_t)cqe->user_data;
+    req->result = cqe->res;
+    req->done = 1;
+    io->inflight--;
+  }
+  __atomic_store_n(io->cq_head, head, __ATOMIC_RELEASE);
+}
+
+// Blocks until at least one more request completes.
+static int uring_wait_one(AsyncIO *io) {
+  if (uring_enter(io->ring_fd, 0, 1) < 0)
+    return -1;
+  uring_reap(io);
+  return 0;
+}
+
+static void uring_unmap(AsyncIO *io) {
+  if (io->sqes != NULL)
+    munmap(io->sqes, io->sqes_size);
+  if (io->cq_ring != NULL && io->cq_ring != io->sq_ring)
+    munmap(io->cq_ring, io->cq_ring_size);
+  if (io->sq_ring != NULL)
+    munmap(io->sq_ring, io->sq_ring_size);
+  io->sqes = io->cq_ring = io->sq_ring = NULL;
+}
+
+static void *map_ring(int fd, size_t size, off_t offset) {
+  void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                 fd, offset);
+  return p == MAP_FAILED ? NULL : p;
+}
+
+static int uring_init(AsyncIO *io) {
+  struct io_uring_params p;
+  memset(&p, 0, sizeof(p));
+  int fd = (int)syscall(__NR_io_uring_setup, io->depth, &p);
+  if (fd < 0)
+    return -1;
+  // IORING_OP_READ and IORING_OP_WRITE arrived in 5.6 with this feature bit.
+  if (!(p.features & IORING_FEAT_RW_CUR_POS)) {
+    close(fd);
+    return -1;
+  }
+  io->ring_fd = fd;
+  io->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  io->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    if (io->cq_ring_size > io->sq_ring_size)
+      io->sq_ring_size = io->cq_ring_size;
+    io->sq_ring = map_ring(fd, io->sq_ring_size, IORING_OFF_SQ_RING);
+    io->cq_ring = io->sq_ring;
+  } else {
+    io->sq_ring = map_ring(fd, io->sq_ring_size, IORING_OFF_SQ_RING);
+    io->cq_ring = map_ring(fd, io->cq_ring_size, IORING_OFF_CQ_RING);
+  }
+  io->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+  io->sqes = map_ring(fd, io->sqes_size, IORING_OFF_SQES);
+  if (io->sq_ring == NULL || io->cq_ring == NULL || io->sqes == NULL) {
+    uring_unmap(io);
+    close(fd);
+    io->ring_fd = -1;
+    return -1;
+  }
+  unsigned char *sq = (unsigned char *)io->sq_ring;
+  unsigned char *cq = (unsigned char *)io->cq_ring;
+  io->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+  io->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+  io->sq_array = (unsigned *)(sq + p.sq_off.array);
+  io->cq_head = (unsigned *)(cq + p.cq_off.head);
+  io->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+  io->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+  io->cqes = cq + p.cq_off.cqes;
+  return 0;
+}
+
+static int uring_submit(AsyncIO *io, AsyncRequest *req) {
+  while (io->inflight >= io->depth)
+    if (uring_wait_one(io) < 0)
+      return -1;
+  // Only this thread writes the tail; the kernel reads it.
+  unsigned tail = *io->sq_tail;
+  unsigned index = tail & *io->sq_mask;
+  struct io_uring_sqe *sqe = &((struct io_uring_sqe *)io->sqes)[index];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = req->write ? IORING_OP_WRITE : IORING_OP_READ;
+  sqe->fd = req->fd;
+  sqe->addr = (uint64_t)(uintptr_t)req->buf;
+  sqe->len = (unsigned)req->len;
+  sqe->off = (uint64_t)req->offset;
+  sqe->user_data = (uint64_t)(uintptr_t)req;
+  io->sq_array[index] = index;
+  __atomic_store_n(io->sq_tail, tail + 1, __ATOMIC_RELEASE);
+  io->inflight++;
+  return uring_enter(io->ring_fd, 1, 0);
+}
+
+static void *pool_main(void *arg) {
+  AsyncIO *io = (AsyncIO *)arg;
+  pthread_mutex_lock(&io->lock);
+  for (;;) {
+    while (!io->stop && io->queue_head == NULL)
+      pthread_cond_wait(&io->work, &io->lock);
+    AsyncRequest *req = io->queue_head;
+    if (req == NULL)
+      break;
+    io->queue_head = req->next;
+    if (io->queue_head == NULL)
+      io->queue_tail = NULL;
+    pthread_mutex_unlock(&io->lock);
+
+    ssize_t result = transfer(req, 0);
+
+    pthread_mutex_lock(&io->lock);
+    req->result = result;
+    req->done = 1;
+    io->inflight--;
+    pthread_cond_broadcast(&io->done);
+  }
+  pthread_mutex_unlock(&io->lock);
+  return NULL;
+}
+
+static int pool_init(AsyncIO *io) {
+  size_t threads = io->depth < ASYNC_IO_MAX_THREADS ? io->depth
+                                                    : ASYNC_IO_MAX_THREADS;
+  io->threads = (pthread_t *)malloc(threads * sizeof(pthread_t));
+  if (io->threads == NULL)
+    return -1;
+  pthread_mutex_init(&io->lock, NULL);
+  pthread_cond_init(&io->work, NULL);
+  pthread_cond_init(&io->done, NULL);
+  for (size_t i = 0; i < threads; i++) {
+    if (pthread_create(&io->threads[i], NULL, pool_main, io) != 0)
+      break;
+    io->thread_count++;
+  }
+  if (io->thread_count == 0) {
+    pthread_mutex_destroy(&io->lock);
+    pthread_cond_destroy(&io->work);
+    pthread_cond_destroy(&io->done);
+    free(io->threads);
+    io->threads = NULL;
+    return -1;
+  }
+  return 0;
+}
+
+static int pool_submit(AsyncIO *io, AsyncRequest *req) {
+  pthread_mutex_lock(&io->lock);
+  while (io->inflight >= io->depth)
+    pthread_cond_wait(&io->done, &io->lock);
+  req->next = NULL;
+  if (io->queue_tail != NULL)
+    io->queue_tail->next = req;
+  else
+    io->queue_head = req;
+  io->queue_tail = req;
+  io->inflight++;
+  pthread_cond_signal(&io->work);
+  pthread_mutex_unlock(&io->lock);
+  return 0;
+}
+
+int async_io_init(AsyncIO *io, unsigned depth, int use_uring) {
+  memset(io, 0, sizeof(*io));
+  io->ring_fd = -1;
+  io->depth = depth > 0 ? depth : 1;
+  if (use_uring && uring_init(io) == 0)
+    return 0;
+  return pool_init(io);
+}
+
+void async_io_free(AsyncIO *io) {
+  if (io->ring_fd >= 0) {
+    // Until every request completes the kernel may still write into the
+    // rings and the callers' buffers, so nothing is released before then.
+    // uring_enter retries EINTR; any other failure leaves requests that
+    // cannot be waited for, and the only safe way out is to stop.
+    while (io->inflight > 0) {
+      if (uring_wait_one(io) < 0) {
+        fprintf(stderr, "io_uring wait failed with %u requests in flight: %s\n",
+                io->inflight, strerror(errno));
+        abort();
+      }
+    }
+    uring_unmap(io);
+    close(io->ring_fd);
+    io->ring_fd = -1;
+    return;
+  }
+  if (io->threads == NULL)
+    return;
+  // The threads drain the queue before they stop.
+  pthread_mutex_lock(&io->lock);
+  io->stop = 1;
+  pthread_cond_broadcast(&io->work);
+  pthread_mutex_unlock(&io->lock);
+  for (size_t i = 0; i < io->thread_count; i++)
+    pthread_join(io->threads[i], NULL);
+  pthread_mutex_destroy(&io->lock);
+  pthread_cond_destroy(&io->work);
+  pthread_cond_destroy(&io->done);
+  free(io->threads);
+  io->threads = NULL;
+  io->thread_count = 0;
+}
+
+const char *async_io_backend(const AsyncIO *io) {
+  return io->ring_fd >= 0 ? "io_uring" : "pread";
+}
+
+static int submit(AsyncIO *io, AsyncRequest *req, int fd, int write,
+                  void *buf, size_t len, off_t offset) {
+  // An io_uring read or write moves at most 2^31 - 1 bytes.
+  if (len > 0x7fffffff)
+    return -1;
+  req->fd = fd;
+  req->write = write;
+  req->buf = buf;
+  req->len = len;
+  req->offset = offset;
+  req->result = 0;
+  req->done = 0;
+  return io->ring_fd >= 0 ? uring_submit(io, req) : pool_submit(io, req);
+}
+
+int async_io_read(AsyncIO *io, AsyncRequest *req, int fd, void *buf,
+                  size_t len, off_t offset) {
+  return submit(io, req, fd, 0, buf, len, offset);
+}
+
+int async_io_write(AsyncIO *io, AsyncRequest *req, int fd, const void *buf,
+                   size_t len, off_t offset) {
+  return submit(io, req, fd, 1, (void *)buf, len, offset);
+}
+
+ssize_t async_io_wait(AsyncIO *io, AsyncRequest *req) {
+  if (io->ring_fd < 0) {
+    pthread_mutex_lock(&io->lock);
+    while (!req->done)
+      pthread_cond_wait(&io->done, &io->lock);
+    pthread_mutex_unlock(&io->lock);
+    return req->result;
+  }
+  uring_reap(io);
+  while (!req->done)
+    if (uring_wait_one(io) < 0)
+      return -EIO;
+  // io_uring may stop short of `len`; finish the rest in place.
+  if (req->result > 0 && (size_t)req->result < req->len)
+    req->result = transfer(req, (size_t)req->result);
+  return req->result;
+}
@@ -0,0 +1,83 @@
+#ifndef ASYNC_IO_H
+#define ASYNC_IO_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+// Asynchronous whole-buffer reads and writes at file offsets, so a tile loop
+// can fetch the next tile and write back the last one while it computes.
+// Requests go to an io_uring instance, set up with raw syscalls (no
+// liburing), when the kernel offers one (5.6 or later, and not blocked by a
+// seccomp filter); otherwise to a few threads running pread/pwrite. Either
+// way completion is reported through async_io_wait.
+//
+// An AsyncIO is driven from one thread.
+
+// One read or write, owned by the caller from async_io_read/write until
+// async_io_wait returns.
+typedef struct AsyncRequest {
+  int fd;
+  int write;
+  void *buf;
+  size_t len;
+  off_t offset;
+  ssize_t result; // bytes transferred or -errno, once done
+  int done;
+  struct AsyncRequest *next; // thread pool queue
+} AsyncRequest;
+
+typedef struct {
+  int ring_fd; // -1 when the thread pool is in use
+  unsigned depth;
+  unsigned inflight;
+  // io_uring: the mapped rings and the pointers into them.
+  void *sq_ring;
+  size_t sq_ring_size;
+  void *cq_ring;
+  size_t cq_ring_size;
+  void *sqes;
+  size_t sqes_size;
+  unsigned *sq_tail;
+  unsigned *sq_mask;
+  unsigned *sq_array;
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned *cq_mask;
+  void *cqes;
+  // Thread pool fallback.
+  pthread_mutex_t lock;
+  pthread_cond_t work;
+  pthread_cond_t done;
+  AsyncRequest *queue_head;
+  AsyncRequest *queue_tail;
+  pthread_t *threads;
+  size_t thread_count;
+  int stop;
+} AsyncIO;
+
+// Sets up for up to `depth` requests in flight, with io_uring unless
+// `use_uring` is 0 or it is unavailable. Returns 0 on success, -1 if neither
+// backend could be started.
+int async_io_init(AsyncIO *io, unsigned depth, int use_uring);
+
+// Waits for requests in flight and releases the backend.
+void async_io_free(AsyncIO *io);
+
+// "io_uring" or "pread".
+const char *async_io_backend(const AsyncIO *io);
+
+// Start reading or writing `len` bytes at `offset`. Blocks only when `depth`
+// requests are already in flight. Returns 0, or -1 if it could not be
+// submitted.
+int async_io_read(AsyncIO *io, AsyncRequest *req, int fd, void *buf,
+                  size_t len, off_t offset);
+
+int async_io_write(AsyncIO *io, AsyncRequest *req, int fd, const void *buf,
+                   size_t len, off_t offset);
+
+// Waits for `req` and returns req->result: `len` unless the transfer failed
+// or hit end of file.
+ssize_t async_io_wait(AsyncIO *io, AsyncRequest *req);
+
+#endif
@@ -0,0 +1,723 @@
+#include "circuit.h"
+#include "arena.h"
+#include "ct_matrix.h"
+#include "he.h"
+#include "poly_utils.h"
+#include <limits.h>
+#include <omp.h>
+#include <stdlib.h>
+#include <string.h>
+
+void circuit_init(Circuit *c) { memset(c, 0, sizeof(*c)); }
+
+static void free_schedule(Circuit *c) {
+  free(c->order);
+  free(c->level_start);
+  free(c->slot);
+  c->order = NULL;
+  c->level_start = NULL;
+  c->slot = NULL;
+  c->level_count = 0;
+  c->slot_count = 0;
+}
+
+void circuit_free(Circuit *c) {
+  free(c->nodes);
+  free(c->outputs);
+  free(c->pairs);
+  free_schedule(c);
+  circuit_init(c);
+}
+
+// Returns `buf` grown to at least `need` elements of `size` bytes, or NULL
+// (leaving `buf` alone) if it cannot be.
+static void *grow(void *buf, size_t *capacity, size_t need, size_t size) {
+  if (need <= *capacity)
+    return buf;
+  size_t cap = *capacity > 0 ? *capacity : 64;
+  while (cap < need)
+    cap *= 2;
+  void *p = realloc(buf, cap * size);
+  if (p != NULL)
+    *capacity = cap;
+  return p;
+}
+
+static int push_node(Circuit *c, CircuitOp op, int a, int b, int64_t k) {
+  CircuitNode *nodes = (CircuitNode *)grow(c->nodes, &c->capacity,
+                                           c->count + 1, sizeof(CircuitNode));
+  if (nodes == NULL || c->count >= INT_MAX) {
+    c->failed = 1;
+    return -1;
+  }
+  c->nodes = nodes;
+  c->nodes[c->count] = (CircuitNode){op, a, b, k};
+  return (int)c->count++;
+}
+
+static int record(Circuit *c, CircuitOp op, int a, int b, int64_t k) {
+  if (c->optimized || a < 0 || b < 0 || a >= (int)c->count ||
+      b >= (int)c->count) {
+    c->failed = 1;
+    return -1;
+  }
+  c->recorded_ops++;
+  return push_node(c, op, a, b, k);
+}
+
+int circuit_input(Circuit *c) {
+  if (c->optimized) {
+    c->failed = 1;
+    return -1;
+  }
+  int id = push_node(c, CIRCUIT_INPUT, 0, 0, (int64_t)c->input_count);
+  if (id >= 0)
+    c->input_count++;
+  return id;
+}
+
+int circuit_add(Circuit *c, int a, int b) {
+  return record(c, CIRCUIT_ADD, a, b, 0);
+}
+
+int circuit_sub(Circuit *c, int a, int b) {
+  return circuit_add(c, a, circuit_scale(c, b, -1));
+}
+
+int circuit_scale(Circuit *c, int a, int64_t k) {
+  return record(c, CIRCUIT_SCALE, a, a, k);
+}
+
+int circuit_mul(Circuit *c, int a, int b) {
+  return record(c, CIRCUIT_MUL, a, b, 0);
+}
+
+int circuit_output(Circuit *c, int node) {
+  int *outputs = (int *)grow(c->outputs, &c->output_capacity,
+                             c->output_count + 1, sizeof(int));
+  if (c->optimized || node < 0 || node >= (int)c->count || outputs == NULL) {
+    c->failed = 1;
+    return -1;
+  }
+  c->outputs = outputs;
+  c->outputs[c->output_count] = node;
+  return (int)c->output_count++;
+}
+
+// A linear piece of the recorded circuit as sum k * atom, sorted by atom,
+// with every k in (0, t). An atom is a node of the rewritten circuit or, when
+// negative, the deferred product -(atom + 1).
+typedef struct {
+  int atom;
+  int64_t k;
+} Term;
+
+typedef struct {
+  Term *terms;
+  size_t count;
+} Form;
+
+// The rewritten circuit under construction, with a hash table of its nodes
+// for common-subexpression elimination.
+typedef struct {
+  Circuit g;
+  int *table;
+  size_t table_size;
+  int *deferred; // operand pairs of products not yet relinearized
+  size_t deferred_count;
+  size_t deferred_capacity;
+  int64_t t;
+} Rewriter;
+
+static size_t node_hash(const CircuitNode *n) {
+  uint64_t h = (uint64_t)n->op;
+  h = h * 1000003u ^ (uint32_t)n->a;
+  h = h * 1000003u ^ (uint32_t)n->b;
+  h = h * 1000003u ^ (uint64_t)n->k;
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdull;
+  h ^= h >> 33;
+  return (size_t)h;
+}
+
+static void table_insert(int *table, size_t size, const Circuit *g, int id) {
+  size_t i = node_hash(&g->nodes[id]) & (size - 1);
+  while (table[i] >= 0)
+    i = (i + 1) & (size - 1);
+  table[i] = id;
+}
+
+static int table_grow(Rewriter *r) {
+  size_t size = r->table_size > 0 ? 2 * r->table_size : 1024;
+  int *table = (int *)malloc(size * sizeof(int));
+  if (table == NULL)
+    return -1;
+  memset(table, 0xff, size * sizeof(int));
+  for (size_t i = 0; i < r->g.count; i++)
+    if (r->g.nodes[i].op != CIRCUIT_MUL_SUM)
+      table_insert(table, size, &r->g, (int)i);
+  free(r->table);
+  r->table = table;
+  r->table_size = size;
+  return 0;
+}
+
+// The existing node computing (op, a, b, k) with a <= b, or -1.
+static int find(const Rewriter *r, CircuitOp op, int a, int b, int64_t k) {
+  CircuitNode key = {op, a, b, k};
+  size_t mask = r->table_size - 1;
+  for (size_t i = node_hash(&key) & mask; r->table[i] >= 0; i = (i + 1) & mask) {
+    const CircuitNode *n = &r->g.nodes[r->table[i]];
+    if (n->op == op && n->a == a && n->b == b && n->k == k)
+      return r->table[i];
+  }
+  return -1;
+}
+
+// The node computing (op, a, b, k), added unless it already exists.
+static int emit(Rewriter *r, CircuitOp op, int a, int b, int64_t k) {
+  if (a < 0 || b < 0)
+    return -1;
+  if ((op == CIRCUIT_ADD || op == CIRCUIT_MUL) && a > b) {
+    int tmp = a;
+    a = b;
+    b = tmp;
+  }
+  int id = find(r, op, a, b, k);
+  if (id >= 0)
+    return id;
+  id = push_node(&r->g, op, a, b, k);
+  if (id < 0)
+    return -1;
+  if (2 * r->g.count > r->table_size) {
+    if (table_grow(r) < 0)
+      return -1;
+  } else {
+    table_insert(r->table, r->table_size, &r->g, id);
+  }
+  return id;
+}
+
+static int compare_int(const void *x, const void *y) {
+  int a = *(const int *)x, b = *(const int *)y;
+  return (a > b) - (a < b);
+}
+
+static int compare_term_k(const void *x, const void *y) {
+  const Term *a = (const Term *)x, *b = (const Term *)y;
+  if (a->k != b->k)
+    return (a->k > b->k) - (a->k < b->k);
+  return (a->atom > b->atom) - (a->atom < b->atom);
+}
+
+// Adds ids[0 .. count) pairwise, level by level, so the tree has depth
+// ceil(log2 count). Sorting first gives equal sets the same tree.
+static int balanced_sum(Rewriter *r, int *ids, size_t count) {
+  qsort(ids, count, sizeof(int), compare_int);
+  while (count > 1) {
+    for (size_t i = 0; i + 1 < count; i += 2)
+      ids[i / 2] = emit(r, CIRCUIT_ADD, ids[i], ids[i + 1], 0);
+    if (count % 2 == 1)
+      ids[count / 2] = ids[count - 1];
+    count = (count + 1) / 2;
+  }
+  return ids[0];
+}
+
+// A relinearized node for deferred product `index`.
+static int emit_product(Rewriter *r, int index) {
+  return emit(r, CIRCUIT_MUL, r->deferred[2 * index],
+              r->deferred[2 * index + 1], 0);
+}
+
+// Sum of the deferred products in terms[0 .. count) with one
+// relinearization.
+static int emit_product_sum(Rewriter *r, const Term *terms, size_t count) {
+  size_t first = r->g.pair_count / 2;
+  int *pairs = (int *)grow(r->g.pairs, &r->g.pair_capacity,
+                           r->g.pair_count + 2 * count, sizeof(int));
+  if (pairs == NULL)
+    return -1;
+  r->g.pairs = pairs;
+  for (size_t i = 0; i < count; i++) {
+    int index = -terms[i].atom - 1;
+    pairs[r->g.pair_count++] = r->deferred[2 * index];
+    pairs[r->g.pair_count++] = r->deferred[2 * index + 1];
+  }
+  return push_node(&r->g, CIRCUIT_MUL_SUM, (int)first, (int)count, 0);
+}
+
+// The node computing `f`: for each distinct coefficient k, the balanced sum
+// of its terms times k, and the balanced sum of those.
+static int materialize(Rewriter *r, const Form *f) {
+  if (f->count == 0)
+    return emit(r, CIRCUIT_ZERO, 0, 0, 0);
+  Term *sorted = (Term *)malloc(f->count * sizeof(Term));
+  int *group = (int *)malloc(f->count * sizeof(int));
+  int *sums = (int *)malloc(f->count * sizeof(int));
+  int result = -1;
+  size_t num_sums = 0;
+  if (sorted == NULL || group == NULL || sums == NULL)
+    goto done;
+  memcpy(sorted, f->terms, f->count * sizeof(Term));
+  // By k, then atom, so the deferred products of a group come first.
+  qsort(sorted, f->count, sizeof(Term), compare_term_k);
+  for (size_t i = 0; i < f->count;) {
+    size_t end = i, products = 0;
+    while (end < f->count && sorted[end].k == sorted[i].k) {
+      products += sorted[end].atom < 0;
+      end++;
+    }
+    size_t size = 0;
+    if (products == 1)
+      group[size++] = emit_product(r, -sorted[i].atom - 1);
+    else if (products > 1)
+      group[size++] = emit_product_sum(r, &sorted[i], products);
+    for (size_t j = i + products; j < end; j++)
+      group[size++] = sorted[j].atom;
+    for (size_t j = 0; j < size; j++)
+      if (group[j] < 0)
+        goto done;
+    int sum = balanced_sum(r, group, size);
+    if (sorted[i].k != 1)
+      sum = emit(r, CIRCUIT_SCALE, sum, sum, sorted[i].k);
+    if (sum < 0)
+      goto done;
+    sums[num_sums++] = sum;
+    i = end;
+  }
+  result = balanced_sum(r, sums, num_sums);
+done:
+  free(sorted);
+  free(group);
+  free(sums);
+  return result;
+}
+
+static int form_alloc(Form *f, size_t count) {
+  f->count = 0;
+  f->terms = (Term *)malloc((count > 0 ? count : 1) * sizeof(Term));
+  return f->terms != NULL ? 0 : -1;
+}
+
+static void form_free(Form *f) {
+  free(f->terms);
+  f->terms = NULL;
+  f->count = 0;
+}
+
+static int form_merge(Form *out, const Form *x, const Form *y, int64_t t) {
+  if (form_alloc(out, x->count + y->count) < 0)
+    return -1;
+  size_t i = 0, j = 0;
+  while (i < x->count || j < y->count) {
+    Term term;
+    if (j == y->count ||
+        (i < x->count && x->terms[i].atom < y->terms[j].atom)) {
+      term = x->terms[i++];
+    } else if (i == x->count || y->terms[j].atom < x->terms[i].atom) {
+      term = y->terms[j++];
+    } else {
+      term.atom = x->terms[i].atom;
+      term.k = (x->terms[i++].k + y->terms[j++].k) % t;
+    }
+    if (term.k != 0)
+      out->terms[out->count++] = term;
+  }
+  return 0;
+}
+
+static int form_scale(Form *out, const Form *x, int64_t k, int64_t t) {
+  if (form_alloc(out, x->count) < 0)
+    return -1;
+  for (size_t i = 0; i < x->count; i++) {
+    Term term = {x->terms[i].atom, x->terms[i].k * k % t};
+    if (term.k != 0)
+      out->terms[out->count++] = term;
+  }
+  return 0;
+}
+
+static int form_single(Form *out, int atom, int64_t k) {
+  if (form_alloc(out, 1) < 0)
+    return -1;
+  if (k != 0)
+    out->terms[out->count++] = (Term){atom, k};
+  return 0;
+}
+
+// A product operand as k * node: a single term keeps its scalar outside the
+// product, anything else is materialized with k = 1.
+static int operand_node(Rewriter *r, const Form *f, int64_t *k) {
+  *k = 1;
+  if (f->count != 1)
+    return materialize(r, f);
+  *k = f->terms[0].k;
+  int atom = f->terms[0].atom;
+  return atom >= 0 ? atom : emit_product(r, -atom - 1);
+}
+
+// The product of forms x and y as a form.
+static int form_product(Rewriter *r, Form *out, const Form *x, const Form *y,
+                        int defer) {
+  if (x->count == 0 || y->count == 0)
+    return form_alloc(out, 0);
+  int64_t kx, ky;
+  int a = operand_node(r, x, &kx);
+  int b = operand_node(r, y, &ky);
+  if (a < 0 || b < 0)
+    return -1;
+  if (a > b) {
+    int tmp = a;
+    a = b;
+    b = tmp;
+  }
+  // A product that already exists is reused rather than deferred.
+  int atom = find(r, CIRCUIT_MUL, a, b, 0);
+  if (atom < 0 && defer) {
+    int *deferred = (int *)grow(r->deferred, &r->deferred_capacity,
+                                2 * r->deferred_count + 2, sizeof(int));
+    if (deferred == NULL)
+      return -1;
+    r->deferred = deferred;
+    deferred[2 * r->deferred_count] = a;
+    deferred[2 * r->deferred_count + 1] = b;
+    atom = -(int)r->deferred_count++ - 1;
+  } else if (atom < 0) {
+    atom = emit(r, CIRCUIT_MUL, a, b, 0);
+    if (atom < 0)
+      return -1;
+  }
+  return form_single(out, atom, kx * ky % r->t);
+}
+
+// Rewrites c->nodes into r->g and points c->outputs at the new nodes.
+static int rewrite(Circuit *c, Rewriter *r) {
+  size_t count = c->count;
+  Form *forms = (Form *)calloc(count > 0 ? count : 1, sizeof(Form));
+  size_t *uses = (size_t *)calloc(count > 0 ? count : 1, sizeof(size_t));
+  char *live = (char *)calloc(count > 0 ? count : 1, 1);
+  int rc = -1;
+  if (forms == NULL || uses == NULL || live == NULL || table_grow(r) < 0)
+    goto done;
+
+  for (size_t i = 0; i < c->input_count; i++)
+    if (emit(r, CIRCUIT_INPUT, 0, 0, (int64_t)i) < 0)
+      goto done;
+
+  for (size_t o = 0; o < c->output_count; o++) {
+    live[c->outputs[o]] = 1;
+    uses[c->outputs[o]]++;
+  }
+  for (size_t i = count; i-- > 0;) {
+    const CircuitNode *n = &c->nodes[i];
+    if (!live[i] || n->op == CIRCUIT_INPUT)
+      continue;
+    live[n->a] = live[n->b] = 1;
+    uses[n->a]++;
+    if (n->op != CIRCUIT_SCALE)
+      uses[n->b]++;
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    const CircuitNode *n = &c->nodes[i];
+    if (!live[i])
+      continue;
+    int status = 0;
+    switch (n->op) {
+    case CIRCUIT_INPUT:
+      status = form_single(&forms[i], (int)n->k, 1);
+      break;
+    case CIRCUIT_ADD:
+      status = form_merge(&forms[i], &forms[n->a], &forms[n->b], r->t);
+      break;
+    case CIRCUIT_SCALE:
+      status = form_scale(&forms[i], &forms[n->a],
+                          (n->k % r->t + r->t) % r->t, r->t);
+      break;
+    case CIRCUIT_MUL:
+      // A product with a single reader ends up in one sum, so its
+      // relinearization can wait for that sum's.
+      status = form_product(r, &forms[i], &forms[n->a], &forms[n->b],
+                            uses[i] == 1);
+      break;
+    default:
+      status = -1;
+    }
+    if (status < 0)
+      goto done;
+    if (n->op != CIRCUIT_INPUT) {
+      if (--uses[n->a] == 0)
+        form_free(&forms[n->a]);
+      if (n->op != CIRCUIT_SCALE && --uses[n->b] == 0)
+        form_free(&forms[n->b]);
+    }
+  }
+
+  for (size_t o = 0; o < c->output_count; o++) {
+    int node = c->outputs[o];
+    int id = materialize(r, &forms[node]);
+    if (id < 0)
+      goto done;
+    c->outputs[o] = id;
+    if (--uses[node] == 0)
+      form_free(&forms[node]);
+  }
+  rc = 0;
+done:
+  if (forms != NULL)
+    for (size_t i = 0; i < count; i++)
+      form_free(&forms[i]);
+  free(forms);
+  free(uses);
+  free(live);
+  return rc;
+}
+
+// Levels (inputs are level 0), the order of evaluation, and value slots:
+// a node's slot is free again from the level after its last reader.
+static int schedule(Circuit *c) {
+  size_t count = c->count;
+  int *level = (int *)calloc(count, sizeof(int));
+  int *last = (int *)malloc(count * sizeof(int));
+  char *live = (char *)calloc(count, 1);
+  int *dying = (int *)malloc(count * sizeof(int));
+  int *free_slots = (int *)malloc(count * sizeof(int));
+  size_t *dying_start = NULL;
+  int rc = -1;
+  c->slot = (int *)malloc(count * sizeof(int));
+  c->order = (int *)malloc(count * sizeof(int));
+  if (level == NULL || last == NULL || live == NULL || dying == NULL ||
+      free_slots == NULL || c->slot == NULL || c->order == NULL)
+    goto done;
+
+  for (size_t o = 0; o < c->output_count; o++)
+    live[c->outputs[o]] = 1;
+  for (size_t i = count; i-- > 0;) {
+    const CircuitNode *n = &c->nodes[i];
+    if (!live[i])
+      continue;
+    if (n->op == CIRCUIT_ADD || n->op == CIRCUIT_SCALE || n->op == CIRCUIT_MUL)
+      live[n->a] = live[n->b] = 1;
+    if (n->op == CIRCUIT_MUL_SUM)
+      for (int j = 0; j < 2 * n->b; j++)
+        live[c->pairs[2 * n->a + j]] = 1;
+  }
+
+  int max_level = 0;
+  for (size_t i = 0; i < count; i++) {
+    const CircuitNode *n = &c->nodes[i];
+    last[i] = -1;
+    c->slot[i] = -1;
+    if (!live[i] || n->op == CIRCUIT_INPUT)
+      continue;
+    int top = 0;
+    if (n->op == CIRCUIT_MUL_SUM) {
+      for (int j = 0; j < 2 * n->b; j++)
+        if (level[c->pairs[2 * n->a + j]] > top)
+          top = level[c->pairs[2 * n->a + j]];
+    } else if (n->op != CIRCUIT_ZERO) {
+      top = level[n->a] > level[n->b] ? level[n->a] : level[n->b];
+    }
+    level[i] = top + 1;
+    if (level[i] > max_level)
+      max_level = level[i];
+  }
+  for (size_t i = 0; i < count; i++) {
+    const CircuitNode *n = &c->nodes[i];
+    if (!live[i] || n->op == CIRCUIT_INPUT || n->op == CIRCUIT_ZERO)
+      continue;
+    if (n->op == CIRCUIT_MUL_SUM) {
+      for (int j = 0; j < 2 * n->b; j++) {
+        int x = c->pairs[2 * n->a + j];
+        last[x] = last[x] > level[i] ? last[x] : level[i];
+      }
+    } else {
+      last[n->a] = last[n->a] > level[i] ? last[n->a] : level[i];
+      last[n->b] = last[n->b] > level[i] ? last[n->b] : level[i];
+    }
+  }
+  for (size_t o = 0; o < c->output_count; o++)
+    last[c->outputs[o]] = INT_MAX;
+
+  // Counting sorts: nodes by level, and by the level of their last reader.
+  c->level_count = (size_t)max_level;
+  c->level_start = (size_t *)calloc(c->level_count + 2, sizeof(size_t));
+  dying_start = (size_t *)calloc(c->level_count + 2, sizeof(size_t));
+  if (c->level_start == NULL || dying_start == NULL)
+    goto done;
+  for (size_t i = 0; i < count; i++) {
+    if (level[i] > 0)
+      c->level_start[level[i]]++;
+    if (level[i] > 0 && last[i] != INT_MAX)
+      dying_start[last[i]]++;
+  }
+  for (size_t l = 1; l <= c->level_count + 1; l++) {
+    c->level_start[l] += c->level_start[l - 1];
+    dying_start[l] += dying_start[l - 1];
+  }
+  for (size_t i = count; i-- > 0;) {
+    if (level[i] > 0)
+      c->order[--c->level_start[level[i]]] = (int)i;
+    if (level[i] > 0 && last[i] != INT_MAX)
+      dying[--dying_start[last[i]]] = (int)i;
+  }
+  // level_start[l] now begins level l; shift so index 0 is level 1.
+  memmove(c->level_start, c->level_start + 1,
+          (c->level_count + 1) * sizeof(size_t));
+
+  size_t num_free = 0;
+  c->slot_count = 0;
+  for (size_t l = 1; l <= c->level_count; l++) {
+    for (size_t d = dying_start[l - 1]; d < dying_start[l]; d++)
+      free_slots[num_free++] = c->slot[dying[d]];
+    for (size_t i = c->level_start[l - 1]; i < c->level_start[l]; i++)
+      c->slot[c->order[i]] =
+          num_free > 0 ? free_slots[--num_free] : (int)c->slot_count++;
+  }
+  rc = 0;
+done:
+  free(level);
+  free(last);
+  free(live);
+  free(dying);
+  free(free_slots);
+  free(dying_start);
+  return rc;
+}
+
+int circuit_optimize(Circuit *c, double t) {
+  if (c->failed || c->optimized || t < 2.0 || t >= 2147483648.0 ||
+      t != (double)(int64_t)t)
+    return -1;
+  Rewriter r;
+  memset(&r, 0, sizeof(r));
+  circuit_init(&r.g);
+  r.t = (int64_t)t;
+  int rc = rewrite(c, &r);
+  free(r.table);
+  free(r.deferred);
+  if (rc < 0 || r.g.failed) {
+    circuit_free(&r.g);
+    c->failed = 1;
+    return -1;
+  }
+  free(c->nodes);
+  free(c->pairs);
+  c->nodes = r.g.nodes;
+  c->count = r.g.count;
+  c->capacity = r.g.capacity;
+  c->pairs = r.g.pairs;
+  c->pair_count = r.g.pair_count;
+  c->pair_capacity = r.g.pair_capacity;
+  if (schedule(c) < 0) {
+    free_schedule(c);
+    c->failed = 1;
+    return -1;
+  }
+  c->optimized = 1;
+  return 0;
+}
+
+size_t circuit_op_count(const Circuit *c) {
+  return c->optimized ? c->level_start[c->level_count] : c->recorded_ops;
+}
+
+static const Ciphertext *operand(const Circuit *c, const CtMatrix *values,
+                                 const Ciphertext *inputs, int node,
+                                 Ciphertext *buf) {
+  if (c->nodes[node].op == CIRCUIT_INPUT)
+    return &inputs[c->nodes[node].k];
+  ct_matrix_load(values, (size_t)c->slot[node], 0, buf);
+  return buf;
+}
+
+static void relin(Ciphertext *out, const Ciphertext3 *prod,
+                  const CircuitEval *eval) {
+  if (eval->rlk_digits != NULL)
+    relinearize_digits(out, prod, eval->q, eval->poly_mod, eval->rlk_digits);
+  else
+    relinearize(out, prod, eval->q, eval->p, eval->poly_mod, eval->rlk);
+}
+
+static void eval_node(const Circuit *c, const CircuitEval *eval,
+                      CtMatrix *values, const Ciphertext *inputs, int id) {
+  const CircuitNode *n = &c->nodes[id];
+  size_t mark = scratch_mark();
+  Ciphertext *x = (Ciphertext *)scratch_bytes(sizeof(Ciphertext));
+  Ciphertext *y = (Ciphertext *)scratch_bytes(sizeof(Ciphertext));
+  Ciphertext *res = (Ciphertext *)scratch_bytes(sizeof(Ciphertext));
+  double q = eval->q;
+  switch (n->op) {
+  case CIRCUIT_ZERO:
+    memset(res->c0.coeffs, 0, values->n * sizeof(double));
+    memset(res->c1.coeffs, 0, values->n * sizeof(double));
+    poly_truncate(&res->c0, values->n);
+    poly_truncate(&res->c1, values->n);
+    res->noise = 0.0;
+    break;
+  case CIRCUIT_ADD:
+    add_cipher_into(res, operand(c, values, inputs, n->a, x),
+                    operand(c, values, inputs, n->b, y), q, eval->poly_mod);
+    break;
+  case CIRCUIT_SCALE:
+    mul_plain_into(res, operand(c, values, inputs, n->a, x), q, eval->t,
+                   eval->poly_mod, (double)n->k);
+    break;
+  case CIRCUIT_MUL:
+  case CIRCUIT_MUL_SUM: {
+    Ciphertext3 *acc = (Ciphertext3 *)scratch_bytes(sizeof(Ciphertext3));
+    Ciphertext3 *prod = (Ciphertext3 *)scratch_bytes(sizeof(Ciphertext3));
+    int pair[2] = {n->a, n->b};
+    const int *pairs = n->op == CIRCUIT_MUL ? pair : &c->pairs[2 * n->a];
+    int products = n->op == CIRCUIT_MUL ? 1 : n->b;
+    for (int j = 0; j < products; j++) {
+      mul_cipher_no_relin(j == 0 ? acc : prod,
+                          operand(c, values, inputs, pairs[2 * j], x),
+                          operand(c, values, inputs, pairs[2 * j + 1], y), q,
+                          eval->t, eval->poly_mod);
+      if (j > 0)
+        add_cipher3(acc, prod, q, eval->poly_mod);
+    }
+    relin(res, acc, eval);
+    break;
+  }
+  default:
+    break;
+  }
+  ct_matrix_store(values, (size_t)c->slot[id], 0, res);
+  scratch_release(mark);
+}
+
+int circuit_run(const Circuit *c, const CircuitEval *eval,
+                const Ciphertext *inputs, Ciphertext *outputs) {
+  if (!c->optimized)
+    return -1;
+  for (size_t i = 0; i < c->level_start[c->level_count]; i++) {
+    CircuitOp op = c->nodes[c->order[i]].op;
+    if ((op == CIRCUIT_MUL || op == CIRCUIT_MUL_SUM) &&
+        eval->rlk_digits == NULL && eval->rlk == NULL)
+      return -1;
+  }
+  size_t n = (size_t)poly_degree_of(eval->poly_mod);
+  CtMatrix values;
+  if (ct_matrix_init(&values, c->slot_count > 0 ? c->slot_count : 1, 1, n) <
+      0)
+    return -1;
+  int threads = eval->threads > 0 ? eval->threads : omp_get_max_threads();
+  for (size_t l = 0; l < c->level_count; l++) {
+    long begin = (long)c->level_start[l], end = (long)c->level_start[l + 1];
+#pragma omp parallel for schedule(dynamic) num_threads(threads)
+    for (long i = begin; i < end; i++)
+      eval_node(c, eval, &values, inputs, c->order[i]);
+  }
+  for (size_t o = 0; o < c->output_count; o++) {
+    const CircuitNode *node = &c->nodes[c->outputs[o]];
+    if (node->op == CIRCUIT_INPUT)
+      outputs[o] = inputs[node->k];
+    else
+      ct_matrix_load(&values, (size_t)c->slot[c->outputs[o]], 0, &outputs[o]);
+  }
+  ct_matrix_free(&values);
+  return 0;
+}
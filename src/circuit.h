@@ -0,0 +1,118 @@
+#ifndef CIRCUIT_H
+#define CIRCUIT_H
+
+#include "types.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// Homomorphic circuits recorded as a graph over ciphertext handles and run as
+// a whole, instead of hand-written loops of evaluation calls:
+//
+//   Circuit c;
+//   circuit_init(&c);
+//   int r = circuit_input(&c), g = circuit_input(&c), b = circuit_input(&c);
+//   int sum = circuit_add(&c, circuit_add(&c, r, g), b);
+//   circuit_output(&c, circuit_scale(&c, sum, inv3));
+//   circuit_optimize(&c, t);
+//   circuit_run(&c, &eval, inputs, outputs);
+//   circuit_free(&c);
+//
+// circuit_optimize rewrites the recorded graph:
+// - each linear piece (additions and plaintext scalars) becomes a sum of
+//   coefficient * term, with the scalars folded mod t and zero terms dropped;
+// - terms that share a coefficient are added in a balanced tree and scaled
+//   once;
+// - identical operations are computed once, and scalars are pulled out of
+//   products so that (k*a) * b and a * b share the product;
+// - products used once are added as three-part ciphertexts and relinearized
+//   once per sum (see mul_cipher_no_relin).
+// circuit_run evaluates the result level by level, running the operations
+// of a level in parallel. Intermediate values are kept as the n live
+// coefficients in a CtMatrix, and a value's slot is reused once its last
+// reader has run.
+typedef enum {
+  CIRCUIT_INPUT,   // inputs[k]
+  CIRCUIT_ZERO,    // an encryption of zero with no noise
+  CIRCUIT_ADD,     // a + b
+  CIRCUIT_SCALE,   // a * k
+  CIRCUIT_MUL,     // a * b, relinearized
+  CIRCUIT_MUL_SUM, // sum of the b products listed at pairs[2a], relinearized
+} CircuitOp;
+
+typedef struct {
+  CircuitOp op;
+  int a;
+  int b;
+  int64_t k;
+} CircuitNode;
+
+typedef struct {
+  CircuitNode *nodes;
+  size_t count;
+  size_t capacity;
+  int *outputs; // node per output
+  size_t output_count;
+  size_t output_capacity;
+  size_t input_count;
+  int *pairs; // operands of CIRCUIT_MUL_SUM nodes
+  size_t pair_count;
+  size_t pair_capacity;
+  int failed; // an allocation failed while recording
+  int optimized;
+  size_t recorded_ops; // additions, scalings and products as recorded
+  // Schedule, set by circuit_optimize: the live non-input nodes ordered by
+  // level, where level l is order[level_start[l] .. level_start[l + 1]).
+  int *order;
+  size_t *level_start;
+  size_t level_count;
+  int *slot; // value slot per node
+  size_t slot_count;
+} Circuit;
+
+// What circuit_run evaluates with. Products relinearize with rlk_digits when
+// it is set and with rlk and p otherwise; circuits without products need
+// neither. `threads` of 0 uses the OpenMP default.
+typedef struct {
+  double q;
+  double t;
+  const Poly *poly_mod;
+  double p;
+  const EvalKey *rlk;
+  const DigitEvalKey *rlk_digits;
+  int threads;
+} CircuitEval;
+
+void circuit_init(Circuit *c);
+
+void circuit_free(Circuit *c);
+
+// Recording. Each call returns the handle of the new value, or -1 if an
+// operand is -1 or memory ran out (circuit_optimize then fails). The i-th
+// circuit_input is inputs[i] in circuit_run. Scalars may be negative.
+int circuit_input(Circuit *c);
+
+int circuit_add(Circuit *c, int a, int b);
+
+int circuit_sub(Circuit *c, int a, int b);
+
+int circuit_scale(Circuit *c, int a, int64_t k);
+
+int circuit_mul(Circuit *c, int a, int b);
+
+// Marks `node` as the next output; returns its index or -1.
+int circuit_output(Circuit *c, int node);
+
+// Rewrites and schedules the circuit for plaintext modulus t (below 2^31).
+// No more operations can be recorded afterwards. Returns 0 on success, -1 if
+// recording failed, t is out of range or memory ran out.
+int circuit_optimize(Circuit *c, double t);
+
+// Operations left after circuit_optimize, inputs not counted.
+size_t circuit_op_count(const Circuit *c);
+
+// outputs[i] = value of output i. Returns 0 on success, -1 if the circuit is
+// not optimized, has products but no relinearization key, or memory ran out.
+int circuit_run(const Circuit *c, const CircuitEval *eval,
+                const Ciphertext *inputs, Ciphertext *outputs);
+
+#endif
@@ -0,0 +1,94 @@
+#define _POSIX_C_SOURCE 200809L
+#include "ct_matrix.h"
+#include "arena.h"
+#include "he.h"
+#include "instrument.h"
+#include "poly_utils.h"
+#include "ring_utils.h"
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+int ct_matrix_init(CtMatrix *m, size_t rows, size_t cols, size_t n) {
+  size_t count = rows * cols;
+  // c0 and c1 blocks, then the noise estimates.
+  size_t bytes = (2 * count * n + count) * sizeof(double);
+  void *base = NULL;
+  if (bytes == 0 || posix_memalign(&base, ARENA_ALIGN, bytes) != 0)
+    return -1;
+  memset(base, 0, bytes);
+  m->rows = rows;
+  m->cols = cols;
+  m->n = n;
+  m->c0 = (double *)base;
+  m->c1 = m->c0 + count * n;
+  m->noise = m->c1 + count * n;
+  return 0;
+}
+
+void ct_matrix_free(CtMatrix *m) {
+  free(m->c0);
+  m->c0 = NULL;
+  m->c1 = NULL;
+  m->noise = NULL;
+}
+
+void ct_matrix_store(CtMatrix *m, size_t i, size_t j, const Ciphertext *ct) {
+  size_t idx = i * m->cols + j;
+  assert(ct->c0.degree < (int)m->n && ct->c1.degree < (int)m->n);
+  poly_copy_coeffs(m->c0 + idx * m->n, &ct->c0, m->n);
+  poly_copy_coeffs(m->c1 + idx * m->n, &ct->c1, m->n);
+  m->noise[idx] = ct->noise;
+}
+
+void ct_matrix_load(const CtMatrix *m, size_t i, size_t j, Ciphertext *ct) {
+  size_t idx = i * m->cols + j;
+  memcpy(ct->c0.coeffs, m->c0 + idx * m->n, m->n * sizeof(double));
+  memcpy(ct->c1.coeffs, m->c1 + idx * m->n, m->n * sizeof(double));
+  poly_truncate(&ct->c0, m->n);
+  poly_truncate(&ct->c1, m->n);
+  ct->noise = m->noise[idx];
+}
+
+CtView ct_matrix_row(const CtMatrix *m, size_t i) {
+  size_t offset = i * m->cols;
+  CtView v = {m->cols, m->n, m->n, 1, m->c0 + offset * m->n,
+              m->c1 + offset * m->n, m->noise + offset};
+  return v;
+}
+
+CtView ct_matrix_col(const CtMatrix *m, size_t j) {
+  CtView v = {m->rows,       m->n,          m->cols * m->n, m->cols,
+              m->c0 + j * m->n, m->c1 + j * m->n, m->noise + j};
+  return v;
+}
+
+void ct_gemm_plain(CtMatrix *C, const int64_t *A, const CtMatrix *B,
+                   double q, double t) {
+  assert(C->n == B->n && C->cols == B->cols);
+  size_t n = B->n;
+  size_t inner = B->rows;
+
+#pragma omp parallel for schedule(static)
+  for (size_t i = 0; i < C->rows; i++) {
+    INSTR_BEGIN();
+    CtView out = ct_matrix_row(C, i);
+    memset(out.c0, 0, out.count * n * sizeof(double));
+    memset(out.c1, 0, out.count * n * sizeof(double));
+    for (size_t j = 0; j < inner; j++) {
+      // Same encoding as encode_plain_integer.
+      double k = positive_fmod((double)A[i * inner + j], t);
+      CtView row = ct_matrix_row(B, j);
+      // Row j of B is contiguous, so all of C's row i updates in one pass.
+      ring_axpy_mod(out.c0, row.c0, k, q, out.count * n);
+      ring_axpy_mod(out.c1, row.c1, k, q, out.count * n);
+      for (size_t col = 0; col < out.count; col++) {
+        double term = noise_mul_plain(row.noise[col], k, q, t);
+        out.noise[col] = j == 0 ? term : out.noise[col] + term;
+      }
+    }
+    // Per row of C: each of the inner terms reads a row of B and updates C's.
+    INSTR_END(INSTR_GEMM_PLAIN, INSTR_COEFF_BYTES(6 * inner * out.count * n));
+  }
+}
@@ -0,0 +1,58 @@
+#ifndef CT_MATRIX_H
+#define CT_MATRIX_H
+
+#include "types.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// Matrix of ciphertexts in structure-of-arrays form. Only the n live
+// coefficients of each polynomial are kept (everything is reduced mod X^n + 1),
+// all c0 polynomials first and then all c1 polynomials, row-major, in one
+// 64-byte aligned block. Element (i, j)'s c0 is the n doubles at
+// c0 + (i * cols + j) * n.
+typedef struct {
+  size_t rows;
+  size_t cols;
+  size_t n;
+  double *c0;
+  double *c1;
+  double *noise; // rows * cols estimates, see Ciphertext
+} CtMatrix;
+
+// A row or column of a CtMatrix. Ciphertext k's c0 is the n doubles at
+// c0 + k * stride (likewise c1) and its noise is noise[k * noise_stride].
+typedef struct {
+  size_t count;
+  size_t n;
+  size_t stride;
+  size_t noise_stride;
+  double *c0;
+  double *c1;
+  double *noise;
+} CtView;
+
+// Returns 0 on success, -1 if the block could not be allocated. The matrix
+// starts out as all zero.
+int ct_matrix_init(CtMatrix *m, size_t rows, size_t cols, size_t n);
+
+void ct_matrix_free(CtMatrix *m);
+
+// Copies between a Ciphertext and element (i, j). `ct` must already be
+// reduced mod X^n + 1.
+void ct_matrix_store(CtMatrix *m, size_t i, size_t j, const Ciphertext *ct);
+
+void ct_matrix_load(const CtMatrix *m, size_t i, size_t j, Ciphertext *ct);
+
+CtView ct_matrix_row(const CtMatrix *m, size_t i);
+
+CtView ct_matrix_col(const CtMatrix *m, size_t j);
+
+// Encrypted GEMM against a plaintext matrix: C = A * B with A a rows(C) x
+// rows(B) row-major matrix of integers. Each output is the same sum of
+// mul_plain terms that mul_plain + add_cipher would produce, coefficient for
+// coefficient, but computed as unit-stride multiply-add-reduce loops over
+// B's rows, in parallel over the rows of C.
+void ct_gemm_plain(CtMatrix *C, const int64_t *A, const CtMatrix *B,
+                   double q, double t);
+
+#endif
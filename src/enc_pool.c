@@ -0,0 +1,134 @@
+#define _POSIX_C_SOURCE 200809L
+#include "enc_pool.h"
+#include "arena.h"
+#include "he.h"
+#include "poly_utils.h"
+#include <math.h>
+#include <stdlib.h>
+
+static void encrypt_zero(Ciphertext *out, const EncPool *pool) {
+  size_t mark = scratch_mark();
+  Poly *zero = scratch_polys(1);
+  poly_zero(zero);
+  encrypt_poly(out, pool->pk, pool->n, pool->q, pool->poly_mod, pool->t,
+               zero);
+  scratch_release(mark);
+}
+
+// Copies the n live coefficients only; a Ciphertext is ~160 KB.
+static void copy_ct(Ciphertext *dst, const Ciphertext *src, size_t n) {
+  poly_copy_coeffs(dst->c0.coeffs, &src->c0, n);
+  poly_copy_coeffs(dst->c1.coeffs, &src->c1, n);
+  dst->c0.degree = src->c0.degree;
+  dst->c1.degree = src->c1.degree;
+  dst->c0.max_degree = (int)n - 1;
+  dst->c1.max_degree = (int)n - 1;
+  dst->noise = src->noise;
+}
+
+// Encrypts outside the lock into its own buffer, then publishes the result.
+// A slot is reserved through `filling` first so the threads never overfill.
+static void *filler_main(void *arg) {
+  EncPool *pool = (EncPool *)arg;
+  Ciphertext *ct = (Ciphertext *)malloc(sizeof(Ciphertext));
+  if (ct == NULL)
+    return NULL;
+  pthread_mutex_lock(&pool->lock);
+  for (;;) {
+    while (!pool->stop && pool->count + pool->filling >= pool->capacity)
+      pthread_cond_wait(&pool->not_full, &pool->lock);
+    if (pool->stop)
+      break;
+    pool->filling++;
+    pthread_mutex_unlock(&pool->lock);
+
+    encrypt_zero(ct, pool);
+
+    pthread_mutex_lock(&pool->lock);
+    size_t tail = (pool->head + pool->count) % pool->capacity;
+    copy_ct(&pool->zeros[tail], ct, pool->n);
+    pool->count++;
+    pool->filling--;
+  }
+  pthread_mutex_unlock(&pool->lock);
+  free(ct);
+  return NULL;
+}
+
+int enc_pool_init(EncPool *pool, const PublicKey *pk, size_t n, double q,
+                  const Poly *poly_mod, double t, size_t capacity,
+                  size_t threads) {
+  pool->pk = pk;
+  pool->poly_mod = poly_mod;
+  pool->n = n;
+  pool->q = q;
+  pool->t = t;
+  pool->capacity = capacity > 0 ? capacity : 1;
+  pool->head = 0;
+  pool->count = 0;
+  pool->filling = 0;
+  pool->misses = 0;
+  pool->stop = 0;
+  pool->thread_count = 0;
+  pool->zeros = (Ciphertext *)malloc(pool->capacity * sizeof(Ciphertext));
+  pool->threads = (pthread_t *)malloc((threads > 0 ? threads : 1) *
+                                      sizeof(pthread_t));
+  if (pool->zeros == NULL || pool->threads == NULL) {
+    free(pool->zeros);
+    free(pool->threads);
+    return -1;
+  }
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->not_full, NULL);
+
+  for (; pool->count < pool->capacity; pool->count++)
+    encrypt_zero(&pool->zeros[pool->count], pool);
+  for (size_t i = 0; i < threads; i++) {
+    if (pthread_create(&pool->threads[i], NULL, filler_main, pool) != 0) {
+      enc_pool_free(pool);
+      return -1;
+    }
+    pool->thread_count++;
+  }
+  return 0;
+}
+
+void enc_pool_free(EncPool *pool) {
+  pthread_mutex_lock(&pool->lock);
+  pool->stop = 1;
+  pthread_cond_broadcast(&pool->not_full);
+  pthread_mutex_unlock(&pool->lock);
+  for (size_t i = 0; i < pool->thread_count; i++)
+    pthread_join(pool->threads[i], NULL);
+  pthread_cond_destroy(&pool->not_full);
+  pthread_mutex_destroy(&pool->lock);
+  free(pool->zeros);
+  free(pool->threads);
+  pool->zeros = NULL;
+  pool->threads = NULL;
+  pool->thread_count = 0;
+}
+
+// encrypt adds Delta*m last, and c0 + Delta*m mod q is the same number
+// whether it is added now or then.
+void encrypt_pooled(Ciphertext *out, EncPool *pool, double pt) {
+  int hit = 0;
+  pthread_mutex_lock(&pool->lock);
+  if (pool->count > 0) {
+    copy_ct(out, &pool->zeros[pool->head], pool->n);
+    pool->head = (pool->head + 1) % pool->capacity;
+    pool->count--;
+    pthread_cond_signal(&pool->not_full);
+    hit = 1;
+  } else {
+    pool->misses++;
+  }
+  pthread_mutex_unlock(&pool->lock);
+  if (!hit)
+    encrypt_zero(out, pool);
+
+  double *c0 = out->c0.coeffs;
+  c0[0] = positive_fmod(c0[0] + floor(pool->q / pool->t) *
+                                    positive_fmod(pt, pool->t),
+                        pool->q);
+}
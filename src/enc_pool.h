@@ -0,0 +1,49 @@
+#ifndef ENC_POOL_H
+#define ENC_POOL_H
+
+#include "types.h"
+#include <pthread.h>
+#include <stddef.h>
+
+// Pool of fresh public-key encryptions of zero. Everything costly in
+// `encrypt` (sampling u, e1 and e2 and the products with pk) is independent
+// of the message, so background threads keep the pool topped up and
+// encrypt_pooled only adds Delta*m to a popped encryption of zero: O(n) and
+// one lock on the request path. An empty pool falls back to encrypting
+// inline, so a burst costs what plain `encrypt` would.
+//
+// A popped ciphertext equals what `encrypt` gives for the same draws. Each
+// encryption of zero is handed out once.
+typedef struct {
+  const PublicKey *pk;
+  const Poly *poly_mod;
+  size_t n;
+  double q;
+  double t;
+  Ciphertext *zeros; // ring buffer of `capacity` entries
+  size_t capacity;
+  size_t head;
+  size_t count;
+  size_t filling; // reserved by a filler thread, not yet in `count`
+  size_t misses;  // pops that found the pool empty
+  int stop;
+  pthread_mutex_t lock;
+  pthread_cond_t not_full;
+  pthread_t *threads;
+  size_t thread_count;
+} EncPool;
+
+// Fills the pool to `capacity` on the calling thread, then starts `threads`
+// filler threads. `pk` and `poly_mod` must outlive the pool. Returns 0 on
+// success, -1 if memory or a thread could not be allocated.
+int enc_pool_init(EncPool *pool, const PublicKey *pk, size_t n, double q,
+                  const Poly *poly_mod, double t, size_t capacity,
+                  size_t threads);
+
+// Stops and joins the filler threads and frees the pool.
+void enc_pool_free(EncPool *pool);
+
+// Encrypts pt like `encrypt`. Safe to call from several threads.
+void encrypt_pooled(Ciphertext *out, EncPool *pool, double pt);
+
+#endif
@@ -14,9 +14,56 @@ KeyPair keygen(size_t n, double q, Poly poly_mod);
 Ciphertext encrypt(PublicKey pk, size_t n, double q, Poly poly_mod, double t,
                    double pt);
 
+// Secret-key encryption for a party that holds sk and encrypts its own data:
+// c1 = a uniform, c0 = -a*s + e + Delta*m. One product with the binary secret
+// and one sampled error, against two products and three errors for `encrypt`,
+// and less noise. The ciphertexts work with every other call.
+Ciphertext encrypt_sk(SecretKey sk, size_t n, double q, Poly poly_mod,
+                      double t, double pt);
+
 double decrypt(SecretKey sk, size_t n, double q, Poly poly_mod, double t,
                Ciphertext ct);
 
+// Batched forms: one call handles `count` independent values, in parallel
+// over OpenMP threads, with the keys and modulus passed once by pointer.
+// They produce what the single-value calls would for each element.
+void encrypt_many(const PublicKey *pk, size_t n, double q,
+                  const Poly *poly_mod, double t, const double *pts,
+                  size_t count, Ciphertext *out);
+
+void encrypt_sk_many(const SecretKey *sk, size_t n, double q,
+                     const Poly *poly_mod, double t, const double *pts,
+                     size_t count, Ciphertext *out);
+
+void decrypt_many(const SecretKey *sk, size_t n, double q,
+                  const Poly *poly_mod, double t, const Ciphertext *cts,
+                  size_t count, double *pts);
+
+double noise_budget(SecretKey sk, size_t n, double q, Poly poly_mod, double t,
+                    Ciphertext ct);
+
+double noise_fresh(size_t n, double q, double t);
+
+double noise_fresh_sk(double q, double t);
+
+double noise_mul_plain(double noise, double k, double q, double t);
+
+double noise_mul_cipher(double noise1, double noise2, size_t n, double q,
+                        double t, double p);
+
+// The bounds mul_cipher_no_relin gives one product, and relinearize /
+// relinearize_digits give a sum of such products with bound `noise`.
+double noise_mul_cipher_no_relin(double noise1, double noise2, size_t n,
+                                 double q, double t);
+
+double noise_relinearize(double noise, size_t n, double q, double p);
+
+double noise_relinearize_digits(double noise, size_t n, double q, double w);
+
+// Remaining budget in bits from ct.noise alone; NaN ("unknown") for
+// ciphertexts without an estimate, such as deserialized ones.
+double noise_budget_estimate(Ciphertext ct, double q, double t);
+
 Poly encode_plain_integer(double t, double pt);
 
 Ciphertext add_plain(Ciphertext ct, double q, double t, Poly poly_mod,
@@ -27,10 +74,101 @@ Ciphertext add_cipher(Ciphertext c1, Ciphertext c2, double q, Poly poly_mod);
 Ciphertext mul_plain(Ciphertext ct, double q, double t, Poly poly_mod,
                      double pt);
 
+// Pointer forms of add_cipher and mul_plain with the same results, for
+// callers that keep ciphertexts in scratch or compact storage. `out` may
+// alias an input. mul_plain_into needs ct reduced mod X^n + 1, as every
+// encryption and evaluation result is.
+void add_cipher_into(Ciphertext *out, const Ciphertext *c1,
+                     const Ciphertext *c2, double q, const Poly *poly_mod);
+
+void mul_plain_into(Ciphertext *out, const Ciphertext *ct, double q, double t,
+                    const Poly *poly_mod, double pt);
+
+// Plaintext operands that are whole polynomials mod t rather than integers
+// in the constant coefficient, as produced by slot packing.
+void encrypt_poly(Ciphertext *out, const PublicKey *pk, size_t n, double q,
+                  const Poly *poly_mod, double t, const Poly *m);
+
+void decrypt_poly(Poly *out, const SecretKey *sk, size_t n, double q,
+                  const Poly *poly_mod, double t, const Ciphertext *ct);
+
+void mul_plain_poly(Ciphertext *out, const Ciphertext *ct, const Poly *m,
+                    double q, double t, const Poly *poly_mod);
+
+void mul_plain_many(const Ciphertext *cts, size_t count, double q, double t,
+                    const Poly *poly_mod, const double *pts, Ciphertext *out);
+
 EvalKey evaluate_keygen(SecretKey sk, size_t n, double q, Poly poly_mod,
                         double p);
 
 Ciphertext mul_cipher(Ciphertext c1, Ciphertext c2, double q, double t,
                       double p, Poly poly_mod, EvalKey rlk);
 
+// mul_cipher in two steps, so a sum of products can be relinearized once:
+// mul_cipher_no_relin leaves the three-part tensor product, add_cipher3 adds
+// one into an accumulator and relinearize folds c2 back into a Ciphertext.
+// Relinearizing a single product gives exactly what mul_cipher does. They
+// work through pointers so a loop over products copies no ciphertexts.
+void mul_cipher_no_relin(Ciphertext3 *out, const Ciphertext *c1,
+                         const Ciphertext *c2, double q, double t,
+                         const Poly *poly_mod);
+
+void add_cipher3(Ciphertext3 *acc, const Ciphertext3 *ct, double q,
+                 const Poly *poly_mod);
+
+void relinearize(Ciphertext *out, const Ciphertext3 *ct, double q, double p,
+                 const Poly *poly_mod, const EvalKey *rlk);
+
+// Base-w digit decomposition relinearization, the alternative to the special
+// modulus p (see DigitEvalKey). The key holds ceil(log_w q) pairs; a larger w
+// means fewer pairs and fewer ring products per relinearization but more
+// noise (about w * sqrt(n * log_w q)). Every product stays below n * w * q,
+// so with q and w powers of two it is exact in 64-bit integer arithmetic,
+// where p = q^2 needs products near q^3. evaluate_keygen_digits returns -1
+// if w is not an integer >= 2 or the key cannot be allocated.
+size_t digit_count(double q, double w);
+
+int evaluate_keygen_digits(DigitEvalKey *rlk, SecretKey sk, size_t n,
+                           double q, Poly poly_mod, double w);
+
+void digit_eval_key_free(DigitEvalKey *rlk);
+
+void relinearize_digits(Ciphertext *out, const Ciphertext3 *ct, double q,
+                        const Poly *poly_mod, const DigitEvalKey *rlk);
+
+// Galois automorphism X -> X^g (g odd) of the plaintext, with a key from
+// evaluate_keygen_galois for the same g. With slot packing (src/packed.h)
+// g = 5^k mod 2n rotates the slots.
+int evaluate_keygen_galois(DigitEvalKey *gk, SecretKey sk, size_t n,
+                           double q, Poly poly_mod, size_t g, double w);
+
+void apply_galois(Ciphertext *out, const Ciphertext *ct, size_t g, double q,
+                  const Poly *poly_mod, const DigitEvalKey *gk);
+
+Ciphertext mul_cipher_digits(Ciphertext c1, Ciphertext c2, double q, double t,
+                             Poly poly_mod, const DigitEvalKey *rlk);
+
+double noise_mul_cipher_digits(double noise1, double noise2, size_t n,
+                               double q, double t, double w);
+
+Ciphertext mod_switch(Ciphertext ct, double q, double new_q, size_t n);
+
+double mod_switch_modulus(size_t n, double t);
+
+size_t ciphertext_wire_size(size_t n, double q);
+
+size_t polys_wire_size(size_t count, size_t n, double q);
+
+size_t serialize_polys(Poly *polys, size_t count, size_t n, double q,
+                       uint8_t *buf);
+
+size_t deserialize_polys(const uint8_t *buf, size_t count, size_t n, double q,
+                         Poly *polys);
+
+size_t serialize_ciphertexts(Ciphertext *cts, size_t count, size_t n,
+                             double q, uint8_t *buf);
+
+size_t deserialize_ciphertexts(const uint8_t *buf, size_t count, size_t n,
+                               double q, Ciphertext *cts);
+
 #endif
\ No newline at end of file
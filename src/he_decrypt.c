@@ -1,24 +1,115 @@
 #include "he.h"
+#include "arena.h"
+#include "instrument.h"
 #include "poly_utils.h"
 #include "ring_utils.h"
+#include <assert.h>
 #include <math.h>
 #include <stdlib.h>
 
+// Plaintext from the constant coefficient of c0 + c1*s, not yet reduced.
+static double decode_constant(double v, double q, double t) {
+  v = positive_fmod(v, q);
+  return round(positive_fmod(round(t * v / q), t));
+}
+
+// Integers are encoded in the constant coefficient, so decryption only needs
+// (c0 + c1*s)[0] = c0[0] + c1[0]*s[0] - sum_{j>0} c1[j]*s[n-j] mod q (X^n = -1),
+// an O(n) dot product instead of the full ring product. The terms are exact
+// integers, so the result matches reducing the full product.
+static double decrypt_constant(const Poly *sk, size_t n, double q, double t,
+                               const Ciphertext *ct) {
+  const double *c1 = ct->c1.coeffs;
+  const double *s = sk->coeffs;
+  // Terms past either operand's live range are zero: c1[j] needs
+  // j <= c1.max_degree and s[n - j] needs j >= n - s.max_degree.
+  size_t end = (size_t)ct->c1.max_degree + 1 < n ? ct->c1.max_degree + 1 : n;
+  size_t begin = n - ((size_t)sk->max_degree < n ? sk->max_degree : n - 1);
+  double v = c1[0] * s[0];
+  for (size_t j = begin; j < end; j++)
+    v -= c1[j] * s[n - j];
+  return decode_constant(v + ct->c0.coeffs[0], q, t);
+}
+
+// decrypt_constant with a ternary secret: adds and subtracts only.
+static double decrypt_constant_ternary(const TernaryPoly *sk, double q,
+                                       double t, const Ciphertext *ct) {
+  const double *c1 = ct->c1.coeffs;
+  size_t c1_live = (size_t)ct->c1.max_degree + 1;
+  double v = 0.0;
+  for (size_t k = 0; k < sk->count; k++) {
+    size_t j = (size_t)sk->index[k];
+    size_t i = j == 0 ? 0 : sk->n - j;
+    if (i >= c1_live)
+      continue;
+    double term = j == 0 ? c1[0] : -c1[i];
+    v += sk->sign[k] > 0 ? term : -term;
+  }
+  return decode_constant(v + ct->c0.coeffs[0], q, t);
+}
+
 double decrypt(SecretKey sk, size_t n, double q, Poly poly_mod, double t,
                 Ciphertext ct) {
-  Poly c1s = ring_mul_mod(ct.c1, sk, q, poly_mod);
-  Poly scaled_pt = ring_add_mod(c1s, ct.c0, q, poly_mod);
-
-  Poly dec = create_poly();
-
-  for (int64_t i = 0; i < MAX_POLY_DEGREE; i++) {
-    if (fabs(scaled_pt.coeffs[i]) > 1e-9) {
-      double v = round(scaled_pt.coeffs[i]);
-      double result = round(t * v / q);
-      dec.coeffs[i] = positive_fmod(result, t);
-      dec.degree = i > dec.degree ? i : dec.degree;
-    }
+  INSTR_BEGIN();
+  assert(poly_degree_of(&poly_mod) == (int64_t)n);
+  double pt = decrypt_constant(&sk, n, q, t, &ct);
+  INSTR_END(INSTR_DECRYPT, INSTR_COEFF_BYTES(2 * n + 1));
+  return pt;
+}
+
+void decrypt_many(const SecretKey *sk, size_t n, double q,
+                  const Poly *poly_mod, double t, const Ciphertext *cts,
+                  size_t count, double *pts) {
+  assert(poly_degree_of(poly_mod) == (int64_t)n);
+  // Built once for the batch; binary secrets skip about half the terms.
+  TernaryPoly *ts = (TernaryPoly *)malloc(sizeof(TernaryPoly));
+  int ternary = ts != NULL && ternary_from_poly(ts, sk, n) == 0;
+#pragma omp parallel for schedule(static)
+  for (size_t k = 0; k < count; k++) {
+    INSTR_BEGIN();
+    pts[k] = ternary ? decrypt_constant_ternary(ts, q, t, &cts[k])
+                     : decrypt_constant(sk, n, q, t, &cts[k]);
+    INSTR_END(INSTR_DECRYPT, INSTR_COEFF_BYTES(2 * n + 1));
+  }
+  free(ts);
+}
+
+void decrypt_poly(Poly *out, const SecretKey *sk, size_t n, double q,
+                  const Poly *poly_mod, double t, const Ciphertext *ct) {
+  INSTR_BEGIN();
+  ring_mul_small_into(out, &ct->c1, sk, q, poly_mod);
+  ring_add_mod_into(out, out, &ct->c0, q, poly_mod);
+  size_t live = (size_t)out->max_degree + 1 < n ? out->max_degree + 1 : n;
+  for (size_t i = 0; i < n; i++)
+    out->coeffs[i] = i < live ? decode_constant(out->coeffs[i], q, t) : 0.0;
+  poly_truncate(out, n);
+  INSTR_END(INSTR_DECRYPT, INSTR_COEFF_BYTES(4 * n));
+}
+
+// Exact remaining noise budget in bits: log2(q / 2t) minus log2 of the largest
+// distance from c0 + c1*s to a multiple of q/t. Decryption is correct while
+// the budget is positive; at zero or below the result can no longer be
+// trusted (and a budget computed past that point describes the wrong message).
+double noise_budget(SecretKey sk, size_t n, double q, Poly poly_mod, double t,
+                    Ciphertext ct) {
+  INSTR_BEGIN();
+  size_t mark = scratch_mark();
+  Poly *scaled_pt = scratch_polys(1);
+  ring_mul_small_into(scaled_pt, &ct.c1, &sk, q, &poly_mod);
+  ring_add_mod_into(scaled_pt, scaled_pt, &ct.c0, q, &poly_mod);
+
+  double delta = q / t;
+  double max_noise = 0.0;
+  size_t live = (size_t)scaled_pt->max_degree + 1;
+  for (size_t i = 0; i < n && i < live; i++) {
+    double v = round(scaled_pt->coeffs[i]);
+    double noise = fabs(v - delta * round(v / delta));
+    if (noise > max_noise)
+      max_noise = noise;
   }
-  dec.max_degree = scaled_pt.max_degree;
-  return round(get_coeff(dec, 0));
+  if (max_noise < 1.0)
+    max_noise = 1.0;
+  scratch_release(mark);
+  INSTR_END(INSTR_NOISE_BUDGET, INSTR_COEFF_BYTES(3 * n));
+  return log2(q / (2.0 * t)) - log2(max_noise);
 }
@@ -1,7 +1,12 @@
 #include "he.h"
+#include "arena.h"
+#include "instrument.h"
 #include "poly_random.h"
 #include "poly_utils.h"
 #include "ring_utils.h"
+#include <assert.h>
+#include <math.h>
+#include <string.h>
 
 Poly encode_plain_integer(double t, double pt) {
   Poly m = create_poly();
@@ -12,23 +17,177 @@ Poly encode_plain_integer(double t, double pt) {
   return m;
 }
 
+// Encrypts the plaintext polynomial m (coefficients in [0, t)).
+static void encrypt_into(Ciphertext *ct, const PublicKey *pk, size_t n,
+                         double q, const Poly *poly_mod, double t,
+                         const Poly *m) {
+  size_t mark = scratch_mark();
+  Poly *tmp = scratch_polys(4);
+  Poly *scaled_m = &tmp[0], *e1 = &tmp[1], *e2 = &tmp[2], *u = &tmp[3];
+  *scaled_m = poly_mul_scalar(*m, floor(q / t));
+  gen_normal_into(e1, n, 0.0, 1.0);
+  gen_normal_into(e2, n, 0.0, 1.0);
+  gen_binary_into(u, n);
+
+  ring_mul_small_into(&ct->c0, &pk->b, u, q, poly_mod);
+  ring_add_mod_into(&ct->c0, &ct->c0, e1, q, poly_mod);
+  ring_add_mod_into(&ct->c0, &ct->c0, scaled_m, q, poly_mod);
+
+  ring_mul_small_into(&ct->c1, &pk->a, u, q, poly_mod);
+  ring_add_mod_into(&ct->c1, &ct->c1, e2, q, poly_mod);
+  ct->noise = noise_fresh(n, q, t);
+  scratch_release(mark);
+}
+
 Ciphertext encrypt(PublicKey pk, size_t n, double q, Poly poly_mod, double t,
                    double pt) {
-  Poly m = encode_plain_integer(t, pt);
-  Poly scaled_m = poly_mul_scalar(m, floor(q / t));
-  Poly e1 = gen_normal_poly(n, 0.0, 1.0);
-  Poly e2 = gen_normal_poly(n, 0.0, 1.0);
-  Poly u = gen_binary_poly(n);
+  INSTR_BEGIN();
+  size_t mark = scratch_mark();
+  Poly *m = scratch_polys(1);
+  *m = encode_plain_integer(t, pt);
+  Ciphertext ct;
+  encrypt_into(&ct, &pk, n, q, &poly_mod, t, m);
+  scratch_release(mark);
+  INSTR_END(INSTR_ENCRYPT, INSTR_COEFF_BYTES(4 * n));
+  return ct;
+}
 
-  Poly bu = ring_mul_mod(pk.b, u, q, poly_mod);
-  Poly bu_e1 = ring_add_mod(bu, e1, q, poly_mod);
-  Poly c0 = ring_add_mod(bu_e1, scaled_m, q, poly_mod);
+// c1 = a, c0 = e - a*s + Delta*pt with a uniform integer below q, so that
+// c0 + c1*s = Delta*pt + e. a*s sums integers below q, exact while n*q stays
+// below 2^53 like the products with pk.
+static void encrypt_sk_into(Ciphertext *ct, const TernaryPoly *s, size_t n,
+                            double q, double t, double pt) {
+  size_t mark = scratch_mark();
+  Poly *e = scratch_polys(1);
+  gen_uniform_into(&ct->c1, n, q);
+  for (size_t i = 0; i < n; i++)
+    ct->c1.coeffs[i] = positive_fmod(floor(ct->c1.coeffs[i]), q);
+  poly_truncate(&ct->c1, n);
+  gen_normal_into(e, n, 0.0, 1.0);
 
-  Poly au = ring_mul_mod(pk.a, u, q, poly_mod);
-  Poly c1 = ring_add_mod(au, e2, q, poly_mod);
+  double *c0 = ct->c0.coeffs;
+  ring_mul_ternary_into(&ct->c0, &ct->c1, s, q);
+  for (size_t i = 0; i < n; i++)
+    c0[i] = positive_fmod(e->coeffs[i] - c0[i], q);
+  c0[0] = positive_fmod(c0[0] + floor(q / t) * positive_fmod(pt, t), q);
+  poly_truncate(&ct->c0, n);
+  ct->noise = noise_fresh_sk(q, t);
+  scratch_release(mark);
+}
 
+Ciphertext encrypt_sk(SecretKey sk, size_t n, double q, Poly poly_mod,
+                      double t, double pt) {
+  INSTR_BEGIN();
+  assert(poly_degree_of(&poly_mod) == (int64_t)n);
+  size_t mark = scratch_mark();
+  TernaryPoly *s = (TernaryPoly *)scratch_bytes(sizeof(TernaryPoly));
+  int rc = ternary_from_poly(s, &sk, n);
+  assert(rc == 0);
+  (void)rc;
   Ciphertext ct;
-  ct.c0 = c0;
-  ct.c1 = c1;
+  encrypt_sk_into(&ct, s, n, q, t, pt);
+  scratch_release(mark);
+  INSTR_END(INSTR_ENCRYPT, INSTR_COEFF_BYTES(3 * n));
   return ct;
-}
\ No newline at end of file
+}
+
+// The secret's terms are listed once for the whole batch.
+void encrypt_sk_many(const SecretKey *sk, size_t n, double q,
+                     const Poly *poly_mod, double t, const double *pts,
+                     size_t count, Ciphertext *out) {
+  assert(poly_degree_of(poly_mod) == (int64_t)n);
+  size_t mark = scratch_mark();
+  TernaryPoly *s = (TernaryPoly *)scratch_bytes(sizeof(TernaryPoly));
+  int rc = ternary_from_poly(s, sk, n);
+  assert(rc == 0);
+  (void)rc;
+
+#pragma omp parallel for schedule(static)
+  for (size_t k = 0; k < count; k++) {
+    INSTR_BEGIN();
+    encrypt_sk_into(&out[k], s, n, q, t, pts[k]);
+    INSTR_END(INSTR_ENCRYPT, INSTR_COEFF_BYTES(3 * n));
+  }
+  scratch_release(mark);
+}
+
+void encrypt_poly(Ciphertext *out, const PublicKey *pk, size_t n, double q,
+                  const Poly *poly_mod, double t, const Poly *m) {
+  INSTR_BEGIN();
+  assert(m->degree < (int)n);
+  encrypt_into(out, pk, n, q, poly_mod, t, m);
+  INSTR_END(INSTR_ENCRYPT, INSTR_COEFF_BYTES(5 * n));
+}
+
+// x * u for a binary u, as signed shift-and-adds over u's set bits, with the
+// products of b and a interleaved so the two accumulations run side by side.
+// Degrees below n land in lo, degrees n + i in hi[i] (X^n = -1 subtracts them
+// later). u's bits are visited from the top so every coefficient sums its
+// terms in the same order as poly_mul; pk.a has fractional coefficients, so
+// the order and the separate rounding of lo and hi matter for an exact match.
+static void mul_binary_pair(double *restrict lo0, double *restrict hi0,
+                            double *restrict lo1, double *restrict hi1,
+                            const double *b, const double *a, const Poly *u,
+                            size_t n) {
+  for (size_t j = n; j-- > 0;) {
+    if (u->coeffs[j] == 0.0)
+      continue;
+    size_t split = n - j;
+#pragma omp simd
+    for (size_t i = 0; i < split; i++) {
+      lo0[i + j] += b[i];
+      lo1[i + j] += a[i];
+    }
+#pragma omp simd
+    for (size_t i = split; i < n; i++) {
+      hi0[i - split] += b[i];
+      hi1[i - split] += a[i];
+    }
+  }
+}
+
+// Run on one thread, this draws the same randomness and gives the same
+// ciphertexts as calling encrypt once per plaintext. The key and modulus are
+// passed once, both products with u come from one pass over its bits, and
+// each coefficient is reduced mod q once at the end: past the rounding of the
+// products everything is an exact integer, so that matches reducing after
+// every step.
+void encrypt_many(const PublicKey *pk, size_t n, double q,
+                  const Poly *poly_mod, double t, const double *pts,
+                  size_t count, Ciphertext *out) {
+  assert(poly_degree_of(poly_mod) == (int64_t)n);
+  double delta = floor(q / t);
+  double noise = noise_fresh(n, q, t);
+
+#pragma omp parallel for schedule(static)
+  for (size_t k = 0; k < count; k++) {
+    INSTR_BEGIN();
+    size_t mark = scratch_mark();
+    Poly *tmp = scratch_polys(5);
+    Poly *e1 = &tmp[0], *e2 = &tmp[1], *u = &tmp[2];
+    double *hi0 = tmp[3].coeffs, *hi1 = tmp[4].coeffs;
+    const double *b = poly_dense(&pk->b, n, hi0 + n);
+    const double *a = poly_dense(&pk->a, n, hi1 + n);
+    gen_normal_into(e1, n, 0.0, 1.0);
+    gen_normal_into(e2, n, 0.0, 1.0);
+    gen_binary_into(u, n);
+
+    double *c0 = out[k].c0.coeffs;
+    double *c1 = out[k].c1.coeffs;
+    memset(c0, 0, n * sizeof(double));
+    memset(c1, 0, n * sizeof(double));
+    memset(hi0, 0, n * sizeof(double));
+    memset(hi1, 0, n * sizeof(double));
+    mul_binary_pair(c0, hi0, c1, hi1, b, a, u, n);
+    for (size_t i = 0; i < n; i++) {
+      c0[i] = positive_fmod(round(c0[i]) - round(hi0[i]) + e1->coeffs[i], q);
+      c1[i] = positive_fmod(round(c1[i]) - round(hi1[i]) + e2->coeffs[i], q);
+    }
+    c0[0] = positive_fmod(c0[0] + delta * positive_fmod(pts[k], t), q);
+    poly_truncate(&out[k].c0, n);
+    poly_truncate(&out[k].c1, n);
+    out[k].noise = noise;
+    scratch_release(mark);
+    INSTR_END(INSTR_ENCRYPT, INSTR_COEFF_BYTES(4 * n));
+  }
+}
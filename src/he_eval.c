@@ -1,116 +1,433 @@
 #include "he.h"
+#include "arena.h"
+#include "instrument.h"
 #include "poly_utils.h"
 #include "ring_utils.h"
 #include <assert.h>
+#include <float.h>
 #include <math.h>
+#include <string.h>
+
+// Static noise estimates. Each Ciphertext carries `noise`, a high-probability
+// bound on its largest noise coefficient: random terms are tracked as
+// NOISE_TAIL standard deviations. Terms that are independent within one
+// operation combine in quadrature, but the noise of two ciphertexts under the
+// same key does not: every pk encryption carries -e*u for the key's e, whose
+// mean e*(1,...,1)/2 is the same offset each time, and tensoring turns it into
+// the same t*e*k drift in every product. Bounds of separate ciphertexts
+// therefore add linearly, as they do in plan_params.
+#define NOISE_TAIL 6.0
+// Variance of a rounded N(0, 1) error coefficient from gen_normal_poly.
+#define ERROR_VARIANCE (1.0 + 1.0 / 12.0)
+
+// Pk encryption leaves e1 + e2*s - e*u; s and u are binary with about n/2
+// ones, so each coefficient sums about n + 1 error terms. Scaling m by
+// floor(q/t) instead of q/t adds up to m * (q mod t) / t < q mod t.
+double noise_fresh(size_t n, double q, double t) {
+  return NOISE_TAIL * sqrt(ERROR_VARIANCE * (double)(n + 1)) + fmod(q, t);
+}
+
+// Secret-key encryption leaves only its own e.
+double noise_fresh_sk(double q, double t) {
+  return NOISE_TAIL * sqrt(ERROR_VARIANCE) + fmod(q, t);
+}
+
+double noise_budget_estimate(Ciphertext ct, double q, double t) {
+  if (isnan(ct.noise))
+    return NAN;
+  double noise = ct.noise > 1.0 ? ct.noise : 1.0;
+  return log2(q / (2.0 * t)) - log2(noise);
+}
+
+// Rounding every coefficient of c0 and c1 leaves r0 + r1*s with r uniform in
+// [-1/2, 1/2], i.e. about n/2 + 1 terms of variance 1/12.
+static double noise_rounding(size_t n) {
+  return NOISE_TAIL * sqrt((1.0 + 0.5 * (double)n) / 12.0);
+}
+
+// Multiplying by k scales the noise, and reducing k*m mod t folds up to k
+// multiples of q mod t (floor(q/t)*t falls short of q by that much).
+double noise_mul_plain(double noise, double k, double q, double t) {
+  return k * (noise + fmod(q, t));
+}
+
+// Tensoring multiplies c(s) = Delta*m + e + q*k terms: the t*(e1*k2 + e2*k1)
+// products dominate. The negacyclic sum in c1*s gives k a spread of
+// sqrt(n/24) around a drift that ramps from -n/4 to n/4 across the
+// coefficients. The spread is independent of e and sums in quadrature, but
+// the drift depends only on s and lines up with the key's offset in e (see
+// above), so it is bounded by |e|_inf * |drift|_1 = noise * n^2/8. Then come
+// m1*e2 + m2*e1 (m < t), the rounding of the three tensor terms,
+// relinearization's c2*e / p, the floor(q/t) mismatch in Delta^2 (about
+// (q mod t) * t) and double rounding: sums of n products near q^2 (tensor,
+// then scaled by t/q) lose about n^1.5 * eps of their magnitude.
+// `relin_floating` is the same loss in relinearization.
+static double noise_tensor(double noise1, double noise2, size_t n, double q,
+                           double t, double relin, double relin_floating) {
+  double nd = (double)n;
+  double spread = nd * nd / 8.0 + sqrt(nd * (nd / 24.0 + 1.0 / 3.0)) + 1.0;
+  double rounding =
+      NOISE_TAIL * sqrt((1.0 + nd / 2.0 + nd * nd / 8.0) / 12.0);
+  double floating = nd * sqrt(nd) * q * t * (DBL_EPSILON / 2.0);
+  return t * spread * (noise1 + noise2) + hypot(rounding, relin) +
+         fmod(q, t) * t + floating + relin_floating;
+}
+
+// c2 * e / p from relinearization, e the error of the key.
+static double noise_relin(size_t n, double q, double p) {
+  return NOISE_TAIL * q * sqrt((double)n * ERROR_VARIANCE / 3.0) / p;
+}
+
+// Relinearization with p sums n products near q^2 * p, then divides by p.
+static double noise_relin_floating(size_t n, double q) {
+  double nd = (double)n;
+  return nd * sqrt(nd) * q * q * (DBL_EPSILON / 2.0);
+}
+
+double noise_mul_cipher(double noise1, double noise2, size_t n, double q,
+                        double t, double p) {
+  return noise_tensor(noise1, noise2, n, q, t, noise_relin(n, q, p),
+                      noise_relin_floating(n, q));
+}
+
+double noise_mul_cipher_no_relin(double noise1, double noise2, size_t n,
+                                 double q, double t) {
+  return noise_tensor(noise1, noise2, n, q, t, 0.0, 0.0);
+}
+
+double noise_relinearize(double noise, size_t n, double q, double p) {
+  return noise + noise_relin(n, q, p) + noise_relin_floating(n, q);
+}
+
+// sum_i d_i * e_i from digit relinearization: count * n products of a digit
+// (uniform below w, rms about w / sqrt(3)) and an error coefficient.
+static double noise_relin_digits(size_t n, double w, size_t count) {
+  return NOISE_TAIL * w * sqrt((double)(count * n) * ERROR_VARIANCE / 3.0);
+}
+
+double noise_relinearize_digits(double noise, size_t n, double q, double w) {
+  return noise + noise_relin_digits(n, w, digit_count(q, w));
+}
+
+double noise_mul_cipher_digits(double noise1, double noise2, size_t n,
+                               double q, double t, double w) {
+  // The digit products are exact (see relinearize_digits_into).
+  return noise_tensor(noise1, noise2, n, q, t,
+                      noise_relin_digits(n, w, digit_count(q, w)), 0.0);
+}
 
 Ciphertext add_plain(Ciphertext ct, double q, double t, Poly poly_mod,
                      double pt) {
-  Poly m = encode_plain_integer(t, pt);
-  Poly scaled_m = poly_mul_scalar(m, q / t);
-  Poly new_c0 = ring_add_mod(ct.c0, scaled_m, q, poly_mod);
+  INSTR_BEGIN();
+  size_t mark = scratch_mark();
+  Poly *scaled_m = scratch_polys(1);
+  *scaled_m = poly_mul_scalar(encode_plain_integer(t, pt), q / t);
 
   Ciphertext result;
-  result.c0 = new_c0;
+  ring_add_mod_into(&result.c0, &ct.c0, scaled_m, q, &poly_mod);
   result.c1 = ct.c1;
+  result.noise = ct.noise + 0.5;
+  scratch_release(mark);
+  INSTR_END(INSTR_ADD_PLAIN, INSTR_COEFF_BYTES(4 * poly_mod.degree));
   return result;
 }
 
-Ciphertext add_cipher(Ciphertext c1, Ciphertext c2, double q, Poly poly_mod) {
-  Poly new_c0 = ring_add_mod(c1.c0, c2.c0, q, poly_mod);
-  Poly new_c1 = ring_add_mod(c1.c1, c2.c1, q, poly_mod);
+void add_cipher_into(Ciphertext *out, const Ciphertext *c1,
+                     const Ciphertext *c2, double q, const Poly *poly_mod) {
+  INSTR_BEGIN();
+  double noise = c1->noise + c2->noise;
+  ring_add_mod_into(&out->c0, &c1->c0, &c2->c0, q, poly_mod);
+  ring_add_mod_into(&out->c1, &c1->c1, &c2->c1, q, poly_mod);
+  out->noise = noise;
+  INSTR_END(INSTR_ADD_CIPHER, INSTR_COEFF_BYTES(6 * poly_mod->degree));
+}
 
+Ciphertext add_cipher(Ciphertext c1, Ciphertext c2, double q, Poly poly_mod) {
   Ciphertext result;
-  result.c0 = new_c0;
-  result.c1 = new_c1;
+  add_cipher_into(&result, &c1, &c2, q, &poly_mod);
   return result;
 }
 
 Ciphertext mul_plain(Ciphertext ct, double q, double t, Poly poly_mod,
                      double pt) {
-  Poly m = encode_plain_integer(t, pt);
-  Poly new_c0 = ring_mul_mod(ct.c0, m, q, poly_mod);
-  Poly new_c1 = ring_mul_mod(ct.c1, m, q, poly_mod);
+  INSTR_BEGIN();
+  size_t mark = scratch_mark();
+  Poly *m = scratch_polys(1);
+  *m = encode_plain_integer(t, pt);
 
   Ciphertext result;
-  result.c0 = new_c0;
-  result.c1 = new_c1;
+  ring_mul_mod_into(&result.c0, &ct.c0, m, q, &poly_mod);
+  ring_mul_mod_into(&result.c1, &ct.c1, m, q, &poly_mod);
+  result.noise = noise_mul_plain(ct.noise, m->coeffs[0], q, t);
+  scratch_release(mark);
+  INSTR_END(INSTR_MUL_PLAIN, INSTR_COEFF_BYTES(4 * poly_mod.degree));
   return result;
 }
 
-Ciphertext mul_cipher(Ciphertext c1, Ciphertext c2, double q, double t,
-                      double p, Poly poly_mod, EvalKey rlk) {
-  Poly c0_prod = ring_mul_no_mod_q(c1.c0, c2.c0, poly_mod);
-  Poly c1_left = ring_mul_no_mod_q(c1.c0, c2.c1, poly_mod);
-  Poly c1_right = ring_mul_no_mod_q(c1.c1, c2.c0, poly_mod);
-  Poly c1_sum = ring_add_no_mod_q(c1_left, c1_right, poly_mod);
-  Poly c2_prod = ring_mul_no_mod_q(c1.c1, c2.c1, poly_mod);
-
-  Poly c0_res = create_poly();
-  Poly c1_res = create_poly();
-  Poly c2_res = create_poly();
-  for (int i = 0; i < MAX_POLY_DEGREE; i++) {
-    if (fabs(c0_prod.coeffs[i]) > 1e-9) {
-      c0_res.coeffs[i] = round(t * c0_prod.coeffs[i] / q);
-      if (i > c0_res.degree) {
-          c0_res.degree = i;
-      }
-    }
-    if (fabs(c1_sum.coeffs[i]) > 1e-9) {
-      c1_res.coeffs[i] = round(t * c1_sum.coeffs[i] / q);
-      if (i > c1_res.degree) {
-          c1_res.degree = i;
-      }
-    }
-    if (fabs(c2_prod.coeffs[i]) > 1e-9) {
-      c2_res.coeffs[i] = round(t * c2_prod.coeffs[i] / q);
-      if (i > c2_res.degree) {
-          c2_res.degree = i;
-      }
-    }
+// The n coefficients of out = m * x mod q; past x's live range that is zero.
+static void scale_live(Poly *out, const Poly *x, double m, double q,
+                       size_t n) {
+  size_t live = (size_t)x->max_degree + 1 < n ? (size_t)x->max_degree + 1 : n;
+  ring_scale_mod(out->coeffs, x->coeffs, m, q, live);
+  memset(out->coeffs + live, 0, (n - live) * sizeof(double));
+}
+
+// mul_plain as a scalar multiply of the n live coefficients mod q: the
+// plaintext is a constant polynomial and the product is exact, so this
+// matches mul_plain. `out` may be `ct` itself.
+static void mul_plain_scaled(Ciphertext *out, const Ciphertext *ct, double q,
+                             double t, size_t n, double pt) {
+  INSTR_BEGIN();
+  double m = positive_fmod(pt, t);
+  scale_live(&out->c0, &ct->c0, m, q, n);
+  scale_live(&out->c1, &ct->c1, m, q, n);
+  poly_truncate(&out->c0, n);
+  poly_truncate(&out->c1, n);
+  out->noise = noise_mul_plain(ct->noise, m, q, t);
+  INSTR_END(INSTR_MUL_PLAIN, INSTR_COEFF_BYTES(4 * n));
+}
+
+// mul_plain for a batch: ciphertext k is multiplied by pts[k]. `out` may be
+// `cts` itself.
+void mul_plain_many(const Ciphertext *cts, size_t count, double q, double t,
+                    const Poly *poly_mod, const double *pts, Ciphertext *out) {
+  size_t n = (size_t)poly_degree_of(poly_mod);
+#pragma omp parallel for schedule(static)
+  for (size_t k = 0; k < count; k++)
+    mul_plain_scaled(&out[k], &cts[k], q, t, n, pts[k]);
+}
+
+void mul_plain_into(Ciphertext *out, const Ciphertext *ct, double q, double t,
+                    const Poly *poly_mod, double pt) {
+  mul_plain_scaled(out, ct, q, t, (size_t)poly_degree_of(poly_mod), pt);
+}
+
+void mul_plain_poly(Ciphertext *out, const Ciphertext *ct, const Poly *m,
+                    double q, double t, const Poly *poly_mod) {
+  INSTR_BEGIN();
+  size_t n = (size_t)poly_degree_of(poly_mod);
+  size_t mark = scratch_mark();
+  // The centered representative of m mod t keeps the noise growth, about
+  // |m|_1 times, as small as possible.
+  Poly *centered = scratch_polys(1);
+  double norm = 0.0;
+  poly_copy_coeffs(centered->coeffs, m, n);
+  for (size_t i = 0; i < n; i++) {
+    double v = positive_fmod(centered->coeffs[i], t);
+    if (v > t / 2.0)
+      v -= t;
+    centered->coeffs[i] = v;
+    norm += fabs(v);
   }
-  c0_res.max_degree = c0_prod.max_degree;
-  c1_res.max_degree = c1_sum.max_degree;
-  c2_res.max_degree = c2_prod.max_degree;
-
-  Poly c0_modq = coeff_mod(c0_res, q);
-  Poly c1_modq = coeff_mod(c1_res, q);
-  Poly c2_modq = coeff_mod(c2_res, q);
-
-  // Relinearization
-  Poly prod_b = ring_mul_no_mod_q(rlk.b, c2_modq, poly_mod);
-  Poly prod_a = ring_mul_no_mod_q(rlk.a, c2_modq, poly_mod);
-
-  Poly div_b = create_poly();
-  Poly div_a = create_poly();
-  for (int i = 0; i < MAX_POLY_DEGREE; i++) {
-    double vb = prod_b.coeffs[i];
-    double va = prod_a.coeffs[i];
-    if (fabs(vb) > 1e-9) {
-      div_b.coeffs[i] = round(vb / p);
-      if (i > div_b.degree) {
-          div_b.degree = i;
-      }
+  poly_truncate(centered, n);
+  ring_mul_mod_into(&out->c0, &ct->c0, centered, q, poly_mod);
+  ring_mul_mod_into(&out->c1, &ct->c1, centered, q, poly_mod);
+  out->noise = noise_mul_plain(ct->noise, norm, q, t);
+  scratch_release(mark);
+  INSTR_END(INSTR_MUL_PLAIN, INSTR_COEFF_BYTES(5 * n));
+}
+
+// Replaces every non-zero coefficient c of p with round(mul * c / div) and
+// sets the degree to the highest one that was non-zero beforehand.
+static void round_scale_in_place(Poly *p, double mul, double div) {
+  int degree = 0;
+  for (int i = 0; i <= p->max_degree; i++) {
+    double c = p->coeffs[i];
+    if (fabs(c) > 1e-9) {
+      p->coeffs[i] = round(mul * c / div);
+      degree = i;
+    } else {
+      p->coeffs[i] = 0.0;
     }
-    if (fabs(va) > 1e-9) {
-      div_a.coeffs[i] = round(va / p);
-      if (i > div_a.degree) {
-          div_a.degree = i;
-      }
+  }
+  p->degree = degree;
+}
+
+// Tensor product of c1 and c2 scaled by t/q: a three-part ciphertext that
+// decrypts under (1, s, s^2).
+static void tensor_into(Ciphertext3 *out, const Ciphertext *c1,
+                        const Ciphertext *c2, double q, double t,
+                        const Poly *poly_mod) {
+  size_t mark = scratch_mark();
+  Poly *scratch = scratch_polys(1);
+  ring_mul_no_mod_q_into(&out->c0, &c1->c0, &c2->c0, poly_mod);
+  ring_mul_no_mod_q_into(&out->c1, &c1->c0, &c2->c1, poly_mod);
+  ring_mul_no_mod_q_into(scratch, &c1->c1, &c2->c0, poly_mod);
+  ring_add_no_mod_q_into(&out->c1, &out->c1, scratch, poly_mod);
+  ring_mul_no_mod_q_into(&out->c2, &c1->c1, &c2->c1, poly_mod);
+
+  round_scale_in_place(&out->c0, t, q);
+  round_scale_in_place(&out->c1, t, q);
+  round_scale_in_place(&out->c2, t, q);
+  coeff_mod_into(&out->c0, &out->c0, q);
+  coeff_mod_into(&out->c1, &out->c1, q);
+  coeff_mod_into(&out->c2, &out->c2, q);
+  scratch_release(mark);
+}
+
+// Relinearization: fold c2 * rlk / p into c0 and c1.
+static void relinearize_into(Ciphertext *out, const Ciphertext3 *ct, double q,
+                             double p, const Poly *poly_mod,
+                             const EvalKey *rlk) {
+  size_t mark = scratch_mark();
+  Poly *scratch = scratch_polys(1);
+  ring_mul_no_mod_q_into(scratch, &rlk->b, &ct->c2, poly_mod);
+  round_scale_in_place(scratch, 1.0, p);
+  coeff_mod_into(scratch, scratch, q);
+  ring_add_mod_into(&out->c0, &ct->c0, scratch, q, poly_mod);
+
+  ring_mul_no_mod_q_into(scratch, &rlk->a, &ct->c2, poly_mod);
+  round_scale_in_place(scratch, 1.0, p);
+  coeff_mod_into(scratch, scratch, q);
+  ring_add_mod_into(&out->c1, &ct->c1, scratch, q, poly_mod);
+  scratch_release(mark);
+}
+
+Ciphertext mul_cipher(Ciphertext c1, Ciphertext c2, double q, double t,
+                      double p, Poly poly_mod, EvalKey rlk) {
+  INSTR_BEGIN();
+  size_t mark = scratch_mark();
+  Ciphertext3 *prod = (Ciphertext3 *)scratch_bytes(sizeof(Ciphertext3));
+  tensor_into(prod, &c1, &c2, q, t, &poly_mod);
+
+  Ciphertext out;
+  relinearize_into(&out, prod, q, p, &poly_mod, &rlk);
+  out.noise =
+      noise_mul_cipher(c1.noise, c2.noise, poly_degree_of(&poly_mod), q, t, p);
+  scratch_release(mark);
+  INSTR_END(INSTR_MUL_CIPHER, INSTR_COEFF_BYTES(8 * poly_mod.degree));
+  return out;
+}
+
+void mul_cipher_no_relin(Ciphertext3 *out, const Ciphertext *c1,
+                         const Ciphertext *c2, double q, double t,
+                         const Poly *poly_mod) {
+  INSTR_BEGIN();
+  tensor_into(out, c1, c2, q, t, poly_mod);
+  out->noise = noise_mul_cipher_no_relin(c1->noise, c2->noise,
+                                         poly_degree_of(poly_mod), q, t);
+  INSTR_END(INSTR_MUL_CIPHER, INSTR_COEFF_BYTES(6 * poly_mod->degree));
+}
+
+void add_cipher3(Ciphertext3 *acc, const Ciphertext3 *ct, double q,
+                 const Poly *poly_mod) {
+  INSTR_BEGIN();
+  ring_add_mod_into(&acc->c0, &acc->c0, &ct->c0, q, poly_mod);
+  ring_add_mod_into(&acc->c1, &acc->c1, &ct->c1, q, poly_mod);
+  ring_add_mod_into(&acc->c2, &acc->c2, &ct->c2, q, poly_mod);
+  acc->noise += ct->noise;
+  INSTR_END(INSTR_ADD_CIPHER, INSTR_COEFF_BYTES(9 * poly_mod->degree));
+}
+
+void relinearize(Ciphertext *out, const Ciphertext3 *ct, double q, double p,
+                 const Poly *poly_mod, const EvalKey *rlk) {
+  INSTR_BEGIN();
+  relinearize_into(out, ct, q, p, poly_mod, rlk);
+  size_t n = (size_t)poly_degree_of(poly_mod);
+  out->noise = noise_relinearize(ct->noise, n, q, p);
+  INSTR_END(INSTR_RELINEARIZE, INSTR_COEFF_BYTES(6 * poly_mod->degree));
+}
+
+// Digit relinearization: c2 = sum_i d_i * w^i with every d_i below w, and
+// sum_i d_i * (b_i + a_i*s) = c2*s^2 - sum_i d_i*e_i, so adding sum_i d_i*b_i
+// to c0 and sum_i d_i*a_i to c1 folds c2 in. Every operand is an integer
+// below q, so the products are exact.
+static void relinearize_digits_into(Ciphertext *out, const Ciphertext3 *ct,
+                                    double q, const Poly *poly_mod,
+                                    const DigitEvalKey *rlk) {
+  size_t n = (size_t)poly_degree_of(poly_mod);
+  size_t mark = scratch_mark();
+  Poly *tmp = scratch_polys(3);
+  Poly *rest = &tmp[0], *digit = &tmp[1], *prod = &tmp[2];
+  poly_copy_coeffs(rest->coeffs, &ct->c2, n);
+  out->c0 = ct->c0;
+  out->c1 = ct->c1;
+  for (size_t i = 0; i < rlk->count; i++) {
+    for (size_t j = 0; j < n; j++) {
+      double c = rest->coeffs[j];
+      double high = floor(c / rlk->w);
+      digit->coeffs[j] = c - high * rlk->w;
+      rest->coeffs[j] = high;
     }
+    poly_truncate(digit, n);
+    ring_mul_mod_into(prod, digit, &rlk->b[i], q, poly_mod);
+    ring_add_mod_into(&out->c0, &out->c0, prod, q, poly_mod);
+    ring_mul_mod_into(prod, digit, &rlk->a[i], q, poly_mod);
+    ring_add_mod_into(&out->c1, &out->c1, prod, q, poly_mod);
   }
+  scratch_release(mark);
+}
 
-  div_b.max_degree = prod_b.max_degree;
-  div_a.max_degree = prod_a.max_degree;
+void relinearize_digits(Ciphertext *out, const Ciphertext3 *ct, double q,
+                        const Poly *poly_mod, const DigitEvalKey *rlk) {
+  INSTR_BEGIN();
+  relinearize_digits_into(out, ct, q, poly_mod, rlk);
+  size_t n = (size_t)poly_degree_of(poly_mod);
+  out->noise = noise_relinearize_digits(ct->noise, n, q, rlk->w);
+  INSTR_END(INSTR_RELINEARIZE,
+            INSTR_COEFF_BYTES(6 * poly_mod->degree * rlk->count));
+}
+
+void apply_galois(Ciphertext *out, const Ciphertext *ct, size_t g, double q,
+                  const Poly *poly_mod, const DigitEvalKey *gk) {
+  INSTR_BEGIN();
+  size_t n = (size_t)poly_degree_of(poly_mod);
+  size_t mark = scratch_mark();
+  // (c0(X^g), c1(X^g)) decrypts under s(X^g); key switching it back to s is
+  // relinearization with c1(X^g) in place of c2 and no c1.
+  Ciphertext3 *moved = (Ciphertext3 *)scratch_bytes(sizeof(Ciphertext3));
+  ring_automorphism_into(&moved->c0, &ct->c0, g, q, n);
+  poly_zero(&moved->c1);
+  ring_automorphism_into(&moved->c2, &ct->c1, g, q, n);
+  relinearize_digits_into(out, moved, q, poly_mod, gk);
+  out->noise = ct->noise + noise_relin_digits(n, gk->w, gk->count);
+  scratch_release(mark);
+  INSTR_END(INSTR_RELINEARIZE, INSTR_COEFF_BYTES(6 * n * gk->count));
+}
 
-  Poly c20_modq = coeff_mod(div_b, q);
-  Poly c21_modq = coeff_mod(div_a, q);
+Ciphertext mul_cipher_digits(Ciphertext c1, Ciphertext c2, double q, double t,
+                             Poly poly_mod, const DigitEvalKey *rlk) {
+  INSTR_BEGIN();
+  size_t mark = scratch_mark();
+  Ciphertext3 *prod = (Ciphertext3 *)scratch_bytes(sizeof(Ciphertext3));
+  tensor_into(prod, &c1, &c2, q, t, &poly_mod);
+
+  Ciphertext out;
+  relinearize_digits_into(&out, prod, q, &poly_mod, rlk);
+  out.noise = noise_mul_cipher_digits(c1.noise, c2.noise,
+                                      poly_degree_of(&poly_mod), q, t, rlk->w);
+  scratch_release(mark);
+  INSTR_END(INSTR_MUL_CIPHER,
+            INSTR_COEFF_BYTES((6 + 4 * rlk->count) * poly_mod.degree));
+  return out;
+}
 
-  Poly new_c0 = ring_add_mod(c0_modq, c20_modq, q, poly_mod);
-  Poly new_c1 = ring_add_mod(c1_modq, c21_modq, q, poly_mod);
+// Rescales ct from modulus q to new_q < q: each coefficient becomes
+// round(c * new_q / q) mod new_q. The noise keeps its size relative to the
+// modulus, plus at most (1 + |s|_1) / 2 from rounding, so the result decrypts
+// with `new_q` in place of `q`.
+Ciphertext mod_switch(Ciphertext ct, double q, double new_q, size_t n) {
+  INSTR_BEGIN();
+  assert(new_q > 0.0 && new_q <= q);
+  double scale = q / new_q;
 
   Ciphertext out;
-  out.c0 = new_c0;
-  out.c1 = new_c1;
+  poly_round_div_scalar_into(&out.c0, &ct.c0, scale);
+  coeff_mod_into(&out.c0, &out.c0, new_q);
+  poly_round_div_scalar_into(&out.c1, &ct.c1, scale);
+  coeff_mod_into(&out.c1, &out.c1, new_q);
+  out.noise = hypot(ct.noise / scale, noise_rounding(n));
+  INSTR_END(INSTR_MOD_SWITCH, INSTR_COEFF_BYTES(4 * n));
   return out;
-}
\ No newline at end of file
+}
+
+// Smallest power of two q' for which the rounding noise added by mod_switch
+// (at most (n + 1) / 2 for a binary secret) uses no more than 1/16 of the
+// q' / (2t) decryption budget.
+double mod_switch_modulus(size_t n, double t) {
+  double target = 16.0 * t * (double)(n + 1);
+  double q = 1.0;
+  while (q < target)
+    q *= 2.0;
+  return q;
+}
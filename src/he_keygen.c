@@ -1,15 +1,20 @@
 #include "he.h"
+#include "instrument.h"
 #include "poly_random.h"
 #include "poly_utils.h"
 #include "ring_utils.h"
+#include <math.h>
+#include <stdlib.h>
 
 KeyPair keygen(size_t n, double q, Poly poly_mod) {
+  INSTR_BEGIN();
   SecretKey s = gen_binary_poly(n);
   Poly a = gen_uniform_poly(n, q);
   Poly e = gen_normal_poly(n, 0.0, 1.0);
 
   Poly neg_a = poly_mul_scalar(a, -1);
-  Poly as = ring_mul_mod(neg_a, s, q, poly_mod);
+  Poly as;
+  ring_mul_small_into(&as, &neg_a, &s, q, &poly_mod);
   Poly neg_e = poly_mul_scalar(e, -1);
   Poly b = ring_add_mod(as, neg_e, q, poly_mod);
 
@@ -18,11 +23,13 @@ KeyPair keygen(size_t n, double q, Poly poly_mod) {
   keys.pk.b = b;
   keys.sk = s;
 
+  INSTR_END(INSTR_KEYGEN, INSTR_COEFF_BYTES(3 * n));
   return keys;
 }
 
 EvalKey evaluate_keygen(SecretKey sk, size_t n, double q, Poly poly_mod,
                         double p) {
+  INSTR_BEGIN();
   double new_modulus = q * p;
   Poly a = gen_uniform_poly(n, new_modulus);
   Poly e = gen_normal_poly(n, 0.0, 1.0);
@@ -31,7 +38,8 @@ EvalKey evaluate_keygen(SecretKey sk, size_t n, double q, Poly poly_mod,
   Poly secret_scaled = poly_mul_scalar(s2, p);
 
   Poly neg_a = poly_mul_scalar(a, -1.0);
-  Poly as = ring_mul_no_mod_q(neg_a, sk, poly_mod);
+  Poly as;
+  ring_mul_small_into(&as, &neg_a, &sk, 0.0, &poly_mod);
   Poly neg_e = poly_mul_scalar(e, -1.0);
   Poly as_nege = ring_add_no_mod_q(as, neg_e, poly_mod);
   Poly b_ring = ring_add_no_mod_q(as_nege, secret_scaled, poly_mod);
@@ -41,5 +49,82 @@ EvalKey evaluate_keygen(SecretKey sk, size_t n, double q, Poly poly_mod,
   EvalKey rlk;
   rlk.a = a;
   rlk.b = b;
+  INSTR_END(INSTR_EVALUATE_KEYGEN, INSTR_COEFF_BYTES(3 * n));
   return rlk;
-}
\ No newline at end of file
+}
+
+size_t digit_count(double q, double w) {
+  size_t count = 1;
+  for (double range = w; range < q; range *= w)
+    count++;
+  return count;
+}
+
+// Key switching key from `target` to sk in base w: for i < count,
+// b[i] = w^i * target - a[i]*sk - e[i] mod q. a is an integer, unlike in
+// evaluate_keygen, so every product the key takes part in stays exact.
+static int switching_keygen(DigitEvalKey *key, SecretKey sk,
+                            const Poly *target, size_t n, double q,
+                            Poly poly_mod, double w) {
+  key->a = key->b = NULL;
+  key->count = 0;
+  key->w = w;
+  // Digits are integers in [0, w), so w must be an integer of at least 2.
+  if (!(w >= 2.0) || w != floor(w))
+    return -1;
+  key->count = digit_count(q, w);
+  key->a = (Poly *)malloc(key->count * sizeof(Poly));
+  key->b = (Poly *)malloc(key->count * sizeof(Poly));
+  if (key->a == NULL || key->b == NULL) {
+    digit_eval_key_free(key);
+    return -1;
+  }
+
+  double scale = 1.0;
+  for (size_t i = 0; i < key->count; i++) {
+    Poly *a = &key->a[i], *b = &key->b[i];
+    *a = gen_uniform_poly(n, q);
+    for (size_t j = 0; j < n; j++)
+      a->coeffs[j] = floor(a->coeffs[j]);
+    coeff_mod_into(a, a, q);
+    Poly e = gen_normal_poly(n, 0.0, 1.0);
+
+    Poly neg_a = poly_mul_scalar(*a, -1.0);
+    ring_mul_small_into(b, &neg_a, &sk, q, &poly_mod);
+    Poly neg_e = poly_mul_scalar(e, -1.0);
+    ring_add_mod_into(b, b, &neg_e, q, &poly_mod);
+    Poly target_scaled = poly_mul_scalar(*target, scale);
+    coeff_mod_into(&target_scaled, &target_scaled, q);
+    ring_add_mod_into(b, b, &target_scaled, q, &poly_mod);
+    scale = positive_fmod(scale * w, q);
+  }
+  return 0;
+}
+
+int evaluate_keygen_digits(DigitEvalKey *rlk, SecretKey sk, size_t n,
+                           double q, Poly poly_mod, double w) {
+  INSTR_BEGIN();
+  Poly s2;
+  ring_mul_small_into(&s2, &sk, &sk, q, &poly_mod);
+  int rc = switching_keygen(rlk, sk, &s2, n, q, poly_mod, w);
+  INSTR_END(INSTR_EVALUATE_KEYGEN, INSTR_COEFF_BYTES(3 * n * rlk->count));
+  return rc;
+}
+
+int evaluate_keygen_galois(DigitEvalKey *gk, SecretKey sk, size_t n,
+                           double q, Poly poly_mod, size_t g, double w) {
+  INSTR_BEGIN();
+  Poly sg;
+  ring_automorphism_into(&sg, &sk, g, q, n);
+  int rc = switching_keygen(gk, sk, &sg, n, q, poly_mod, w);
+  INSTR_END(INSTR_EVALUATE_KEYGEN, INSTR_COEFF_BYTES(3 * n * gk->count));
+  return rc;
+}
+
+void digit_eval_key_free(DigitEvalKey *rlk) {
+  free(rlk->a);
+  free(rlk->b);
+  rlk->a = NULL;
+  rlk->b = NULL;
+  rlk->count = 0;
+}
@@ -0,0 +1,155 @@
+#define _POSIX_C_SOURCE 200809L
+#include "he_params.h"
+#include "he.h"
+#include "poly_utils.h"
+#include "ring_utils.h"
+#include <math.h>
+#include <time.h>
+
+// Largest log2 q for a given ring degree and security level, from the
+// HomomorphicEncryption.org standard tables (classical attacks, small
+// secret). Toy degrees below 1024 are only offered at security 0, where q is
+// limited by double precision instead.
+//
+// The standard's levels assume its error distribution (a discrete Gaussian
+// with sigma near 3.2) and a cryptographic random source. This code samples
+// rounded sigma = 1 errors and every other value with rand(), so the keys
+// do not reach these levels. The levels only bound q the way the standard
+// would; nothing here should be reported as a security guarantee.
+typedef struct {
+  size_t n;
+  int max_log_q[3]; // standard's bound for 128, 192 and 256 bits
+} SecurityRow;
+
+static const SecurityRow security_table[] = {
+    {16, {0, 0, 0}},       {32, {0, 0, 0}},      {64, {0, 0, 0}},
+    {128, {0, 0, 0}},      {256, {0, 0, 0}},     {512, {0, 0, 0}},
+    {1024, {27, 19, 14}},  {2048, {54, 37, 29}}, {4096, {109, 75, 58}},
+};
+#define NUM_SECURITY_ROWS (sizeof(security_table) / sizeof(security_table[0]))
+
+// Coefficients must survive the 64-bit wire format and int64 decoding.
+#define MAX_LOG_Q 62
+#define PLAN_BENCH_CANDIDATES 3
+#define PLAN_BENCH_REPS 8
+
+// The standard allows q above 2^62 from n = 4096 on, but the wire format
+// does not, so every level is capped at MAX_LOG_Q.
+static int max_log_q(const SecurityRow *row, int security) {
+  int bound;
+  switch (security) {
+  case 0:
+    return MAX_LOG_Q;
+  case 128:
+    bound = row->max_log_q[0];
+    break;
+  case 192:
+    bound = row->max_log_q[1];
+    break;
+  case 256:
+    bound = row->max_log_q[2];
+    break;
+  default:
+    return 0;
+  }
+  return bound < MAX_LOG_Q ? bound : MAX_LOG_Q;
+}
+
+// The bounds the evaluation functions attach to their results, composed the
+// way bench_matmul and circuit_run evaluate, so the budget planned here is
+// the one noise_budget_estimate reports at the end of the run: sums add their
+// terms' bounds linearly, as add_cipher does, and each level's products are
+// summed before a single relinearization.
+double plan_budget(CircuitSpec spec, HEParams params) {
+  double fan_in = spec.fan_in > 1 ? (double)spec.fan_in : 1.0;
+
+  double noise = noise_fresh(params.n, params.q, spec.t);
+  if (spec.plain_scale > 0.0)
+    noise = fan_in * noise_mul_plain(noise, spec.plain_scale, params.q, spec.t);
+  for (int level = 0; level < spec.depth; level++) {
+    noise = fan_in * noise_mul_cipher_no_relin(noise, noise, params.n,
+                                               params.q, spec.t);
+    if (params.w > 0.0)
+      noise = noise_relinearize_digits(noise, params.n, params.q, params.w);
+    else
+      noise = noise_relinearize(noise, params.n, params.q, params.p);
+  }
+  return log2(params.q / (2.0 * spec.t)) - log2(noise > 1.0 ? noise : 1.0);
+}
+
+Poly params_poly_mod(HEParams params) { return ring_modulus(params.n); }
+
+static double now_sec(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Wall time of one level of `spec` under `params`: a multiply (ct*ct, or
+// ct*pt at depth 0) followed by an add, averaged over a few repetitions.
+static double time_candidate(CircuitSpec spec, HEParams params) {
+  Poly poly_mod = params_poly_mod(params);
+  KeyPair keys = keygen(params.n, params.q, poly_mod);
+  EvalKey rlk;
+  if (spec.depth > 0)
+    rlk = evaluate_keygen(keys.sk, params.n, params.q, poly_mod, params.p);
+  Ciphertext a = encrypt(keys.pk, params.n, params.q, poly_mod, params.t, 1);
+  Ciphertext b = encrypt(keys.pk, params.n, params.q, poly_mod, params.t, 2);
+
+  double start = now_sec();
+  for (int r = 0; r < PLAN_BENCH_REPS; r++) {
+    Ciphertext prod;
+    if (spec.depth > 0)
+      prod = mul_cipher(a, b, params.q, params.t, params.p, poly_mod, rlk);
+    else
+      prod = mul_plain(a, params.q, params.t, poly_mod, 3);
+    b = add_cipher(prod, b, params.q, poly_mod);
+  }
+  return (now_sec() - start) / PLAN_BENCH_REPS;
+}
+
+int plan_params(CircuitSpec spec, HEParams *out) {
+  HEParams candidates[NUM_SECURITY_ROWS];
+  size_t found = 0;
+
+  // For each degree keep the smallest q that leaves the requested margin;
+  // larger q only costs wire size and headroom against double rounding.
+  for (size_t i = 0; i < NUM_SECURITY_ROWS; i++) {
+    const SecurityRow *row = &security_table[i];
+    if (spec.security > 0 && row->max_log_q[0] == 0)
+      continue;
+    if (2 * row->n > MAX_POLY_DEGREE)
+      break;
+    int min_log_q = (int)ceil(log2(2.0 * spec.t)) + 1;
+    for (int log_q = min_log_q; log_q <= max_log_q(row, spec.security);
+         log_q++) {
+      double q = ldexp(1.0, log_q);
+      HEParams params = {.n = row->n,
+                         .q = q,
+                         .t = spec.t,
+                         .p = spec.depth > 0 ? q * q : 0.0};
+      if (plan_budget(spec, params) >= spec.margin) {
+        candidates[found++] = params;
+        break;
+      }
+    }
+  }
+  if (found == 0)
+    return -1;
+
+  // Every kernel is O(n^2) in the degree, so the smallest n wins unless the
+  // caller asks for the candidates to be timed.
+  size_t best = 0;
+  if (spec.benchmark) {
+    double best_sec = INFINITY;
+    for (size_t i = 0; i < found && i < PLAN_BENCH_CANDIDATES; i++) {
+      double sec = time_candidate(spec, candidates[i]);
+      if (sec < best_sec) {
+        best_sec = sec;
+        best = i;
+      }
+    }
+  }
+  *out = candidates[best];
+  return 0;
+}
@@ -0,0 +1,32 @@
+#ifndef HE_PARAMS_H
+#define HE_PARAMS_H
+
+#include "types.h"
+
+// Shape of a circuit for plan_params. Every level multiplies two ciphertexts
+// of the previous level and sums `fan_in` such products before relinearizing
+// the sum; level 0 is a fresh encryption or, with `plain_scale`, a sum of
+// `fan_in` fresh encryptions scaled by plaintexts up to `plain_scale`.
+typedef struct {
+  double t;           // plaintext modulus
+  int depth;          // ciphertext-ciphertext multiplications per path
+  int fan_in;         // terms summed at each level (1 for none)
+  double plain_scale; // largest mul_plain operand mod t (0 for none)
+  int security;       // standard's q bounds: 0 for toy sizes, 128, 192 or 256
+  double margin;      // noise budget to keep in reserve, in bits
+  int benchmark;      // time the valid candidates instead of ranking by n
+} CircuitSpec;
+
+// Fills `out` with the fastest (n, q, t, p) that runs `spec` with at least
+// `spec.margin` bits of noise budget left. q is a power of two and p = q^2
+// when depth > 0 (0 otherwise). Returns 0 on success, -1 if no parameter set
+// in the table is both secure and large enough.
+int plan_params(CircuitSpec spec, HEParams *out);
+
+// Estimated noise budget in bits left at the end of `spec` under `params`.
+double plan_budget(CircuitSpec spec, HEParams params);
+
+// X^n + 1 for `params`, from ring_modulus.
+Poly params_poly_mod(HEParams params);
+
+#endif
@@ -0,0 +1,158 @@
+#include "he.h"
+#include "instrument.h"
+#include "poly_utils.h"
+#include <math.h>
+#include <string.h>
+
+// Ciphertexts travel as n reduced coefficients of c0 followed by n of c1,
+// each packed little-endian into ceil(log2(q)) bits, so a ciphertext that was
+// mod-switched to a small q' also shrinks on the wire. Every serialized
+// polynomial pair starts on a byte boundary.
+static unsigned wire_bits(double q) {
+  unsigned bits = 1;
+  while (bits < 64 && ldexp(1.0, bits) < q)
+    bits++;
+  return bits;
+}
+
+size_t ciphertext_wire_size(size_t n, double q) {
+  return (2 * n * wire_bits(q) + 7) / 8;
+}
+
+size_t polys_wire_size(size_t count, size_t n, double q) {
+  return (count * n * wire_bits(q) + 7) / 8;
+}
+
+typedef struct {
+  uint8_t *out;
+  unsigned used; // bits already filled in *out
+} BitWriter;
+
+typedef struct {
+  const uint8_t *in;
+  unsigned used; // bits already consumed from *in
+} BitReader;
+
+static void put_bits(BitWriter *w, uint64_t v, unsigned bits) {
+  while (bits > 0) {
+    unsigned take = 8 - w->used;
+    if (take > bits)
+      take = bits;
+    if (w->used == 0)
+      *w->out = 0;
+    *w->out |= (uint8_t)((v & ((1u << take) - 1)) << w->used);
+    v >>= take;
+    bits -= take;
+    w->used += take;
+    if (w->used == 8) {
+      w->out++;
+      w->used = 0;
+    }
+  }
+}
+
+static uint64_t get_bits(BitReader *r, unsigned bits) {
+  uint64_t v = 0;
+  unsigned shift = 0;
+  while (bits > 0) {
+    unsigned take = 8 - r->used;
+    if (take > bits)
+      take = bits;
+    uint64_t chunk = (*r->in >> r->used) & ((1u << take) - 1);
+    v |= chunk << shift;
+    shift += take;
+    bits -= take;
+    r->used += take;
+    if (r->used == 8) {
+      r->in++;
+      r->used = 0;
+    }
+  }
+  return v;
+}
+
+static void put_poly(BitWriter *w, Poly *p, size_t n, unsigned bits) {
+  for (size_t i = 0; i < n; i++) {
+    double v = (int64_t)i <= p->max_degree ? p->coeffs[i] : 0.0;
+    put_bits(w, (uint64_t)llround(v), bits);
+  }
+}
+
+static void get_poly(BitReader *r, Poly *p, size_t n, unsigned bits) {
+  *p = create_poly();
+  for (size_t i = 0; i < n; i++) {
+    uint64_t v = get_bits(r, bits);
+    p->coeffs[i] = (double)v;
+    if (v != 0) {
+      p->degree = i;
+      p->max_degree = i;
+    }
+  }
+}
+
+static size_t finish_write(BitWriter *w, uint8_t *buf) {
+  if (w->used > 0) {
+    w->out++;
+    w->used = 0;
+  }
+  return (size_t)(w->out - buf);
+}
+
+static size_t finish_read(BitReader *r, const uint8_t *buf) {
+  if (r->used > 0) {
+    r->in++;
+    r->used = 0;
+  }
+  return (size_t)(r->in - buf);
+}
+
+size_t serialize_polys(Poly *polys, size_t count, size_t n, double q,
+                       uint8_t *buf) {
+  unsigned bits = wire_bits(q);
+  BitWriter w = {buf, 0};
+  for (size_t i = 0; i < count; i++) {
+    put_poly(&w, &polys[i], n, bits);
+  }
+  return finish_write(&w, buf);
+}
+
+size_t deserialize_polys(const uint8_t *buf, size_t count, size_t n, double q,
+                         Poly *polys) {
+  unsigned bits = wire_bits(q);
+  BitReader r = {buf, 0};
+  for (size_t i = 0; i < count; i++) {
+    get_poly(&r, &polys[i], n, bits);
+  }
+  return finish_read(&r, buf);
+}
+
+size_t serialize_ciphertexts(Ciphertext *cts, size_t count, size_t n,
+                             double q, uint8_t *buf) {
+  INSTR_BEGIN();
+  unsigned bits = wire_bits(q);
+  BitWriter w = {buf, 0};
+  for (size_t i = 0; i < count; i++) {
+    put_poly(&w, &cts[i].c0, n, bits);
+    put_poly(&w, &cts[i].c1, n, bits);
+    finish_write(&w, buf);
+  }
+  INSTR_END(INSTR_SERIALIZE,
+            INSTR_COEFF_BYTES(2 * count * n) + (double)(w.out - buf));
+  return (size_t)(w.out - buf);
+}
+
+size_t deserialize_ciphertexts(const uint8_t *buf, size_t count, size_t n,
+                               double q, Ciphertext *cts) {
+  INSTR_BEGIN();
+  unsigned bits = wire_bits(q);
+  BitReader r = {buf, 0};
+  for (size_t i = 0; i < count; i++) {
+    get_poly(&r, &cts[i].c0, n, bits);
+    get_poly(&r, &cts[i].c1, n, bits);
+    cts[i].noise = NAN;
+    finish_read(&r, buf);
+  }
+  INSTR_END(INSTR_DESERIALIZE,
+            INSTR_COEFF_BYTES(2 * count * n) + (double)(r.in - buf));
+  return (size_t)(r.in - buf);
+}
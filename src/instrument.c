@@ -0,0 +1,165 @@
+#define _POSIX_C_SOURCE 200809L
+#include "instrument.h"
+
+#ifdef HE_INSTRUMENT
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static const char *counter_names[NUM_INSTR_COUNTERS] = {
+    "poly_mul",     "poly_divmod",     "coeff_mod",   "ring_scale",
+    "ring_axpy",    "gen_binary",      "gen_uniform", "gen_normal",
+    "keygen",       "evaluate_keygen", "encrypt",     "decrypt",
+    "noise_budget", "add_plain",       "add_cipher",  "mul_plain",
+    "mul_cipher",   "mod_switch",      "relinearize", "gemm_plain",
+    "serialize",    "deserialize",
+};
+
+typedef struct {
+  uint64_t calls;
+  double seconds;
+  double bytes;
+} InstrStat;
+
+// One per thread, written without locks and only read at exit.
+typedef struct InstrBlock {
+  InstrStat stats[NUM_INSTR_COUNTERS];
+  int tid;
+  struct InstrBlock *next;
+} InstrBlock;
+
+typedef struct {
+  char name[48];
+  double start;
+  double end;
+  int tid;
+} TraceEvent;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+static InstrBlock *blocks = NULL;
+static int num_threads = 0;
+static __thread InstrBlock *thread_block = NULL;
+
+static TraceEvent *events = NULL;
+static size_t num_events = 0;
+static size_t events_capacity = 0;
+
+double instr_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// HE_TRACE may contain %p, which is replaced by the process id so forked
+// workers do not overwrite each other's traces.
+static void trace_path(char *path, size_t len, const char *pattern) {
+  size_t out = 0;
+  for (const char *c = pattern; *c != '\0' && out + 1 < len; c++) {
+    if (c[0] == '%' && c[1] == 'p') {
+      out += snprintf(path + out, len - out, "%d", (int)getpid());
+      c++;
+    } else {
+      path[out++] = *c;
+    }
+  }
+  path[out < len ? out : len - 1] = '\0';
+}
+
+static void write_trace(void) {
+  const char *pattern = getenv("HE_TRACE");
+  if (pattern == NULL || pattern[0] == '\0' || num_events == 0)
+    return;
+  char path[4096];
+  trace_path(path, sizeof(path), pattern);
+  FILE *f = fopen(path, "w");
+  if (f == NULL) {
+    fprintf(stderr, "Failed to write trace %s\n", path);
+    return;
+  }
+  fprintf(f, "{\"traceEvents\": [\n");
+  for (size_t i = 0; i < num_events; i++) {
+    TraceEvent *e = &events[i];
+    fprintf(f,
+            "%s  {\"name\": \"%s\", \"ph\": \"X\", \"ts\": %.3f, "
+            "\"dur\": %.3f, \"pid\": %d, \"tid\": %d}",
+            i ? ",\n" : "", e->name, e->start * 1e6,
+            (e->end - e->start) * 1e6, (int)getpid(), e->tid);
+  }
+  fprintf(f, "\n]}\n");
+  fclose(f);
+  fprintf(stderr, "Wrote trace %s (%zu spans)\n", path, num_events);
+}
+
+static void report(void) {
+  InstrStat total[NUM_INSTR_COUNTERS];
+  memset(total, 0, sizeof(total));
+
+  pthread_mutex_lock(&lock);
+  for (InstrBlock *b = blocks; b != NULL; b = b->next) {
+    for (int c = 0; c < NUM_INSTR_COUNTERS; c++) {
+      total[c].calls += b->stats[c].calls;
+      total[c].seconds += b->stats[c].seconds;
+      total[c].bytes += b->stats[c].bytes;
+    }
+  }
+
+  fprintf(stderr, "\n=== Instrumentation (pid %d, %d threads) ===\n",
+          (int)getpid(), num_threads);
+  fprintf(stderr, "%-16s %12s %12s %12s %12s\n", "function", "calls",
+          "total ms", "avg us", "MB");
+  for (int c = 0; c < NUM_INSTR_COUNTERS; c++) {
+    if (total[c].calls == 0)
+      continue;
+    fprintf(stderr, "%-16s %12llu %12.2f %12.2f %12.2f\n", counter_names[c],
+            (unsigned long long)total[c].calls, total[c].seconds * 1e3,
+            total[c].seconds * 1e6 / total[c].calls, total[c].bytes / 1e6);
+  }
+  write_trace();
+  pthread_mutex_unlock(&lock);
+}
+
+static void init(void) { atexit(report); }
+
+static InstrBlock *get_block(void) {
+  if (thread_block == NULL) {
+    pthread_once(&once, init);
+    InstrBlock *b = (InstrBlock *)calloc(1, sizeof(InstrBlock));
+    pthread_mutex_lock(&lock);
+    b->tid = num_threads++;
+    b->next = blocks;
+    blocks = b;
+    pthread_mutex_unlock(&lock);
+    thread_block = b;
+  }
+  return thread_block;
+}
+
+void instr_record(InstrCounter counter, double start, double bytes) {
+  InstrStat *s = &get_block()->stats[counter];
+  s->calls++;
+  s->seconds += instr_now() - start;
+  s->bytes += bytes;
+}
+
+void instr_span(const char *name, double start, double end) {
+  int tid = get_block()->tid;
+  pthread_mutex_lock(&lock);
+  if (num_events == events_capacity) {
+    events_capacity = events_capacity ? 2 * events_capacity : 1024;
+    events = (TraceEvent *)realloc(events, events_capacity * sizeof(TraceEvent));
+  }
+  TraceEvent *e = &events[num_events++];
+  snprintf(e->name, sizeof(e->name), "%s", name);
+  e->start = start;
+  e->end = end;
+  e->tid = tid;
+  pthread_mutex_unlock(&lock);
+}
+
+#endif
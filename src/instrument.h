@@ -0,0 +1,65 @@
+#ifndef INSTRUMENT_H
+#define INSTRUMENT_H
+
+// Hot-path counters and tracing, compiled in with -DHE_INSTRUMENT (make
+// INSTRUMENT=1). Every instrumented function counts its calls, inclusive wall
+// time and the coefficient bytes it reads and writes into a per-thread block;
+// the blocks are merged and printed to stderr at exit. With HE_TRACE=<file>
+// set, spans recorded with INSTR_SPAN_* (benchmark phases and tiles) are also
+// written there as Chrome trace JSON (chrome://tracing, Perfetto).
+//
+// Without HE_INSTRUMENT every macro expands to nothing.
+
+typedef enum {
+  INSTR_POLY_MUL,
+  INSTR_POLY_DIVMOD,
+  INSTR_COEFF_MOD,
+  INSTR_RING_SCALE,
+  INSTR_RING_AXPY,
+  INSTR_GEN_BINARY,
+  INSTR_GEN_UNIFORM,
+  INSTR_GEN_NORMAL,
+  INSTR_KEYGEN,
+  INSTR_EVALUATE_KEYGEN,
+  INSTR_ENCRYPT,
+  INSTR_DECRYPT,
+  INSTR_NOISE_BUDGET,
+  INSTR_ADD_PLAIN,
+  INSTR_ADD_CIPHER,
+  INSTR_MUL_PLAIN,
+  INSTR_MUL_CIPHER,
+  INSTR_MOD_SWITCH,
+  INSTR_RELINEARIZE,
+  INSTR_GEMM_PLAIN,
+  INSTR_SERIALIZE,
+  INSTR_DESERIALIZE,
+  NUM_INSTR_COUNTERS
+} InstrCounter;
+
+#ifdef HE_INSTRUMENT
+
+double instr_now(void);
+
+void instr_record(InstrCounter counter, double start, double bytes);
+
+// `name` is copied, so it may live on the caller's stack.
+void instr_span(const char *name, double start, double end);
+
+#define INSTR_BEGIN() double instr_start_ = instr_now()
+#define INSTR_END(counter, bytes) instr_record((counter), instr_start_, (bytes))
+#define INSTR_SPAN_BEGIN(var) double var = instr_now()
+#define INSTR_SPAN_END(var, name) instr_span((name), (var), instr_now())
+
+#else
+
+#define INSTR_BEGIN() ((void)0)
+#define INSTR_END(counter, bytes) ((void)0)
+#define INSTR_SPAN_BEGIN(var) ((void)0)
+#define INSTR_SPAN_END(var, name) ((void)0)
+
+#endif
+
+// Bytes held by `count` coefficients.
+#define INSTR_COEFF_BYTES(count) ((double)(count) * sizeof(double))
+
+#endif
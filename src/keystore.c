@@ -0,0 +1,208 @@
+#define _POSIX_C_SOURCE 200809L
+#include "keystore.h"
+#include "poly_utils.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define KEYSTORE_MAGIC "HEKEYS\0\0"
+#define KEYSTORE_VERSION 1
+
+// File layout: header, then n doubles each for sk, pk.b, pk.a and, when
+// has_rlk is set, rlk.a and rlk.b.
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t has_rlk;
+  uint64_t n;
+  double q;
+  double p;
+  uint64_t checksum;
+} KeystoreHeader;
+
+const char *keystore_dir(void) {
+  const char *dir = getenv("HE_KEYSTORE");
+  if (dir == NULL)
+    return "keys";
+  if (dir[0] == '\0')
+    return NULL;
+  return dir;
+}
+
+static void entry_path(char *path, size_t len, const char *dir,
+                       HEParams params) {
+  snprintf(path, len, "%s/he_n%zu_q%.0f_p%.0f.keys", dir, params.n, params.q,
+           params.p);
+}
+
+// FNV-1a over the coefficient section.
+static uint64_t checksum(const double *coeffs, size_t count) {
+  const uint8_t *bytes = (const uint8_t *)coeffs;
+  uint64_t h = 1469598103934665603ull;
+  for (size_t i = 0; i < count * sizeof(double); i++) {
+    h ^= bytes[i];
+    h *= 1099511628211ull;
+  }
+  return h;
+}
+
+// Checks every coefficient is finite and in [0, bound]; binary polys must
+// also be exactly 0 or 1.
+static int coeffs_valid(const double *coeffs, size_t n, double bound,
+                        int binary) {
+  for (size_t i = 0; i < n; i++) {
+    double v = coeffs[i];
+    if (!isfinite(v) || v < 0.0 || v > bound)
+      return 0;
+    if (binary && v != 0.0 && v != 1.0)
+      return 0;
+  }
+  return 1;
+}
+
+static Poly poly_from_coeffs(const double *coeffs, size_t n) {
+  Poly p = create_poly();
+  for (size_t i = 0; i < n; i++) {
+    p.coeffs[i] = coeffs[i];
+    if (coeffs[i] != 0.0) {
+      p.degree = i;
+      p.max_degree = i;
+    }
+  }
+  return p;
+}
+
+int keystore_load(const char *dir, HEParams params, KeyPair *keys,
+                  EvalKey *rlk) {
+  if (dir == NULL || params.n == 0 || params.n > MAX_POLY_DEGREE)
+    return -1;
+
+  char path[4096];
+  entry_path(path, sizeof(path), dir, params);
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return -1;
+
+  struct stat st;
+  if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(KeystoreHeader)) {
+    close(fd);
+    return -1;
+  }
+  size_t size = (size_t)st.st_size;
+  void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return -1;
+
+  const KeystoreHeader *hdr = (const KeystoreHeader *)map;
+  const double *coeffs = (const double *)((const uint8_t *)map + sizeof(*hdr));
+  size_t n = params.n;
+  size_t polys = hdr->has_rlk ? 5 : 3;
+  double qp = params.q * params.p;
+
+  int ok = memcmp(hdr->magic, KEYSTORE_MAGIC, sizeof(hdr->magic)) == 0 &&
+           hdr->version == KEYSTORE_VERSION && hdr->n == n &&
+           hdr->q == params.q && hdr->p == params.p &&
+           size == sizeof(*hdr) + polys * n * sizeof(double) &&
+           (rlk == NULL || hdr->has_rlk);
+  ok = ok && checksum(coeffs, polys * n) == hdr->checksum;
+  ok = ok && coeffs_valid(coeffs, n, 1.0, 1) &&
+       coeffs_valid(coeffs + n, n, params.q, 0) &&
+       coeffs_valid(coeffs + 2 * n, n, params.q, 0);
+  if (ok && rlk != NULL) {
+    ok = coeffs_valid(coeffs + 3 * n, n, qp, 0) &&
+         coeffs_valid(coeffs + 4 * n, n, qp, 0);
+  }
+
+  if (ok) {
+    keys->sk = poly_from_coeffs(coeffs, n);
+    keys->pk.b = poly_from_coeffs(coeffs + n, n);
+    keys->pk.a = poly_from_coeffs(coeffs + 2 * n, n);
+    if (rlk != NULL) {
+      rlk->a = poly_from_coeffs(coeffs + 3 * n, n);
+      rlk->b = poly_from_coeffs(coeffs + 4 * n, n);
+    }
+  }
+  munmap(map, size);
+  return ok ? 0 : -1;
+}
+
+int keystore_save(const char *dir, HEParams params, KeyPair *keys,
+                  EvalKey *rlk) {
+  if (dir == NULL)
+    return -1;
+  // Entries hold secret keys: owner-only whatever the umask.
+  if (mkdir(dir, 0700) < 0 && errno != EEXIST)
+    return -1;
+
+  size_t n = params.n;
+  size_t polys = rlk ? 5 : 3;
+  double *coeffs = (double *)malloc(polys * n * sizeof(double));
+  if (coeffs == NULL)
+    return -1;
+  poly_copy_coeffs(coeffs, &keys->sk, n);
+  poly_copy_coeffs(coeffs + n, &keys->pk.b, n);
+  poly_copy_coeffs(coeffs + 2 * n, &keys->pk.a, n);
+  if (rlk) {
+    poly_copy_coeffs(coeffs + 3 * n, &rlk->a, n);
+    poly_copy_coeffs(coeffs + 4 * n, &rlk->b, n);
+  }
+
+  KeystoreHeader hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, KEYSTORE_MAGIC, sizeof(hdr.magic));
+  hdr.version = KEYSTORE_VERSION;
+  hdr.has_rlk = rlk ? 1 : 0;
+  hdr.n = n;
+  hdr.q = params.q;
+  hdr.p = params.p;
+  hdr.checksum = checksum(coeffs, polys * n);
+
+  // Write to a private temporary and rename, so concurrent readers only ever
+  // see complete entries.
+  char path[4096];
+  char tmp[4096 + 32];
+  entry_path(path, sizeof(path), dir, params);
+  snprintf(tmp, sizeof(tmp), "%s.%d.tmp", path, (int)getpid());
+
+  // O_EXCL so a file or symlink planted at `tmp` is never written through.
+  int rc = -1;
+  int fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL, 0600);
+  FILE *f = fd >= 0 ? fdopen(fd, "wb") : NULL;
+  if (f == NULL && fd >= 0) {
+    close(fd);
+    unlink(tmp);
+  }
+  if (f) {
+    int written = fwrite(&hdr, sizeof(hdr), 1, f) == 1 &&
+                  fwrite(coeffs, sizeof(double), polys * n, f) == polys * n;
+    if (fclose(f) == 0 && written && rename(tmp, path) == 0)
+      rc = 0;
+    else
+      unlink(tmp);
+  }
+  free(coeffs);
+  return rc;
+}
+
+int keystore_get(const char *dir, HEParams params, Poly poly_mod,
+                 KeyPair *keys, EvalKey *rlk) {
+  if (keystore_load(dir, params, keys, rlk) == 0)
+    return 0;
+
+  // An entry saved without a relinearization key still has a usable pair.
+  if (rlk == NULL || keystore_load(dir, params, keys, NULL) < 0)
+    *keys = keygen(params.n, params.q, poly_mod);
+  if (rlk != NULL)
+    *rlk = evaluate_keygen(keys->sk, params.n, params.q, poly_mod, params.p);
+
+  if (dir != NULL && keystore_save(dir, params, keys, rlk) < 0)
+    fprintf(stderr, "Warning: could not write keys to keystore %s\n", dir);
+  return 1;
+}
@@ -0,0 +1,30 @@
+#ifndef KEYSTORE_H
+#define KEYSTORE_H
+
+#include "he.h"
+#include "types.h"
+
+// On-disk cache of generated keys, one file per (n, q, p) in a keystore
+// directory. Keys do not depend on t, so every t shares the same entry.
+
+// Directory from $HE_KEYSTORE, or "keys" when unset. Returns NULL when the
+// variable is set to the empty string, which disables caching.
+const char *keystore_dir(void);
+
+// Maps the entry for `params` and copies it into `keys` (and `rlk` when not
+// NULL). Returns 0 on success, -1 if the entry is missing, truncated, fails
+// its checksum or does not match `params`.
+int keystore_load(const char *dir, HEParams params, KeyPair *keys,
+                  EvalKey *rlk);
+
+// Writes `keys` (and `rlk` when not NULL) for `params`. Returns 0 on success.
+int keystore_save(const char *dir, HEParams params, KeyPair *keys,
+                  EvalKey *rlk);
+
+// Loads keys for `params`, generating and saving whatever is missing. Pass
+// NULL for `rlk` when no relinearization key is needed. Returns 0 if
+// everything came from the keystore, 1 if any key had to be generated.
+int keystore_get(const char *dir, HEParams params, Poly poly_mod,
+                 KeyPair *keys, EvalKey *rlk);
+
+#endif
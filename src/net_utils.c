@@ -0,0 +1,131 @@
+#define _POSIX_C_SOURCE 200809L
+#include "net_utils.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static int is_tcp(const char *addr) { return strncmp(addr, "tcp:", 4) == 0; }
+
+static void tcp_addr(const char *addr, struct sockaddr_in *sa) {
+  memset(sa, 0, sizeof(*sa));
+  sa->sin_family = AF_INET;
+  sa->sin_port = htons((unsigned short)atoi(addr + 4));
+  sa->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+}
+
+static int unix_addr(const char *addr, struct sockaddr_un *sa) {
+  memset(sa, 0, sizeof(*sa));
+  sa->sun_family = AF_UNIX;
+  if (strlen(addr) >= sizeof(sa->sun_path))
+    return -1;
+  strcpy(sa->sun_path, addr);
+  return 0;
+}
+
+int net_listen(const char *addr) {
+  int fd;
+  if (is_tcp(addr)) {
+    struct sockaddr_in sa;
+    tcp_addr(addr, &sa);
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+      return -1;
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+      close(fd);
+      return -1;
+    }
+  } else {
+    struct sockaddr_un sa;
+    if (unix_addr(addr, &sa) < 0)
+      return -1;
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+      return -1;
+    unlink(addr);
+    if (bind(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+      close(fd);
+      return -1;
+    }
+  }
+  if (listen(fd, 64) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+int net_accept(int listen_fd) {
+  int fd;
+  do {
+    fd = accept(listen_fd, NULL, NULL);
+  } while (fd < 0 && errno == EINTR);
+  return fd;
+}
+
+int net_connect(const char *addr) {
+  int fd;
+  int rc;
+  if (is_tcp(addr)) {
+    struct sockaddr_in sa;
+    tcp_addr(addr, &sa);
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+      return -1;
+    rc = connect(fd, (struct sockaddr *)&sa, sizeof(sa));
+  } else {
+    struct sockaddr_un sa;
+    if (unix_addr(addr, &sa) < 0)
+      return -1;
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+      return -1;
+    rc = connect(fd, (struct sockaddr *)&sa, sizeof(sa));
+  }
+  if (rc < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+int net_send_all(int fd, const void *buf, size_t len) {
+  const char *p = (const char *)buf;
+  while (len > 0) {
+    // A peer that hung up (say, after rejecting a request) fails the send
+    // instead of raising SIGPIPE.
+    ssize_t w = send(fd, p, len, MSG_NOSIGNAL);
+    if (w < 0 && errno == EINTR)
+      continue;
+    if (w <= 0)
+      return -1;
+    p += w;
+    len -= (size_t)w;
+  }
+  return 0;
+}
+
+int net_recv_all(int fd, void *buf, size_t len) {
+  char *p = (char *)buf;
+  while (len > 0) {
+    ssize_t r = read(fd, p, len);
+    if (r < 0 && errno == EINTR)
+      continue;
+    if (r <= 0)
+      return -1;
+    p += r;
+    len -= (size_t)r;
+  }
+  return 0;
+}
+
+void net_close(int fd) {
+  if (fd >= 0)
+    close(fd);
+}
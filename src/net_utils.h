@@ -0,0 +1,21 @@
+#ifndef NET_UTILS_H
+#define NET_UTILS_H
+
+#include <stddef.h>
+
+// Addresses are either "tcp:<port>" (bound to 127.0.0.1) or a filesystem path
+// for a Unix domain socket. All functions return -1 on failure.
+
+int net_listen(const char *addr);
+
+int net_accept(int listen_fd);
+
+int net_connect(const char *addr);
+
+int net_send_all(int fd, const void *buf, size_t len);
+
+int net_recv_all(int fd, void *buf, size_t len);
+
+void net_close(int fd);
+
+#endif
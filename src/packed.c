@@ -0,0 +1,258 @@
+#include "packed.h"
+#include "arena.h"
+#include "he.h"
+#include "poly_utils.h"
+#include "ring_utils.h"
+#include <assert.h>
+#include <stdlib.h>
+
+static int64_t mul_mod(int64_t a, int64_t b, int64_t m) { return a * b % m; }
+
+static int64_t pow_mod(int64_t base, uint64_t exp, int64_t m) {
+  int64_t result = 1 % m;
+  base %= m;
+  while (exp > 0) {
+    if (exp & 1)
+      result = mul_mod(result, base, m);
+    base = mul_mod(base, base, m);
+    exp >>= 1;
+  }
+  return result;
+}
+
+static int is_prime(int64_t x) {
+  if (x < 2)
+    return 0;
+  for (int64_t d = 2; d * d <= x; d++)
+    if (x % d == 0)
+      return 0;
+  return 1;
+}
+
+int64_t slot_modulus(size_t n, int64_t min_t) {
+  int64_t step = 2 * (int64_t)n;
+  int64_t t = min_t <= 1 ? 1 : min_t + (step - (min_t - 1) % step) % step;
+  while (!is_prime(t))
+    t += step;
+  return t;
+}
+
+int slot_encoder_init(SlotEncoder *enc, size_t n, int64_t t) {
+  if (n < 2 || (n & (n - 1)) != 0 || t >= (1ll << 31) || !is_prime(t) ||
+      (t - 1) % (2 * (int64_t)n) != 0)
+    return -1;
+
+  // zeta = x^((t-1)/2n) has order dividing 2n, and exactly 2n (n a power of
+  // two) when zeta^n = -1.
+  int64_t zeta = 0;
+  for (int64_t x = 2; x < t && zeta == 0; x++) {
+    int64_t z = pow_mod(x, (uint64_t)(t - 1) / (2 * n), t);
+    if (pow_mod(z, n, t) == t - 1)
+      zeta = z;
+  }
+  enc->zeta = (int64_t *)malloc(2 * n * sizeof(int64_t));
+  enc->exps = (size_t *)malloc(n * sizeof(size_t));
+  if (zeta == 0 || enc->zeta == NULL || enc->exps == NULL) {
+    slot_encoder_free(enc);
+    return -1;
+  }
+  enc->n = n;
+  enc->t = t;
+  enc->n_inv = pow_mod((int64_t)n, (uint64_t)(t - 2), t);
+  enc->zeta[0] = 1;
+  for (size_t i = 1; i < 2 * n; i++)
+    enc->zeta[i] = mul_mod(enc->zeta[i - 1], zeta, t);
+  size_t e = 1;
+  for (size_t j = 0; j < n / 2; j++) {
+    enc->exps[j] = e;
+    enc->exps[n / 2 + j] = 2 * n - e;
+    e = e * 5 % (2 * n);
+  }
+  return 0;
+}
+
+void slot_encoder_free(SlotEncoder *enc) {
+  free(enc->zeta);
+  free(enc->exps);
+  enc->zeta = NULL;
+  enc->exps = NULL;
+}
+
+// m_i = n^-1 * sum_j slots[j] * zeta^(-e_j * i): the sum over all 2n-th roots
+// of unity zeta^e (e odd) of zeta^(e * d) vanishes unless d = 0 mod 2n.
+void slot_encode(const SlotEncoder *enc, const int64_t *slots, Poly *m) {
+  size_t n = enc->n, two_n = 2 * n;
+  int64_t t = enc->t;
+  for (size_t i = 0; i < n; i++) {
+    int64_t acc = 0;
+    for (size_t j = 0; j < n; j++) {
+      size_t e = (two_n - enc->exps[j] * i % two_n) % two_n;
+      int64_t v = slots[j] % t;
+      acc = (acc + mul_mod(v < 0 ? v + t : v, enc->zeta[e], t)) % t;
+    }
+    m->coeffs[i] = (double)mul_mod(acc, enc->n_inv, t);
+  }
+  poly_truncate(m, n);
+}
+
+void slot_decode(const SlotEncoder *enc, const Poly *m, int64_t *slots) {
+  size_t n = enc->n, two_n = 2 * n;
+  int64_t t = enc->t;
+  size_t live = (size_t)m->max_degree + 1 < n ? m->max_degree + 1 : n;
+  for (size_t j = 0; j < n; j++) {
+    int64_t acc = 0;
+    for (size_t i = 0; i < live; i++) {
+      int64_t c = (int64_t)positive_fmod(m->coeffs[i], (double)t);
+      acc = (acc + mul_mod(c, enc->zeta[enc->exps[j] * i % two_n], t)) % t;
+    }
+    slots[j] = acc;
+  }
+}
+
+size_t slot_rotation(size_t n, size_t k) {
+  size_t g = 1;
+  for (size_t i = 0; i < k; i++)
+    g = g * 5 % (2 * n);
+  return g;
+}
+
+int packed_keygen(PackedKeys *keys, SecretKey sk, size_t dim, size_t n,
+                  double q, const Poly *poly_mod, double w) {
+  keys->dim = 0;
+  if (dim == 0 || (n / 2) % dim != 0)
+    return -1;
+  keys->rot = (DigitEvalKey *)calloc(dim, sizeof(DigitEvalKey));
+  if (keys->rot == NULL)
+    return -1;
+  keys->dim = dim;
+  for (size_t k = 1; k < dim; k++) {
+    if (evaluate_keygen_galois(&keys->rot[k], sk, n, q, *poly_mod,
+                               slot_rotation(n, k), w) < 0) {
+      packed_keys_free(keys);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+void packed_keys_free(PackedKeys *keys) {
+  for (size_t k = 1; k < keys->dim; k++)
+    digit_eval_key_free(&keys->rot[k]);
+  free(keys->rot);
+  keys->rot = NULL;
+  keys->dim = 0;
+}
+
+// Replicates v (length dim) across all n slots and encodes it.
+static void encode_replicated(Poly *m, const SlotEncoder *enc,
+                              const int64_t *v, size_t dim) {
+  size_t mark = scratch_mark();
+  int64_t *slots = (int64_t *)scratch_bytes(enc->n * sizeof(int64_t));
+  for (size_t j = 0; j < enc->n; j++)
+    slots[j] = v[j % dim];
+  slot_encode(enc, slots, m);
+  scratch_release(mark);
+}
+
+void packed_encrypt(Ciphertext *out, const SlotEncoder *enc,
+                    const PublicKey *pk, double q, const Poly *poly_mod,
+                    const int64_t *v, size_t dim) {
+  assert((enc->n / 2) % dim == 0);
+  size_t mark = scratch_mark();
+  Poly *m = scratch_polys(1);
+  encode_replicated(m, enc, v, dim);
+  encrypt_poly(out, pk, enc->n, q, poly_mod, (double)enc->t, m);
+  scratch_release(mark);
+}
+
+void packed_decrypt(int64_t *v, size_t dim, const SlotEncoder *enc,
+                    const SecretKey *sk, double q, const Poly *poly_mod,
+                    const Ciphertext *ct) {
+  size_t mark = scratch_mark();
+  Poly *m = scratch_polys(1);
+  int64_t *slots = (int64_t *)scratch_bytes(enc->n * sizeof(int64_t));
+  decrypt_poly(m, sk, enc->n, q, poly_mod, (double)enc->t, ct);
+  slot_decode(enc, m, slots);
+  for (size_t j = 0; j < dim; j++)
+    v[j] = slots[j];
+  scratch_release(mark);
+}
+
+// u_k[j] = M[(j - k) mod dim][j], replicated and encoded.
+static void encode_diagonal(Poly *m, const SlotEncoder *enc, const int64_t *M,
+                            size_t dim, size_t k) {
+  size_t mark = scratch_mark();
+  int64_t *u = (int64_t *)scratch_bytes(dim * sizeof(int64_t));
+  for (size_t j = 0; j < dim; j++)
+    u[j] = M[((j + dim - k) % dim) * dim + j];
+  encode_replicated(m, enc, u, dim);
+  scratch_release(mark);
+}
+
+void packed_encode_diagonals(Poly *diags, const SlotEncoder *enc,
+                             const int64_t *M, size_t dim) {
+  assert((enc->n / 2) % dim == 0);
+  for (size_t k = 0; k < dim; k++)
+    encode_diagonal(&diags[k], enc, M, dim, k);
+}
+
+void packed_encrypt_diagonals(Ciphertext *diags, const SlotEncoder *enc,
+                              const PublicKey *pk, double q,
+                              const Poly *poly_mod, const int64_t *M,
+                              size_t dim) {
+  assert((enc->n / 2) % dim == 0);
+  size_t mark = scratch_mark();
+  Poly *m = scratch_polys(1);
+  for (size_t k = 0; k < dim; k++) {
+    encode_diagonal(m, enc, M, dim, k);
+    encrypt_poly(&diags[k], pk, enc->n, q, poly_mod, (double)enc->t, m);
+  }
+  scratch_release(mark);
+}
+
+// acc += rot_k(term), where rot_0 is the identity. Every term of a product
+// shares v, and its noise enters each term the same way, so the noise adds
+// linearly rather than as independent terms.
+static void accumulate_rotated(Ciphertext *acc, const Ciphertext *term,
+                               size_t k, const PackedKeys *keys, double q,
+                               const Poly *poly_mod) {
+  size_t n = (size_t)poly_degree_of(poly_mod);
+  if (k == 0) {
+    *acc = *term;
+    return;
+  }
+  size_t mark = scratch_mark();
+  Ciphertext *rotated = (Ciphertext *)scratch_bytes(sizeof(Ciphertext));
+  apply_galois(rotated, term, slot_rotation(n, k), q, poly_mod, &keys->rot[k]);
+  ring_add_mod_into(&acc->c0, &acc->c0, &rotated->c0, q, poly_mod);
+  ring_add_mod_into(&acc->c1, &acc->c1, &rotated->c1, q, poly_mod);
+  acc->noise += rotated->noise;
+  scratch_release(mark);
+}
+
+void packed_matvec_plain(Ciphertext *out, const Poly *diags,
+                         const Ciphertext *v, const PackedKeys *keys,
+                         double q, double t, const Poly *poly_mod) {
+  size_t mark = scratch_mark();
+  Ciphertext *term = (Ciphertext *)scratch_bytes(sizeof(Ciphertext));
+  for (size_t k = 0; k < keys->dim; k++) {
+    mul_plain_poly(term, v, &diags[k], q, t, poly_mod);
+    accumulate_rotated(out, term, k, keys, q, poly_mod);
+  }
+  scratch_release(mark);
+}
+
+void packed_matvec(Ciphertext *out, const Ciphertext *diags,
+                   const Ciphertext *v, const PackedKeys *keys,
+                   const DigitEvalKey *rlk, double q, double t,
+                   const Poly *poly_mod) {
+  size_t mark = scratch_mark();
+  Ciphertext3 *prod = (Ciphertext3 *)scratch_bytes(sizeof(Ciphertext3));
+  Ciphertext *term = (Ciphertext *)scratch_bytes(sizeof(Ciphertext));
+  for (size_t k = 0; k < keys->dim; k++) {
+    mul_cipher_no_relin(prod, &diags[k], v, q, t, poly_mod);
+    relinearize_digits(term, prod, q, poly_mod, rlk);
+    accumulate_rotated(out, term, k, keys, q, poly_mod);
+  }
+  scratch_release(mark);
+}
@@ -0,0 +1,91 @@
+#ifndef PACKED_H
+#define PACKED_H
+
+#include "types.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// Slot packing. For a prime t = 1 mod 2n, X^n + 1 splits into n linear
+// factors mod t, so a plaintext polynomial is equivalent to its values at the
+// n roots zeta^e (zeta a primitive 2n-th root of unity mod t, e odd): n slots
+// that add and multiply element-wise. The slots form two rows of n/2. Slot j
+// of row 0 is e = 5^j mod 2n and slot j of row 1 is e = -5^j, so the
+// automorphism X -> X^(5^k) rotates both rows left by k.
+typedef struct {
+  size_t n;
+  int64_t t;
+  int64_t n_inv; // n^-1 mod t
+  int64_t *zeta; // zeta^i mod t for i < 2n
+  size_t *exps;  // root exponent e of each slot
+} SlotEncoder;
+
+// Smallest prime t >= min_t with t = 1 mod 2n.
+int64_t slot_modulus(size_t n, int64_t min_t);
+
+// Returns 0 on success, -1 if n is not a power of two, t is not a prime
+// = 1 mod 2n below 2^31, or the tables could not be allocated.
+int slot_encoder_init(SlotEncoder *enc, size_t n, int64_t t);
+
+void slot_encoder_free(SlotEncoder *enc);
+
+// Between n slot values mod t and the plaintext polynomial (coefficients in
+// [0, t)) that holds them. Both are O(n^2).
+void slot_encode(const SlotEncoder *enc, const int64_t *slots, Poly *m);
+
+void slot_decode(const SlotEncoder *enc, const Poly *m, int64_t *slots);
+
+// Galois element 5^k mod 2n, which rotates the slots left by k.
+size_t slot_rotation(size_t n, size_t k);
+
+// Packed linear algebra on vectors of length dim, which must divide n/2. A
+// vector is replicated across all n slots, so rotating the slots by k rotates
+// every copy cyclically mod dim.
+//
+// Matrix-vector products use the Halevi-Shoup diagonal method in the form
+// y = sum_k rot_k(u_k * v), where u_k[j] = M[(j - k) mod dim][j] is the k-th
+// diagonal pre-rotated by -k. Rotating the products rather than v adds each
+// rotation's key switching noise once instead of multiplying it by M. One
+// product takes dim slot-wise multiplies and dim - 1 rotations, against dim^2
+// scalar products unpacked.
+typedef struct {
+  size_t dim;
+  DigitEvalKey *rot; // rot[k] rotates by k, for 0 < k < dim
+} PackedKeys;
+
+// Galois keys for rotations by 1 .. dim - 1 in base w. Returns 0 on success,
+// -1 on a bad dim or failed allocation.
+int packed_keygen(PackedKeys *keys, SecretKey sk, size_t dim, size_t n,
+                  double q, const Poly *poly_mod, double w);
+
+void packed_keys_free(PackedKeys *keys);
+
+void packed_encrypt(Ciphertext *out, const SlotEncoder *enc,
+                    const PublicKey *pk, double q, const Poly *poly_mod,
+                    const int64_t *v, size_t dim);
+
+void packed_decrypt(int64_t *v, size_t dim, const SlotEncoder *enc,
+                    const SecretKey *sk, double q, const Poly *poly_mod,
+                    const Ciphertext *ct);
+
+// The dim diagonals u_k of the dim x dim row-major matrix M (values mod t)
+// as plaintexts, or encrypted for products with an encrypted matrix.
+void packed_encode_diagonals(Poly *diags, const SlotEncoder *enc,
+                             const int64_t *M, size_t dim);
+
+void packed_encrypt_diagonals(Ciphertext *diags, const SlotEncoder *enc,
+                              const PublicKey *pk, double q,
+                              const Poly *poly_mod, const int64_t *M,
+                              size_t dim);
+
+// out = M v for a plaintext M (diagonals from packed_encode_diagonals).
+void packed_matvec_plain(Ciphertext *out, const Poly *diags,
+                         const Ciphertext *v, const PackedKeys *keys,
+                         double q, double t, const Poly *poly_mod);
+
+// out = M v for an encrypted M, relinearizing each product with `rlk`.
+void packed_matvec(Ciphertext *out, const Ciphertext *diags,
+                   const Ciphertext *v, const PackedKeys *keys,
+                   const DigitEvalKey *rlk, double q, double t,
+                   const Poly *poly_mod);
+
+#endif
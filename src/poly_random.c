@@ -1,24 +1,32 @@
 #include "poly_random.h"
+#include "instrument.h"
 #include "poly_utils.h"
 #include <math.h>
 #include <stdlib.h>
 #include <time.h>
 
-Poly gen_binary_poly(size_t size) {
-  Poly p = create_poly();
+void gen_binary_into(Poly *p, size_t size) {
+  INSTR_BEGIN();
+  poly_zero(p);
 
   int max_degree = 0;
   for (size_t i = 0; i < size && i < MAX_POLY_DEGREE; ++i) {
     double v = (rand() % 2) ? 1.0 : 0.0;
-    p.coeffs[i] = v;
+    p->coeffs[i] = v;
     if (fabs(v) > 1e-9) {
       max_degree = i;
     }
     if (v != 0.0) {
-      p.max_degree = i;
+      p->max_degree = i;
     }
   }
-  p.degree = max_degree;
+  p->degree = max_degree;
+  INSTR_END(INSTR_GEN_BINARY, INSTR_COEFF_BYTES(size));
+}
+
+Poly gen_binary_poly(size_t size) {
+  Poly p;
+  gen_binary_into(&p, size);
   return p;
 }
 
@@ -35,38 +43,52 @@ static double gen_normal(double mean, double stddev) {
   return mean + u * s * stddev;
 }
 
-Poly gen_normal_poly(size_t size, double mean, double stddev) {
-  Poly p = create_poly();
+void gen_normal_into(Poly *p, size_t size, double mean, double stddev) {
+  INSTR_BEGIN();
+  poly_zero(p);
 
   int max_degree = 0;
   for (size_t i = 0; i < size && i < MAX_POLY_DEGREE; ++i) {
     double v = round(gen_normal(mean, stddev));
-    p.coeffs[i] = v;
+    p->coeffs[i] = v;
     if (fabs(v) > 1e-9) {
       max_degree = i;
     }
     if (v != 0.0) {
-      p.max_degree = i;
+      p->max_degree = i;
     }
   }
-  p.degree = max_degree;
+  p->degree = max_degree;
+  INSTR_END(INSTR_GEN_NORMAL, INSTR_COEFF_BYTES(size));
+}
+
+Poly gen_normal_poly(size_t size, double mean, double stddev) {
+  Poly p;
+  gen_normal_into(&p, size, mean, stddev);
   return p;
 }
 
-Poly gen_uniform_poly(size_t size, double modulus) {
-  Poly p = create_poly();
+void gen_uniform_into(Poly *p, size_t size, double modulus) {
+  INSTR_BEGIN();
+  poly_zero(p);
 
   int max_degree = 0;
   for (size_t i = 0; i < size && i < MAX_POLY_DEGREE; ++i) {
     double v = ((double)rand() / RAND_MAX) * modulus;
-    p.coeffs[i] = v;
+    p->coeffs[i] = v;
     if (fabs(v) > 1e-9) {
       max_degree = i;
     }
     if (v != 0.0) {
-      p.max_degree = i;
+      p->max_degree = i;
     }
   }
-  p.degree = max_degree;
+  p->degree = max_degree;
+  INSTR_END(INSTR_GEN_UNIFORM, INSTR_COEFF_BYTES(size));
+}
+
+Poly gen_uniform_poly(size_t size, double modulus) {
+  Poly p;
+  gen_uniform_into(&p, size, modulus);
   return p;
-}
\ No newline at end of file
+}
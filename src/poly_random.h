@@ -10,4 +10,12 @@ Poly gen_uniform_poly(size_t size, double modulus);
 
 Poly gen_normal_poly(size_t size, double mean, double stddev);
 
+// The same draws written into `p`, for callers that sample into scratch or a
+// ciphertext instead of copying a whole Poly out.
+void gen_binary_into(Poly *p, size_t size);
+
+void gen_uniform_into(Poly *p, size_t size, double modulus);
+
+void gen_normal_into(Poly *p, size_t size, double mean, double stddev);
+
 #endif
\ No newline at end of file
@@ -1,15 +1,18 @@
 #include "poly_utils.h"
+#include "instrument.h"
 #include <assert.h>
 #include <stdlib.h>
 #include <string.h>
 
+// Only coeffs[0..max_degree] are live; everything above is left unwritten
+// and every reader treats it as zero, so creating or resetting a polynomial
+// costs the same for n = 16 as for n = 4096.
 Poly create_poly(void) {
   Poly p;
-  for (int i = 0; i < MAX_POLY_DEGREE; i++) {
-    p.coeffs[i] = 0.0;
-  }
+  p.coeffs[0] = 0.0;
   p.degree = 0;
   p.max_degree = 0;
+  p.ring_n = 0;
   return p;
 }
 
@@ -21,17 +24,19 @@ double positive_fmod(double x, double m) {
   return r;
 }
 
-int64_t poly_degree(Poly p) {
-  for (int64_t i = MAX_POLY_DEGREE - 1; i >= 0; i--) {
-    if (fabs(p.coeffs[i]) > 1e-9) {
+int64_t poly_degree_of(const Poly *p) {
+  for (int64_t i = p->max_degree; i >= 0; i--) {
+    if (fabs(p->coeffs[i]) > 1e-9) {
       return i;
     }
   }
   return 0;
 }
 
+int64_t poly_degree(Poly p) { return poly_degree_of(&p); }
+
 double get_coeff(Poly p, int64_t degree) {
-  if (degree >= MAX_POLY_DEGREE || degree < 0) {
+  if (degree > p.max_degree || degree < 0) {
     return 0.0;
   }
   return p.coeffs[degree];
@@ -41,10 +46,13 @@ void set_coeff(Poly *p, int64_t degree, double value) {
   if (degree >= MAX_POLY_DEGREE || degree < 0) {
     return;
   }
-  p->coeffs[degree] = value;
+  p->ring_n = 0;
   if (degree > p->max_degree) {
+    memset(p->coeffs + p->max_degree + 1, 0,
+           (degree - p->max_degree - 1) * sizeof(double));
     p->max_degree = degree;
   }
+  p->coeffs[degree] = value;
   if (degree == p->degree && fabs(value) <= 1e-9) {
     while (p->degree > 0 && fabs(p->coeffs[p->degree]) <= 1e-9) {
       p->degree--;
@@ -54,30 +62,69 @@ void set_coeff(Poly *p, int64_t degree, double value) {
   }
 }
 
-Poly coeff_mod(Poly p, double modulus) {
-  Poly out = create_poly();
-  for (int i = 0; i <= p.degree; i++) {
-    if (fabs(p.coeffs[i]) > 1e-9) {
-      double rounded = round(p.coeffs[i]);
-      double m = positive_fmod(rounded, modulus);
-      out.coeffs[i] = m;
-    }
+void poly_zero(Poly *p) {
+  p->coeffs[0] = 0.0;
+  p->degree = 0;
+  p->max_degree = 0;
+  p->ring_n = 0;
+}
+
+const double *poly_dense(const Poly *p, size_t n, double *buf) {
+  size_t live = (size_t)p->max_degree + 1;
+  if (live >= n)
+    return p->coeffs;
+  memcpy(buf, p->coeffs, live * sizeof(double));
+  memset(buf + live, 0, (n - live) * sizeof(double));
+  return buf;
+}
+
+void poly_copy_coeffs(double *dst, const Poly *p, size_t n) {
+  const double *src = poly_dense(p, n, dst);
+  if (src != dst)
+    memcpy(dst, src, n * sizeof(double));
+}
+
+void coeff_mod_into(Poly *out, const Poly *p, double modulus) {
+  INSTR_BEGIN();
+  int degree = p->degree;
+  int max_degree = p->max_degree;
+  for (int i = 0; i <= degree; i++) {
+    double v = p->coeffs[i];
+    out->coeffs[i] = fabs(v) > 1e-9 ? positive_fmod(round(v), modulus) : 0.0;
   }
-  out.max_degree = p.max_degree;
-  out.degree = p.degree;
+  for (int i = degree + 1; i <= max_degree; i++)
+    out->coeffs[i] = 0.0;
+  out->max_degree = max_degree;
+  out->degree = degree;
+  INSTR_END(INSTR_COEFF_MOD, INSTR_COEFF_BYTES(2 * (degree + 1)));
+}
+
+Poly coeff_mod(Poly p, double modulus) {
+  Poly out;
+  coeff_mod_into(&out, &p, modulus);
   return out;
 }
 
-Poly poly_add(Poly a, Poly b) {
-  Poly sum = create_poly();
-  int max_degree = (a.max_degree > b.max_degree) ? a.max_degree : b.max_degree;
-  for (int i = 0; i <= max_degree; i++) {
-    sum.coeffs[i] = a.coeffs[i] + b.coeffs[i];
+void poly_add_into(Poly *sum, const Poly *a, const Poly *b) {
+  // Each input is read only up to its own max_degree.
+  const Poly *longer = (a->max_degree > b->max_degree) ? a : b;
+  int common = (a->max_degree > b->max_degree) ? b->max_degree : a->max_degree;
+  int max_degree = longer->max_degree;
+  for (int i = 0; i <= common; i++) {
+    sum->coeffs[i] = a->coeffs[i] + b->coeffs[i];
+  }
+  for (int i = common + 1; i <= max_degree; i++) {
+    sum->coeffs[i] = longer->coeffs[i];
   }
   int64_t deg = max_degree;
-  while (deg > 0 && fabs(sum.coeffs[deg]) < 1e-9) deg--;
-  sum.degree = deg;
-  sum.max_degree = max_degree;
+  while (deg > 0 && fabs(sum->coeffs[deg]) < 1e-9) deg--;
+  sum->degree = deg;
+  sum->max_degree = max_degree;
+}
+
+Poly poly_add(Poly a, Poly b) {
+  Poly sum;
+  poly_add_into(&sum, &a, &b);
   return sum;
 }
 
@@ -93,102 +140,143 @@ Poly poly_mul_scalar(Poly p, double scalar) {
   return res;
 }
 
-Poly poly_mul(Poly a, Poly b) {
-  Poly res = create_poly();
+void poly_mul_into(Poly *res, const Poly *a, const Poly *b) {
+  INSTR_BEGIN();
+  assert(res != a && res != b);
+  int top = a->degree + b->degree;
+  if (top >= MAX_POLY_DEGREE)
+    top = MAX_POLY_DEGREE - 1;
+  memset(res->coeffs, 0, (top + 1) * sizeof(double));
 
   int nonzero_deg[MAX_POLY_DEGREE];
   size_t nz_count = 0;
-  for (int i = 0; i <= b.degree; i++) {
-      if (fabs(b.coeffs[i]) > 1e-9)
+  for (int i = 0; i <= b->degree; i++) {
+      if (fabs(b->coeffs[i]) > 1e-9)
           nonzero_deg[nz_count++] = i;
   }
   int max_res_degree = 0;
   int max_poly_res_degree = 0;
-  for (int i = 0; i <= a.degree; i++) {
-    if (fabs(a.coeffs[i]) > 1e-9) {
+  for (int i = 0; i <= a->degree; i++) {
+    if (fabs(a->coeffs[i]) > 1e-9) {
       for (size_t j = 0; j < nz_count; j++) {
         int ind = nonzero_deg[j];
         assert(i + ind < MAX_POLY_DEGREE);
-        res.coeffs[i + ind] += a.coeffs[i] * b.coeffs[ind];
+        res->coeffs[i + ind] += a->coeffs[i] * b->coeffs[ind];
         if (i + ind > max_poly_res_degree) {
           max_poly_res_degree = i + ind;
         }
-        if (i + ind > max_res_degree && fabs(res.coeffs[i + ind]) > 1e-9) {
+        if (i + ind > max_res_degree && fabs(res->coeffs[i + ind]) > 1e-9) {
           max_res_degree = i + ind;
         }
       }
     }
   }
-  res.max_degree = max_poly_res_degree;
-  res.degree = max_res_degree;
+  res->max_degree = max_poly_res_degree;
+  res->degree = max_res_degree;
+  INSTR_END(INSTR_POLY_MUL,
+            INSTR_COEFF_BYTES(a->degree + b->degree + res->max_degree + 3));
+}
+
+Poly poly_mul(Poly a, Poly b) {
+  Poly res;
+  poly_mul_into(&res, &a, &b);
   return res;
 }
 
-void poly_divmod(Poly num, Poly den, Poly *quot, Poly *rem) {
+void poly_divmod_into(Poly *quot, Poly *rem, const Poly *den) {
   // In our case `den` should always be (x^n + 1)
-  assert(poly_degree(den) > 0 || fabs(get_coeff(den, 0)) > 1e-9);
+  INSTR_BEGIN();
+  assert(poly_degree_of(den) > 0 || fabs(den->coeffs[0]) > 1e-9);
 
-  size_t ndeg = poly_degree(num);
-  size_t ddeg = poly_degree(den);
+  size_t ndeg = poly_degree_of(rem);
+  size_t ddeg = poly_degree_of(den);
 
-  *quot = create_poly();
-  *rem = num;
+  if (quot) {
+    poly_zero(quot);
+    if (ndeg >= ddeg)
+      memset(quot->coeffs, 0, (ndeg - ddeg + 1) * sizeof(double));
+  }
 
   if (ndeg < ddeg) {
+    INSTR_END(INSTR_POLY_DIVMOD, INSTR_COEFF_BYTES(2 * (ndeg + 1)));
     return;
   }
 
   int nonzero_deg[MAX_POLY_DEGREE];
   size_t nz_count = 0;
   for (int i = 0; i <= ddeg; i++) {
-      if (fabs(den.coeffs[i]) > 1e-9)
+      if (fabs(den->coeffs[i]) > 1e-9)
           nonzero_deg[nz_count++] = i;
   }
 
-  double d_lead = get_coeff(den, ddeg);
+  double d_lead = den->coeffs[ddeg];
   assert(fabs(d_lead) > 1e-9);
   int max_rem_degree = rem->degree;
   int max_poly_rem_degree = rem->max_degree;
-  int max_quot_degree = quot->degree;
-  int max_poly_quot_degree = quot->max_degree;
+  int max_quot_degree = 0;
+  int max_poly_quot_degree = 0;
   for (int64_t k = ndeg - ddeg; k >= 0; --k) {
     int64_t target_deg = ddeg + k;
-    double r_coeff = get_coeff(*rem, target_deg);
+    double r_coeff = rem->coeffs[target_deg];
     double coeff = trunc(round(r_coeff) / round(d_lead));
-    quot->coeffs[k] += coeff;
-    if (k > max_quot_degree && fabs(quot->coeffs[k]) > 1e-9)
-        max_quot_degree = k;
-    if (k > max_poly_quot_degree)
-        max_poly_quot_degree = k;
+    if (quot) {
+      quot->coeffs[k] += coeff;
+      if (k > max_quot_degree && fabs(quot->coeffs[k]) > 1e-9)
+          max_quot_degree = k;
+      if (k > max_poly_quot_degree)
+          max_poly_quot_degree = k;
+    }
 
     for (size_t j = 0; j < nz_count; j++) {
         int i = nonzero_deg[j];
-        rem->coeffs[i + k] -= coeff * den.coeffs[i];
+        rem->coeffs[i + k] -= coeff * den->coeffs[i];
         if (i + k > max_rem_degree && fabs(rem->coeffs[i + k]) > 1e-9)
             max_rem_degree = i + k;
         if (i + k > max_poly_rem_degree)
             max_poly_rem_degree = i + k;
     }
   }
-  quot->max_degree = max_poly_quot_degree;
+  if (quot) {
+    quot->max_degree = max_poly_quot_degree;
+    quot->degree = max_quot_degree;
+  }
   rem->max_degree = max_poly_rem_degree;
-  quot->degree = max_quot_degree;
   rem->degree = max_rem_degree;
 
-  assert(poly_degree(*rem) < poly_degree(den));
+  assert(poly_degree_of(rem) < (int64_t)ddeg);
+  INSTR_END(INSTR_POLY_DIVMOD, INSTR_COEFF_BYTES(2 * (ndeg + 1) + ddeg + 1));
 }
 
-Poly poly_round_div_scalar(Poly x, double divisor) {
-  Poly out = create_poly();
+void poly_divmod(Poly num, Poly den, Poly *quot, Poly *rem) {
+  *rem = num;
+  poly_divmod_into(quot, rem, &den);
+}
+
+void poly_round_div_scalar_into(Poly *out, const Poly *x, double divisor) {
   assert(fabs(divisor) > 1e-9);
+  int degree = x->degree;
+  int max_degree = x->max_degree;
 
-  for (int i = 0; i <= x.max_degree; i++) {
-    double v = x.coeffs[i];
-    out.coeffs[i] = round(v / divisor);
+  for (int i = 0; i <= max_degree; i++) {
+    out->coeffs[i] = round(x->coeffs[i] / divisor);
   }
-  int64_t deg = x.degree;
-  while (deg > 0 && fabs(out.coeffs[deg]) < 1e-9) deg--;
-  out.degree = deg;
-  out.max_degree = x.max_degree;
+  int64_t deg = degree;
+  while (deg > 0 && fabs(out->coeffs[deg]) < 1e-9) deg--;
+  out->degree = deg;
+  out->max_degree = max_degree;
+}
+
+Poly poly_round_div_scalar(Poly x, double divisor) {
+  Poly out;
+  poly_round_div_scalar_into(&out, &x, divisor);
   return out;
 }
+
+void poly_truncate(Poly *p, size_t n) {
+  int degree = (int)n - 1;
+  while (degree > 0 && fabs(p->coeffs[degree]) <= 1e-9)
+    degree--;
+  p->degree = degree;
+  p->max_degree = (int)n - 1;
+  p->ring_n = 0;
+}
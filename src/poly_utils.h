@@ -9,6 +9,9 @@ double positive_fmod(double x, double m);
 
 int64_t poly_degree(Poly p);
 
+// poly_degree without copying the polynomial.
+int64_t poly_degree_of(const Poly *p);
+
 double get_coeff(Poly p, int64_t degree);
 
 void set_coeff(Poly *p, int64_t degree, double value);
@@ -19,11 +22,44 @@ Poly poly_add(Poly a, Poly b);
 
 Poly poly_mul_scalar(Poly p, double scalar);
 
+Poly poly_round_div_scalar(Poly x, double divisor);
+
 Poly poly_mul(Poly a, Poly b);
 
 void poly_divmod(Poly numerator, Poly denominator, Poly *quotient,
                  Poly *remainder);
 
+// Only coefficients 0..max_degree of a Poly are live: create_poly and the
+// operations below write that range and nothing above it, and every reader
+// treats the coefficients past max_degree as zero.
 Poly create_poly(void);
 
+// Pointer-based forms of the operations above for callers that keep their
+// polynomials in scratch or arena memory. `out` may alias the input except
+// for poly_mul_into. poly_divmod_into reduces `rem` in place and skips the
+// quotient when `quot` is NULL.
+void poly_zero(Poly *p);
+
+void coeff_mod_into(Poly *out, const Poly *p, double modulus);
+
+void poly_add_into(Poly *sum, const Poly *a, const Poly *b);
+
+void poly_mul_into(Poly *res, const Poly *a, const Poly *b);
+
+void poly_divmod_into(Poly *quot, Poly *rem, const Poly *den);
+
+void poly_round_div_scalar_into(Poly *out, const Poly *x, double divisor);
+
+// Sets the degree bookkeeping of a ring element mod X^n + 1 whose n live
+// coefficients were written directly.
+void poly_truncate(Poly *p, size_t n);
+
+// The first n coefficients of `p` as a plain array, for kernels that loop
+// over all n: p->coeffs itself when they are all live, otherwise `buf` (room
+// for n doubles) filled with the live ones followed by zeros.
+const double *poly_dense(const Poly *p, size_t n, double *buf);
+
+// Copies the first n coefficients of `p` to `dst`, zeros past the live range.
+void poly_copy_coeffs(double *dst, const Poly *p, size_t n);
+
 #endif
\ No newline at end of file
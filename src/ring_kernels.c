@@ -0,0 +1,115 @@
+#include "ring_kernels.h"
+#include <math.h>
+
+// Inputs to add_mod below this bound keep every sum exact and below the
+// 2^53 REDUCE_MOD needs.
+#define ADD_LIMIT 2251799813685248.0 // 2^51
+
+// The recursion ends at n = 16 (KARATSUBA_CUTOFF in ring_utils.c is 32), so
+// every power-of-two degree bottoms out in this one. Summing by output
+// coefficient keeps each accumulator in registers once the loops unroll.
+static void karatsuba_16(wide_int *r, const int64_t *a, const int64_t *b,
+                         unsigned char *ws) {
+  (void)ws;
+#pragma GCC unroll 31
+  for (int k = 0; k < 31; k++) {
+    wide_int acc = 0;
+#pragma GCC unroll 16
+    for (int i = k < 16 ? 0 : k - 15; i <= (k < 16 ? k : 15); i++)
+      acc += (wide_int)a[i] * b[k - i];
+    r[k] = acc;
+  }
+}
+
+// The generic karatsuba in ring_utils.c with n = N and h = m = H; it uses the
+// same workspace layout, so karatsuba_ws sizes both.
+#define DEFINE_KARATSUBA(N, H)                                                 \
+  static void karatsuba_##N(wide_int *r, const int64_t *a, const int64_t *b,   \
+                            unsigned char *ws) {                               \
+    int64_t *sa = (int64_t *)ws;                                               \
+    int64_t *sb = sa + (H);                                                    \
+    wide_int *mid = (wide_int *)(sb + (H));                                    \
+    unsigned char *next = (unsigned char *)(mid + 2 * (H) - 1);                \
+    karatsuba_##H(r, a, b, next);                                              \
+    r[2 * (H) - 1] = 0;                                                        \
+    karatsuba_##H(r + 2 * (H), a + (H), b + (H), next);                        \
+    _Pragma("omp simd")                                                        \
+    for (size_t i = 0; i < (H); i++) {                                         \
+      sa[i] = a[(H) + i] + a[i];                                               \
+      sb[i] = b[(H) + i] + b[i];                                               \
+    }                                                                          \
+    karatsuba_##H(mid, sa, sb, next);                                          \
+    for (size_t i = 0; i < 2 * (H) - 1; i++)                                   \
+      mid[i] -= r[i] + r[2 * (H) + i];                                         \
+    for (size_t i = 0; i < 2 * (H) - 1; i++)                                   \
+      r[(H) + i] += mid[i];                                                    \
+  }
+
+#define DEFINE_ELEMENTWISE(N)                                                  \
+  static int add_mod_##N(double *out, const double *x, const double *y,        \
+                         double q) {                                           \
+    int ok = 1;                                                                \
+    _Pragma("omp simd reduction(&:ok)")                                        \
+    for (size_t i = 0; i < (N); i++)                                           \
+      ok &= (fabs(x[i]) < ADD_LIMIT) & (fabs(y[i]) < ADD_LIMIT);               \
+    if (!ok)                                                                   \
+      return 0;                                                                \
+    _Pragma("omp simd")                                                        \
+    for (size_t i = 0; i < (N); i++) {                                         \
+      double v = round(x[i] + y[i]);                                           \
+      REDUCE_MOD(v, q);                                                        \
+      out[i] = v;                                                              \
+    }                                                                          \
+    return 1;                                                                  \
+  }                                                                            \
+                                                                               \
+  static void fold_##N(double *out, const wide_int *prod, int64_t q) {         \
+    for (size_t i = 0; i < (N); i++) {                                         \
+      wide_int v = prod[i] - (i + 1 < (N) ? prod[(N) + i] : 0);                \
+      if (q != 0) {                                                            \
+        v %= q;                                                                \
+        v += v < 0 ? q : 0;                                                    \
+      }                                                                        \
+      out[i] = (double)v;                                                      \
+    }                                                                          \
+  }
+
+DEFINE_KARATSUBA(32, 16)
+DEFINE_KARATSUBA(64, 32)
+DEFINE_KARATSUBA(128, 64)
+DEFINE_KARATSUBA(256, 128)
+DEFINE_KARATSUBA(512, 256)
+DEFINE_KARATSUBA(1024, 512)
+DEFINE_KARATSUBA(2048, 1024)
+DEFINE_KARATSUBA(4096, 2048)
+DEFINE_KARATSUBA(8192, 4096)
+
+DEFINE_ELEMENTWISE(16)
+DEFINE_ELEMENTWISE(32)
+DEFINE_ELEMENTWISE(64)
+DEFINE_ELEMENTWISE(128)
+DEFINE_ELEMENTWISE(256)
+DEFINE_ELEMENTWISE(512)
+DEFINE_ELEMENTWISE(1024)
+DEFINE_ELEMENTWISE(2048)
+DEFINE_ELEMENTWISE(4096)
+DEFINE_ELEMENTWISE(8192)
+
+#define RING_KERNELS(N) {(N), add_mod_##N, karatsuba_##N, fold_##N}
+
+// Indexed by log2(n / RING_KERNELS_MIN_N).
+static const RingKernels kernels[] = {
+    RING_KERNELS(16),   RING_KERNELS(32),   RING_KERNELS(64),
+    RING_KERNELS(128),  RING_KERNELS(256),  RING_KERNELS(512),
+    RING_KERNELS(1024), RING_KERNELS(2048), RING_KERNELS(4096),
+    RING_KERNELS(8192),
+};
+
+const RingKernels *ring_kernels_for(size_t n) {
+  if (n < RING_KERNELS_MIN_N || n > RING_KERNELS_MAX_N || (n & (n - 1)) != 0)
+    return NULL;
+  size_t i = 0;
+  while ((size_t)RING_KERNELS_MIN_N << i < n)
+    i++;
+  return &kernels[i];
+}
@@ -0,0 +1,45 @@
+#ifndef RING_KERNELS_H
+#define RING_KERNELS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef __int128 wide_int;
+
+// v mod q for an integer v with |v| < 2^53: v - q * floor(v / q) is exact up
+// to one step of q either way, and unlike fmod it vectorizes.
+#define REDUCE_MOD(v, q)                                                      \
+  do {                                                                         \
+    (v) -= (q) * floor((v) / (q));                                             \
+    (v) += ((v) < 0.0) ? (q) : 0.0;                                            \
+    (v) -= ((v) >= (q)) ? (q) : 0.0;                                           \
+  } while (0)
+
+// Ring kernels compiled for one fixed degree n of X^n + 1, generated by
+// macro for every power of two from RING_KERNELS_MIN_N to RING_KERNELS_MAX_N.
+// With n a constant every trip count is known, the Karatsuba recursion is a
+// chain of direct calls down to a fully unrolled 16 x 16 schoolbook, and the
+// elementwise loops vectorize without a remainder. ring_utils picks the set
+// for the modulus at hand and falls back to its generic code for other n.
+#define RING_KERNELS_MIN_N 16
+#define RING_KERNELS_MAX_N 8192
+
+typedef struct RingKernels {
+  size_t n;
+  // out = round(x + y) mod q over n coefficients, for integer 1 <= q < 2^52.
+  // `out` may alias x or y. Returns 0, leaving `out` alone, if a coefficient
+  // is 2^51 or more in magnitude.
+  int (*add_mod)(double *out, const double *x, const double *y, double q);
+  // prod[0 .. 2n-2] = a * b exactly. `ws` needs the same workspace as the
+  // generic Karatsuba for n.
+  void (*mul)(wide_int *prod, const int64_t *a, const int64_t *b,
+              unsigned char *ws);
+  // out[i] = prod[i] - prod[n + i] (X^n = -1), reduced into [0, q) unless q
+  // is 0.
+  void (*fold)(double *out, const wide_int *prod, int64_t q);
+} RingKernels;
+
+// The kernels for degree n, or NULL if n has none.
+const RingKernels *ring_kernels_for(size_t n);
+
+#endif
@@ -1,64 +1,412 @@
 #include "ring_utils.h"
+#include "arena.h"
+#include "instrument.h"
 #include "poly_utils.h"
+#include "ring_kernels.h"
+#include <assert.h>
+#include <math.h>
+#include <string.h>
 
-Poly ring_add_mod(Poly x, Poly y, double modulus, Poly poly_mod) {
-  Poly sum = poly_add(x, y);
+// Reducing twice by `modulus` is a no-op after the first pass, so each step
+// below reduces once.
+
+// Karatsuba works on exact integers: int64_t operands and __int128 products,
+// so unlike a double product it has no rounding to compound through its
+// subtractions. Recursion bottoms out in schoolbook below KARATSUBA_CUTOFF
+// coefficients; bench_kernels' ring_mul_mod was flat between 16 and 48 and
+// slower at 8 and 64.
+#define KARATSUBA_CUTOFF 32
+// An operand with at most n / KARATSUBA_SPARSE non-zero coefficients (a
+// plaintext constant, the binary u in encrypt) is cheaper through poly_mul's
+// non-zero prefilter.
+#define KARATSUBA_SPARSE 16
 
-  Poly sum_mod = coeff_mod(sum, modulus);
-  sum_mod = coeff_mod(sum_mod, modulus);
+// r[0 .. 2n-2] = a * b.
+static void schoolbook(wide_int *r, const int64_t *a, const int64_t *b,
+                       size_t n) {
+  for (size_t k = 0; k < 2 * n - 1; k++)
+    r[k] = 0;
+  for (size_t i = 0; i < n; i++)
+    for (size_t j = 0; j < n; j++)
+      r[i + j] += (wide_int)a[i] * b[j];
+}
 
-  Poly quot, rem;
-  poly_divmod(sum_mod, poly_mod, &quot, &rem);
+// r[0 .. 2n-2] = a * b, splitting a = a0 + a1 X^h (likewise b) and forming
+// the middle term as (a0 + a1)(b0 + b1) - a0 b0 - a1 b1. `ws` needs
+// karatsuba_ws(n) bytes.
+static void karatsuba(wide_int *r, const int64_t *a, const int64_t *b,
+                      size_t n, unsigned char *ws) {
+  if (n < KARATSUBA_CUTOFF) {
+    schoolbook(r, a, b, n);
+    return;
+  }
+  size_t h = n / 2;
+  size_t m = n - h;
+  int64_t *sa = (int64_t *)ws;
+  int64_t *sb = sa + m;
+  wide_int *mid = (wide_int *)(sb + m);
+  unsigned char *next = (unsigned char *)(mid + 2 * m - 1);
 
-  Poly rem_mod = coeff_mod(rem, modulus);
-  rem_mod = coeff_mod(rem_mod, modulus);
+  karatsuba(r, a, b, h, next);
+  r[2 * h - 1] = 0;
+  karatsuba(r + 2 * h, a + h, b + h, m, next);
 
-  return rem_mod;
+  for (size_t i = 0; i < m; i++) {
+    sa[i] = a[h + i] + (i < h ? a[i] : 0);
+    sb[i] = b[h + i] + (i < h ? b[i] : 0);
+  }
+  karatsuba(mid, sa, sb, m, next);
+  for (size_t i = 0; i < 2 * h - 1; i++)
+    mid[i] -= r[i];
+  for (size_t i = 0; i < 2 * m - 1; i++)
+    mid[i] -= r[2 * h + i];
+  for (size_t i = 0; i < 2 * m - 1; i++)
+    r[h + i] += mid[i];
 }
 
-Poly ring_mul_mod(Poly x, Poly y, double modulus, Poly poly_mod) {
-  Poly prod = poly_mul(x, y);
+// Workspace bytes for karatsuba(n); `levels` gets the recursion depth.
+static size_t karatsuba_ws(size_t n, int *levels) {
+  size_t total = 0;
+  *levels = 0;
+  while (n >= KARATSUBA_CUTOFF) {
+    size_t m = n - n / 2;
+    total += 2 * m * sizeof(int64_t) + (2 * m - 1) * sizeof(wide_int);
+    n = m;
+    (*levels)++;
+  }
+  return total;
+}
 
-  Poly prod_mod = coeff_mod(prod, modulus);
-  prod_mod = coeff_mod(prod_mod, modulus);
+// Copies p[0 .. n-1] to `out` and returns its number of non-zero terms, or
+// -1 if p is not an integer polynomial of degree < n with every coefficient
+// below 2^`bits` in magnitude.
+static int64_t integer_terms(const Poly *p, size_t n, int bits, int64_t *out,
+                             double *max_abs) {
+  // `degree` can overstate a reduced polynomial (see poly_divmod_into).
+  for (int i = (int)n; i <= p->degree; i++)
+    if (p->coeffs[i] != 0.0)
+      return -1;
+  double limit = ldexp(1.0, bits);
+  int64_t count = 0;
+  *max_abs = 0.0;
+  size_t live = (size_t)p->max_degree + 1 < n ? (size_t)p->max_degree + 1 : n;
+  for (size_t i = 0; i < live; i++) {
+    double v = p->coeffs[i];
+    if (v != round(v) || fabs(v) >= limit)
+      return -1;
+    out[i] = (int64_t)v;
+    count += v != 0.0;
+    if (fabs(v) > *max_abs)
+      *max_abs = fabs(v);
+  }
+  for (size_t i = live; i < n; i++)
+    out[i] = 0;
+  return count;
+}
 
-  Poly quot, rem;
-  poly_divmod(prod_mod, poly_mod, &quot, &rem);
+Poly ring_modulus(size_t n) {
+  Poly poly_mod = create_poly();
+  set_coeff(&poly_mod, 0, 1.0);
+  set_coeff(&poly_mod, (int64_t)n, 1.0);
+  poly_mod.ring_n = (int)n;
+  poly_mod.ring_kernels = ring_kernels_for(n);
+  return poly_mod;
+}
 
-  Poly rem_mod = coeff_mod(rem, modulus);
-  rem_mod = coeff_mod(rem_mod, modulus);
+// Degree n of poly_mod if it is X^n + 1 (the only modulus the library uses),
+// 0 otherwise. O(1) for a modulus from ring_modulus.
+static size_t negacyclic_degree(const Poly *poly_mod) {
+  if (poly_mod->ring_n > 0 && poly_mod->ring_n == poly_mod->degree)
+    return (size_t)poly_mod->ring_n;
+  int n = poly_mod->degree;
+  if (n <= 0 || poly_mod->coeffs[0] != 1.0 || poly_mod->coeffs[n] != 1.0)
+    return 0;
+  for (int i = 1; i < n; i++)
+    if (poly_mod->coeffs[i] != 0.0)
+      return 0;
+  return (size_t)n;
+}
 
-  return rem_mod;
+// The fixed-degree kernels for poly_mod = X^n + 1, or NULL.
+static const RingKernels *modulus_kernels(const Poly *poly_mod, size_t n) {
+  if (poly_mod->ring_n > 0 && (size_t)poly_mod->ring_n == n)
+    return poly_mod->ring_kernels;
+  return ring_kernels_for(n);
 }
 
-Poly ring_mul_no_mod_q(Poly x, Poly y, Poly poly_mod) {
-  Poly prod = poly_mul(x, y);
+// With fixed-degree kernels for X^n + 1 and operands of degree < n, no
+// reduction by poly_mod is needed and one pass of round-and-reduce gives what
+// the generic path below does.
+static int ring_add_fixed(Poly *out, const Poly *x, const Poly *y,
+                          double modulus, const Poly *poly_mod) {
+  size_t n = negacyclic_degree(poly_mod);
+  const RingKernels *kernels = modulus_kernels(poly_mod, n);
+  if (kernels == NULL || x->degree >= (int)n || y->degree >= (int)n ||
+      modulus != round(modulus) || modulus < 1.0 ||
+      modulus >= ldexp(1.0, 52))
+    return 0;
+  size_t mark = scratch_mark();
+  double *buf = (double *)scratch_bytes(2 * n * sizeof(double));
+  const double *xs = poly_dense(x, n, buf);
+  const double *ys = poly_dense(y, n, buf + n);
+  int done = kernels->add_mod(out->coeffs, xs, ys, modulus);
+  if (done)
+    poly_truncate(out, n);
+  scratch_release(mark);
+  return done;
+}
+
+void ring_add_mod_into(Poly *out, const Poly *x, const Poly *y,
+                       double modulus, const Poly *poly_mod) {
+  if (ring_add_fixed(out, x, y, modulus, poly_mod))
+    return;
+  poly_add_into(out, x, y);
+  coeff_mod_into(out, out, modulus);
+  poly_divmod_into(NULL, out, poly_mod);
+  coeff_mod_into(out, out, modulus);
+}
+
+// out = x * y mod poly_mod (and mod `modulus` unless it is 0) for dense
+// integer operands in X^n + 1, through Karatsuba and a negacyclic fold
+// (X^n = -1). The product is exact, so this matches the schoolbook path
+// wherever that one is exact and is closer to the true value where it is not.
+// No modulus here is NTT-friendly, so this is the fast path for all of them.
+// Returns 0, leaving `out` alone, when the operands are sparse, fractional
+// or too large, and the caller falls back to poly_mul's sparse
+// schoolbook and long division.
+static int ring_mul_karatsuba(Poly *out, const Poly *x, const Poly *y,
+                              double modulus, const Poly *poly_mod) {
+  size_t n = negacyclic_degree(poly_mod);
+  if (n == 0)
+    return 0;
+  if (modulus != 0.0 && (modulus != round(modulus) || modulus < 1.0 ||
+                         modulus >= ldexp(1.0, 62)))
+    return 0;
 
-  Poly quot, rem;
-  poly_divmod(prod, poly_mod, &quot, &rem);
+  int levels;
+  size_t ws_bytes = karatsuba_ws(n, &levels);
+  size_t mark = scratch_mark();
+  int64_t *a = (int64_t *)scratch_bytes(2 * n * sizeof(int64_t));
+  int64_t *b = a + n;
+  // Operand sums double in size at every level and must stay in an int64_t.
+  int bits = 62 - levels;
+  int64_t sparse = (int64_t)n / KARATSUBA_SPARSE;
+  double max_a, max_b;
+  if (integer_terms(x, n, bits, a, &max_a) <= sparse ||
+      integer_terms(y, n, bits, b, &max_b) <= sparse ||
+      // Every partial product is at most n * 2^levels * max_a * max_b.
+      (double)n * ldexp(max_a, levels) * max_b >= ldexp(1.0, 126)) {
+    scratch_release(mark);
+    return 0;
+  }
 
-  return rem;
+  assert(out != x && out != y);
+  wide_int *prod = (wide_int *)scratch_bytes((2 * n - 1) * sizeof(wide_int));
+  unsigned char *ws = (unsigned char *)scratch_bytes(ws_bytes);
+  int64_t q = (int64_t)modulus;
+  const RingKernels *kernels = modulus_kernels(poly_mod, n);
+  if (kernels != NULL) {
+    kernels->mul(prod, a, b, ws);
+    kernels->fold(out->coeffs, prod, q);
+  } else {
+    karatsuba(prod, a, b, n, ws);
+    for (size_t i = 0; i < n; i++) {
+      wide_int v = prod[i] - (i + 1 < n ? prod[n + i] : 0);
+      if (q != 0) {
+        v %= q;
+        if (v < 0)
+          v += q;
+      }
+      out->coeffs[i] = (double)v;
+    }
+  }
+  poly_truncate(out, n);
+  scratch_release(mark);
+  return 1;
 }
 
-Poly ring_add_no_mod_q(Poly x, Poly y, Poly poly_mod) {
-  Poly sum = poly_add(x, y);
+void ring_mul_mod_into(Poly *out, const Poly *x, const Poly *y,
+                       double modulus, const Poly *poly_mod) {
+  if (ring_mul_karatsuba(out, x, y, modulus, poly_mod))
+    return;
+  poly_mul_into(out, x, y);
+  coeff_mod_into(out, out, modulus);
+  poly_divmod_into(NULL, out, poly_mod);
+  coeff_mod_into(out, out, modulus);
+}
+
+void ring_mul_no_mod_q_into(Poly *out, const Poly *x, const Poly *y,
+                            const Poly *poly_mod) {
+  if (ring_mul_karatsuba(out, x, y, 0.0, poly_mod))
+    return;
+  poly_mul_into(out, x, y);
+  poly_divmod_into(NULL, out, poly_mod);
+}
 
-  Poly quot, rem;
-  poly_divmod(sum, poly_mod, &quot, &rem);
+void ring_add_no_mod_q_into(Poly *out, const Poly *x, const Poly *y,
+                            const Poly *poly_mod) {
+  poly_add_into(out, x, y);
+  poly_divmod_into(NULL, out, poly_mod);
+}
+
+void ring_scale_mod(double *out, const double *x, double k, double q,
+                    size_t n) {
+  INSTR_BEGIN();
+#pragma omp simd
+  for (size_t c = 0; c < n; c++) {
+    double v = k * x[c];
+    REDUCE_MOD(v, q);
+    out[c] = v;
+  }
+  INSTR_END(INSTR_RING_SCALE, INSTR_COEFF_BYTES(2 * n));
+}
+
+void ring_axpy_mod(double *restrict acc, const double *restrict x, double k,
+                   double q, size_t n) {
+  INSTR_BEGIN();
+#pragma omp simd
+  for (size_t c = 0; c < n; c++) {
+    double v = k * x[c];
+    REDUCE_MOD(v, q);
+    v += acc[c];
+    v -= (v >= q) ? q : 0.0;
+    acc[c] = v;
+  }
+  INSTR_END(INSTR_RING_AXPY, INSTR_COEFF_BYTES(3 * n));
+}
 
-  return rem;
+int ternary_from_poly(TernaryPoly *out, const Poly *p, size_t n) {
+  for (int i = (int)n; i <= p->degree; i++)
+    if (p->coeffs[i] != 0.0)
+      return -1;
+  out->n = n;
+  out->count = 0;
+  size_t live = (size_t)p->max_degree + 1 < n ? (size_t)p->max_degree + 1 : n;
+  for (size_t i = 0; i < live; i++) {
+    double v = p->coeffs[i];
+    if (v == 0.0)
+      continue;
+    if (v != 1.0 && v != -1.0)
+      return -1;
+    out->index[out->count] = (int32_t)i;
+    out->sign[out->count] = v > 0.0 ? 1 : -1;
+    out->count++;
+  }
+  return 0;
+}
+
+// lo[k] += (x * s)[k] for degrees k < n, hi[k] += (x * s)[n + k]. The terms
+// of s are visited from the top so each coefficient sums its terms in the
+// same order as poly_mul, which matters when x is fractional.
+static void ternary_accumulate(double *restrict lo, double *restrict hi,
+                               const double *x, const TernaryPoly *s) {
+  size_t n = s->n;
+  for (size_t k = s->count; k-- > 0;) {
+    size_t j = (size_t)s->index[k];
+    size_t split = n - j;
+    if (s->sign[k] > 0) {
+#pragma omp simd
+      for (size_t i = 0; i < split; i++)
+        lo[i + j] += x[i];
+#pragma omp simd
+      for (size_t i = split; i < n; i++)
+        hi[i - split] += x[i];
+    } else {
+#pragma omp simd
+      for (size_t i = 0; i < split; i++)
+        lo[i + j] -= x[i];
+#pragma omp simd
+      for (size_t i = split; i < n; i++)
+        hi[i - split] -= x[i];
+    }
+  }
+}
+
+void ring_mul_ternary_into(Poly *out, const Poly *x, const TernaryPoly *s,
+                           double modulus) {
+  size_t n = s->n;
+  assert(out != x);
+  // Each coefficient sums up to n terms of x. With x reduced mod `modulus`
+  // the sums are exact integers only while n * modulus stays below 2^53.
+  assert(modulus == 0.0 || (double)n * modulus < (double)(1ll << 53));
+  size_t mark = scratch_mark();
+  double *lo = out->coeffs;
+  double *hi = (double *)scratch_bytes(2 * n * sizeof(double));
+  const double *xs = poly_dense(x, n, hi + n);
+  memset(lo, 0, n * sizeof(double));
+  memset(hi, 0, n * sizeof(double));
+  ternary_accumulate(lo, hi, xs, s);
+  // X^n = -1. The general path rounds the product, then (when reducing)
+  // takes it mod q and subtracts the top half; without a modulus only the
+  // top half is rounded, by poly_divmod_into.
+  for (size_t i = 0; i < n; i++) {
+    if (modulus != 0.0)
+      lo[i] = positive_fmod(round(lo[i]) - round(hi[i]), modulus);
+    else
+      lo[i] -= round(hi[i]);
+  }
+  poly_truncate(out, n);
+  scratch_release(mark);
+}
+
+void ring_mul_small_into(Poly *out, const Poly *x, const Poly *s,
+                         double modulus, const Poly *poly_mod) {
+  size_t n = negacyclic_degree(poly_mod);
+  size_t mark = scratch_mark();
+  TernaryPoly *ts = (TernaryPoly *)scratch_bytes(sizeof(TernaryPoly));
+  if (n > 0 && x->degree < (int)n && ternary_from_poly(ts, s, n) == 0)
+    ring_mul_ternary_into(out, x, ts, modulus);
+  else if (modulus != 0.0)
+    ring_mul_mod_into(out, x, s, modulus, poly_mod);
+  else
+    ring_mul_no_mod_q_into(out, x, s, poly_mod);
+  scratch_release(mark);
+}
+
+void ring_automorphism_into(Poly *out, const Poly *x, size_t g,
+                            double modulus, size_t n) {
+  assert(out != x && g % 2 == 1);
+  size_t live = (size_t)x->max_degree + 1 < n ? (size_t)x->max_degree + 1 : n;
+  memset(out->coeffs, 0, n * sizeof(double));
+  for (size_t i = 0; i < live; i++) {
+    size_t j = (i * g) % (2 * n);
+    double v = x->coeffs[i];
+    if (j < n)
+      out->coeffs[j] = v;
+    else if (v != 0.0)
+      out->coeffs[j - n] = modulus != 0.0 ? modulus - v : -v;
+  }
+  poly_truncate(out, n);
+}
+
+Poly ring_add_mod(Poly x, Poly y, double modulus, Poly poly_mod) {
+  Poly out;
+  ring_add_mod_into(&out, &x, &y, modulus, &poly_mod);
+  return out;
+}
+
+Poly ring_mul_mod(Poly x, Poly y, double modulus, Poly poly_mod) {
+  Poly out;
+  ring_mul_mod_into(&out, &x, &y, modulus, &poly_mod);
+  return out;
+}
+
+Poly ring_mul_no_mod_q(Poly x, Poly y, Poly poly_mod) {
+  Poly out;
+  ring_mul_no_mod_q_into(&out, &x, &y, &poly_mod);
+  return out;
+}
+
+Poly ring_add_no_mod_q(Poly x, Poly y, Poly poly_mod) {
+  Poly out;
+  ring_add_no_mod_q_into(&out, &x, &y, &poly_mod);
+  return out;
 }
 
 Poly ring_mul_poly_mod(Poly x, Poly y, Poly poly_mod) {
-  Poly prod = poly_mul(x, y);
-  Poly quot, rem;
-  poly_divmod(prod, poly_mod, &quot, &rem);
-  return rem;
+  return ring_mul_no_mod_q(x, y, poly_mod);
 }
 
 Poly ring_add_poly_mod(Poly x, Poly y, Poly poly_mod) {
-  Poly sum = poly_add(x, y);
-  Poly quot, rem;
-  poly_divmod(sum, poly_mod, &quot, &rem);
-  return rem;
-}
\ No newline at end of file
+  return ring_add_no_mod_q(x, y, poly_mod);
+}
@@ -4,6 +4,12 @@
 #include "types.h"
 #include <stdint.h>
 
+// X^n + 1, the modulus of every ring here. The result carries n and its
+// fixed-degree kernels (see Poly.ring_n), so the ring operations below pick
+// their path from the modulus in O(1). Any other poly_mod, including X^n + 1
+// built with set_coeff, is scanned on every call instead.
+Poly ring_modulus(size_t n);
+
 Poly ring_add_mod(Poly x, Poly y, double modulus, Poly poly_mod);
 
 Poly ring_mul_mod(Poly x, Poly y, double modulus, Poly poly_mod);
@@ -16,4 +22,60 @@ Poly ring_add_poly_mod(Poly x, Poly y, Poly poly_mod);
 
 Poly ring_mul_poly_mod(Poly x, Poly y, Poly poly_mod);
 
+// Pointer-based forms. `out` may alias an input for the additions but not
+// for the multiplications.
+void ring_add_mod_into(Poly *out, const Poly *x, const Poly *y,
+                       double modulus, const Poly *poly_mod);
+
+void ring_mul_mod_into(Poly *out, const Poly *x, const Poly *y,
+                       double modulus, const Poly *poly_mod);
+
+void ring_mul_no_mod_q_into(Poly *out, const Poly *x, const Poly *y,
+                            const Poly *poly_mod);
+
+void ring_add_no_mod_q_into(Poly *out, const Poly *x, const Poly *y,
+                            const Poly *poly_mod);
+
+// Unit-stride kernels over n packed coefficients, for the batched and matrix
+// code paths. Inputs are integers in [0, q) and every intermediate stays below
+// 2^53, so results match coeff_mod exactly. `out` may alias `x`.
+// out = k * x mod q
+void ring_scale_mod(double *out, const double *x, double k, double q,
+                    size_t n);
+
+// acc = (acc + k * x) mod q
+void ring_axpy_mod(double *acc, const double *x, double k, double q,
+                   size_t n);
+
+// A polynomial with coefficients in {-1, 0, 1} (binary and ternary secrets,
+// the u in encryption) as the list of its non-zero terms, so that products
+// with it are shifted adds and subtracts. Indices are ascending.
+typedef struct {
+  size_t n;
+  size_t count;
+  int32_t index[MAX_POLY_DEGREE];
+  int8_t sign[MAX_POLY_DEGREE];
+} TernaryPoly;
+
+// Returns 0 on success, -1 if p has a coefficient outside {-1, 0, 1} or a
+// term of degree n or more.
+int ternary_from_poly(TernaryPoly *out, const Poly *p, size_t n);
+
+// out = x * s mod X^n + 1, reduced mod `modulus` unless it is 0. Rounds like
+// ring_mul_mod / ring_mul_no_mod_q, so fractional x give the same result as
+// the general path. x must have degree < n and `out` must not alias it.
+void ring_mul_ternary_into(Poly *out, const Poly *x, const TernaryPoly *s,
+                           double modulus);
+
+// x * s mod poly_mod (and mod `modulus` unless it is 0) for a secret-like s:
+// ring_mul_ternary_into when s is ternary, the general path otherwise.
+void ring_mul_small_into(Poly *out, const Poly *x, const Poly *s,
+                         double modulus, const Poly *poly_mod);
+
+// out(X) = x(X^g) mod X^n + 1 for odd g: coefficient i moves to i*g mod 2n,
+// negated (mod `modulus` unless it is 0) when that wraps past n. `out` must
+// not alias x.
+void ring_automorphism_into(Poly *out, const Poly *x, size_t g,
+                            double modulus, size_t n);
+
 #endif
\ No newline at end of file
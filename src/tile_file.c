@@ -0,0 +1,165 @@
+#define _POSIX_C_SOURCE 200809L
+#include "tile_file.h"
+#include "he.h"
+#include <fcntl.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+// Page aligned, as O_DIRECT would need.
+#define TILE_FILE_ALIGN 4096
+
+static double now_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Waits for buffer k's request and frees the buffer. Returns 0, or -1 if the
+// transfer fell short.
+static int settle(TileFile *f, int k) {
+  if (f->state[k] == TILE_BUFFER_FREE)
+    return 0;
+  ssize_t got = async_io_wait(f->io, &f->req[k]);
+  int ok = got == (ssize_t)f->req[k].len;
+  if (!ok && f->state[k] == TILE_BUFFER_WRITING)
+    f->failed = 1;
+  f->state[k] = TILE_BUFFER_FREE;
+  return ok ? 0 : -1;
+}
+
+static int find(const TileFile *f, TileBufferState state, size_t slot) {
+  for (int k = 0; k < TILE_FILE_BUFFERS; k++)
+    if (f->state[k] == state && f->slot[k] == slot)
+      return k;
+  return -1;
+}
+
+// A free buffer, waiting for a write to finish if need be, or -1 if every
+// buffer holds a read ahead.
+static int take_buffer(TileFile *f) {
+  for (int k = 0; k < TILE_FILE_BUFFERS; k++)
+    if (f->state[k] == TILE_BUFFER_FREE)
+      return k;
+  for (int k = 0; k < TILE_FILE_BUFFERS; k++) {
+    if (f->state[k] == TILE_BUFFER_WRITING) {
+      settle(f, k);
+      return k;
+    }
+  }
+  return -1;
+}
+
+static off_t slot_offset(const TileFile *f, size_t slot) {
+  return (off_t)(slot * f->slot_bytes);
+}
+
+int tile_file_open(TileFile *f, AsyncIO *io, const char *path, size_t n,
+                   double q, size_t slot_cts) {
+  f->io = io;
+  f->n = n;
+  f->q = q;
+  f->ct_bytes = ciphertext_wire_size(n, q);
+  f->slot_bytes = slot_cts * f->ct_bytes;
+  f->failed = 0;
+  f->wait_seconds = 0.0;
+  for (int k = 0; k < TILE_FILE_BUFFERS; k++) {
+    f->buf[k] = NULL;
+    f->state[k] = TILE_BUFFER_FREE;
+  }
+  f->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+  if (f->fd < 0)
+    return -1;
+  for (int k = 0; k < TILE_FILE_BUFFERS; k++) {
+    void *buf = NULL;
+    if (posix_memalign(&buf, TILE_FILE_ALIGN,
+                       f->slot_bytes > 0 ? f->slot_bytes : 1) != 0) {
+      tile_file_close(f);
+      return -1;
+    }
+    f->buf[k] = (unsigned char *)buf;
+  }
+  return 0;
+}
+
+int tile_file_close(TileFile *f) {
+  for (int k = 0; k < TILE_FILE_BUFFERS; k++) {
+    settle(f, k);
+    free(f->buf[k]);
+    f->buf[k] = NULL;
+  }
+  if (f->fd >= 0 && close(f->fd) != 0)
+    f->failed = 1;
+  f->fd = -1;
+  return f->failed ? -1 : 0;
+}
+
+int tile_file_write(TileFile *f, size_t slot, Ciphertext *cts, size_t count) {
+  if (count * f->ct_bytes > f->slot_bytes || f->failed)
+    return -1;
+  // A read ahead of this slot would race the write; drop it.
+  int k = find(f, TILE_BUFFER_READING, slot);
+  if (k >= 0)
+    settle(f, k);
+  k = take_buffer(f);
+  if (k < 0) {
+    k = 0;
+    settle(f, k);
+  }
+  size_t len = serialize_ciphertexts(cts, count, f->n, f->q, f->buf[k]);
+  if (async_io_write(f->io, &f->req[k], f->fd, f->buf[k], len,
+                     slot_offset(f, slot)) < 0)
+    return -1;
+  f->state[k] = TILE_BUFFER_WRITING;
+  f->slot[k] = slot;
+  return 0;
+}
+
+static int start_read(TileFile *f, int k, size_t slot, size_t count) {
+  if (async_io_read(f->io, &f->req[k], f->fd, f->buf[k], count * f->ct_bytes,
+                    slot_offset(f, slot)) < 0)
+    return -1;
+  f->state[k] = TILE_BUFFER_READING;
+  f->slot[k] = slot;
+  return 0;
+}
+
+int tile_file_prefetch(TileFile *f, size_t slot, size_t count) {
+  if (count * f->ct_bytes > f->slot_bytes)
+    return -1;
+  if (find(f, TILE_BUFFER_READING, slot) >= 0)
+    return 0;
+  // Reads are not ordered after writes in flight, so finish any to this slot.
+  int k = find(f, TILE_BUFFER_WRITING, slot);
+  if (k >= 0 && settle(f, k) < 0)
+    return -1;
+  k = take_buffer(f);
+  return k < 0 ? 0 : start_read(f, k, slot, count);
+}
+
+int tile_file_read(TileFile *f, size_t slot, Ciphertext *cts, size_t count) {
+  int k = find(f, TILE_BUFFER_READING, slot);
+  if (k >= 0 && f->req[k].len != count * f->ct_bytes) {
+    settle(f, k);
+    k = -1;
+  }
+  if (k < 0) {
+    if (tile_file_prefetch(f, slot, count) < 0)
+      return -1;
+    k = find(f, TILE_BUFFER_READING, slot);
+    if (k < 0) {
+      // Every buffer holds a read ahead of another slot.
+      k = 0;
+      settle(f, k);
+      if (start_read(f, k, slot, count) < 0)
+        return -1;
+    }
+  }
+  double start = now_seconds();
+  int rc = settle(f, k);
+  f->wait_seconds += now_seconds() - start;
+  if (rc < 0)
+    return -1;
+  deserialize_ciphertexts(f->buf[k], count, f->n, f->q, cts);
+  return 0;
+}
@@ -0,0 +1,67 @@
+#ifndef TILE_FILE_H
+#define TILE_FILE_H
+
+#include "async_io.h"
+#include "types.h"
+#include <stddef.h>
+
+// Encrypted tiles kept in a file, one fixed-size slot per tile holding its
+// ciphertexts in wire format (serialize_ciphertexts, so noise estimates are
+// not kept). Reads and writes go through an AsyncIO with TILE_FILE_BUFFERS
+// staging buffers, so the next tile can be read ahead and the last one
+// written behind while the caller evaluates the current one:
+//
+//   tile_file_prefetch(&in, 0, count);
+//   for (size_t i = 0; i < tiles; i++) {
+//     tile_file_read(&in, i, cts, count); // waits for the prefetch
+//     tile_file_prefetch(&in, i + 1, count);
+//     ... evaluate cts into results ...
+//     tile_file_write(&out, i, results, count); // returns once serialized
+//   }
+//   tile_file_close(&out);
+#define TILE_FILE_BUFFERS 2
+
+typedef enum {
+  TILE_BUFFER_FREE,
+  TILE_BUFFER_READING,
+  TILE_BUFFER_WRITING,
+} TileBufferState;
+
+typedef struct {
+  AsyncIO *io;
+  int fd;
+  size_t n;
+  double q;
+  size_t ct_bytes;
+  size_t slot_bytes;
+  unsigned char *buf[TILE_FILE_BUFFERS];
+  AsyncRequest req[TILE_FILE_BUFFERS];
+  TileBufferState state[TILE_FILE_BUFFERS];
+  size_t slot[TILE_FILE_BUFFERS];
+  int failed;          // a write failed; reported by tile_file_close
+  double wait_seconds; // time tile_file_read spent waiting for data
+} TileFile;
+
+// Creates (or truncates) `path` for slots of up to `slot_cts` ciphertexts of
+// degree n mod q. `io` must outlive the file. Returns 0, or -1 if the file or
+// buffers could not be set up.
+int tile_file_open(TileFile *f, AsyncIO *io, const char *path, size_t n,
+                   double q, size_t slot_cts);
+
+// Waits for pending writes and closes the file. Returns 0, or -1 if a write
+// failed.
+int tile_file_close(TileFile *f);
+
+// Serializes cts[0 .. count) and starts writing them to `slot`. cts may be
+// reused once this returns. Returns 0, or -1 on failure.
+int tile_file_write(TileFile *f, size_t slot, Ciphertext *cts, size_t count);
+
+// Starts reading `count` ciphertexts of `slot` into a free buffer, if there is
+// one. Returns 0, or -1 on failure.
+int tile_file_prefetch(TileFile *f, size_t slot, size_t count);
+
+// cts[0 .. count) = the ciphertexts of `slot`, waiting for its prefetch or
+// reading it now. Returns 0, or -1 on failure.
+int tile_file_read(TileFile *f, size_t slot, Ciphertext *cts, size_t count);
+
+#endif
@@ -6,10 +6,18 @@
 
 #define MAX_POLY_DEGREE 10000
 
+struct RingKernels;
+
 typedef struct {
   double coeffs[MAX_POLY_DEGREE];
   int degree;
   int max_degree;
+  // Set only on a modulus from ring_modulus: its n and the fixed-degree ring
+  // kernels for it (NULL if n has none), resolved once so ring operations
+  // need not scan the modulus. ring_n is 0 on every other polynomial;
+  // create_poly, set_coeff, poly_zero and poly_truncate clear it.
+  int ring_n;
+  const struct RingKernels *ring_kernels;
 } Poly;
 
 typedef struct {
@@ -19,15 +27,19 @@ typedef struct {
 
 typedef Poly SecretKey;
 
+// `noise` is a running estimate of the largest noise coefficient, updated by
+// every evaluation call (NAN when unknown, e.g. after deserialization).
 typedef struct {
   Poly c0;
   Poly c1;
+  double noise;
 } Ciphertext;
 
 typedef struct {
   Poly c0;
   Poly c1;
   Poly c2;
+  double noise;
 } Ciphertext3;
 
 typedef struct {
@@ -35,4 +47,26 @@ typedef struct {
   Poly b;
 } EvalKey;
 
+// Relinearization key for base-w digit decomposition: for i < count,
+// b[i] = w^i * s^2 - a[i]*s - e[i] mod q. The arrays are heap allocated
+// (see evaluate_keygen_digits and digit_eval_key_free).
+typedef struct {
+  size_t count;
+  double w;
+  Poly *a;
+  Poly *b;
+} DigitEvalKey;
+
+// A complete parameter set: ring degree n (poly_mod = X^n + 1), ciphertext
+// modulus q, plaintext modulus t and relinearization special modulus p
+// (0 when no relinearization key is needed). A non-zero digit base w selects
+// base-w decomposition keys (DigitEvalKey) for relinearization instead of p.
+typedef struct {
+  size_t n;
+  double q;
+  double t;
+  double p;
+  double w;
+} HEParams;
+
 #endif
\ No newline at end of file
@@ -0,0 +1,166 @@
+#include "../src/circuit.h"
+#include "../src/he.h"
+#include "../src/poly_utils.h"
+#include "../src/ring_utils.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Runs circuits with products through circuit_optimize and circuit_run and
+// checks the decrypted outputs against the same circuit on plaintexts. Each
+// case also states how many relinearized products (CIRCUIT_MUL) and sums of
+// deferred products (CIRCUIT_MUL_SUM) the optimized circuit must keep, so a
+// rewrite that stops sharing or deferring products fails here too.
+
+#define MAX_INPUTS 6
+#define MAX_OUTPUTS 3
+#define TRIALS 4
+
+typedef struct {
+  const char *name;
+  int inputs;
+  int outputs;
+  // Records the outputs over input handles in[].
+  void (*record)(Circuit *c, const int *in);
+  // The same outputs mod t.
+  void (*plain)(const int64_t *x, int64_t *out, int64_t t);
+  size_t muls;
+  size_t mul_sums;
+} CircuitCase;
+
+// a*b + c*d + e*f: three products with one relinearization.
+static void record_sum_of_products(Circuit *c, const int *in) {
+  int ab = circuit_mul(c, in[0], in[1]);
+  int cd = circuit_mul(c, in[2], in[3]);
+  int ef = circuit_mul(c, in[4], in[5]);
+  circuit_output(c, circuit_add(c, circuit_add(c, ab, cd), ef));
+}
+
+static void plain_sum_of_products(const int64_t *x, int64_t *out, int64_t t) {
+  out[0] = (x[0] * x[1] + x[2] * x[3] + x[4] * x[5]) % t;
+}
+
+// x*x and (x + y)^2 + x*y: squares, where both operands are one value.
+static void record_squares(Circuit *c, const int *in) {
+  circuit_output(c, circuit_mul(c, in[0], in[0]));
+  int s = circuit_add(c, in[0], in[1]);
+  int xy = circuit_mul(c, in[0], in[1]);
+  circuit_output(c, circuit_add(c, circuit_mul(c, s, s), xy));
+}
+
+static void plain_squares(const int64_t *x, int64_t *out, int64_t t) {
+  out[0] = x[0] * x[0] % t;
+  int64_t s = (x[0] + x[1]) % t;
+  out[1] = (s * s + x[0] * x[1]) % t;
+}
+
+// (2a)*b + c, a*(3b) - c and (a*b)*5: the scalars come out of the products,
+// so all three share one a*b.
+static void record_shared_product(Circuit *c, const int *in) {
+  int a2 = circuit_scale(c, in[0], 2);
+  int b3 = circuit_scale(c, in[1], 3);
+  circuit_output(c, circuit_add(c, circuit_mul(c, a2, in[1]), in[2]));
+  circuit_output(c, circuit_sub(c, circuit_mul(c, in[0], b3), in[2]));
+  circuit_output(c, circuit_scale(c, circuit_mul(c, in[0], in[1]), 5));
+}
+
+static void plain_shared_product(const int64_t *x, int64_t *out, int64_t t) {
+  int64_t ab = x[0] * x[1] % t;
+  out[0] = (2 * ab + x[2]) % t;
+  out[1] = ((3 * ab - x[2]) % t + t) % t;
+  out[2] = 5 * ab % t;
+}
+
+static const CircuitCase cases[] = {
+    {"sum of products", 6, 1, record_sum_of_products, plain_sum_of_products,
+     0, 1},
+    {"squares", 2, 2, record_squares, plain_squares, 1, 1},
+    {"shared product", 3, 3, record_shared_product, plain_shared_product, 1,
+     0},
+};
+#define NUM_CASES (sizeof(cases) / sizeof(cases[0]))
+
+// Operations of type `op` left in the optimized circuit.
+static size_t count_ops(const Circuit *c, CircuitOp op) {
+  size_t count = 0;
+  for (size_t i = 0; i < circuit_op_count(c); i++)
+    if (c->nodes[c->order[i]].op == op)
+      count++;
+  return count;
+}
+
+// Runs one case with the p-modulus key, or with digit_rlk when it is set.
+// Returns 1 if every output decrypts to its plaintext value.
+static int run_case(const CircuitCase *cc, size_t n, double q, double t,
+                    Poly poly_mod, const KeyPair *keys, const EvalKey *rlk,
+                    double p, const DigitEvalKey *digit_rlk) {
+  Circuit c;
+  circuit_init(&c);
+  int in[MAX_INPUTS];
+  for (int i = 0; i < cc->inputs; i++)
+    in[i] = circuit_input(&c);
+  cc->record(&c, in);
+  if (circuit_optimize(&c, t) < 0) {
+    circuit_free(&c);
+    return 0;
+  }
+  int ok = count_ops(&c, CIRCUIT_MUL) == cc->muls &&
+           count_ops(&c, CIRCUIT_MUL_SUM) == cc->mul_sums;
+
+  CircuitEval eval = {q, t, &poly_mod, p, rlk, digit_rlk, 0};
+  Ciphertext *cts = (Ciphertext *)malloc((MAX_INPUTS + MAX_OUTPUTS) *
+                                         sizeof(Ciphertext));
+  Ciphertext *outputs = &cts[MAX_INPUTS];
+  for (int trial = 0; trial < TRIALS && ok; trial++) {
+    int64_t x[MAX_INPUTS], expected[MAX_OUTPUTS];
+    for (int i = 0; i < cc->inputs; i++) {
+      x[i] = rand() % (int64_t)t;
+      cts[i] = encrypt(keys->pk, n, q, poly_mod, t, (double)x[i]);
+    }
+    cc->plain(x, expected, (int64_t)t);
+    if (circuit_run(&c, &eval, cts, outputs) < 0) {
+      ok = 0;
+      break;
+    }
+    for (int o = 0; o < cc->outputs; o++)
+      if ((int64_t)decrypt(keys->sk, n, q, poly_mod, t, outputs[o]) !=
+          expected[o])
+        ok = 0;
+  }
+  free(cts);
+  circuit_free(&c);
+  return ok;
+}
+
+int main() {
+  size_t n = 16;
+  double q = 4294967296.0; // 2^32
+  double t = 256.0;
+  double p = q * q;
+  Poly poly_mod = ring_modulus(n);
+
+  srand(7);
+  KeyPair keys = keygen(n, q, poly_mod);
+  EvalKey rlk = evaluate_keygen(keys.sk, n, q, poly_mod, p);
+  DigitEvalKey digit_rlk;
+  if (evaluate_keygen_digits(&digit_rlk, keys.sk, n, q, poly_mod, 256.0) <
+      0) {
+    fprintf(stderr, "Failed to allocate relinearization key\n");
+    return 1;
+  }
+
+  int failures = 0;
+  for (size_t i = 0; i < NUM_CASES; i++) {
+    for (int digits = 0; digits <= 1; digits++) {
+      int ok = run_case(&cases[i], n, q, t, poly_mod, &keys, &rlk, p,
+                        digits ? &digit_rlk : NULL);
+      printf("[%s] %s, %s relinearization\n", ok ? "OK" : "FAIL",
+             cases[i].name, digits ? "digit" : "p-modulus");
+      if (!ok)
+        failures++;
+    }
+  }
+  digit_eval_key_free(&digit_rlk);
+  return failures == 0 ? 0 : 1;
+}
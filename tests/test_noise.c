@@ -0,0 +1,211 @@
+#include "../src/he.h"
+#include "../src/he_params.h"
+#include "../src/poly_utils.h"
+#include "../src/ring_utils.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Checks that the static noise estimate is a bound: for every result,
+// noise_budget_estimate must not exceed the budget noise_budget measures,
+// and a result with a positive estimate must decrypt correctly.
+// Each case runs a few key pairs (the noise of ciphertexts under one key is
+// correlated, so one key is not enough) and several trials per key.
+
+#define KEYS 3
+#define TRIALS 6
+
+typedef enum { CASE_SUM_PLAIN, CASE_MUL, CASE_DOT, CASE_DOT_DIGITS } CaseKind;
+
+typedef struct {
+  const char *name;
+  CaseKind kind;
+  size_t n;
+  int log_q;
+  int terms;
+} NoiseCase;
+
+static const NoiseCase cases[] = {
+    {"sum of ct*pt", CASE_SUM_PLAIN, 16, 32, 32},
+    {"sum of ct*pt", CASE_SUM_PLAIN, 64, 32, 32},
+    {"ct*ct", CASE_MUL, 16, 32, 1},
+    {"ct*ct", CASE_MUL, 64, 32, 1},
+    {"ct*ct", CASE_MUL, 64, 34, 1},
+    {"ct*ct dot product", CASE_DOT, 16, 32, 8},
+    {"ct*ct dot product", CASE_DOT, 16, 32, 32},
+    {"ct*ct dot product", CASE_DOT, 64, 34, 8},
+    {"ct*ct dot product, digit relin", CASE_DOT_DIGITS, 16, 32, 8},
+    {"ct*ct dot product, digit relin", CASE_DOT_DIGITS, 64, 36, 8},
+};
+#define NUM_CASES (sizeof(cases) / sizeof(cases[0]))
+
+// Worst (estimated - measured) over the case's trials, in bits; positive
+// means the estimate promised budget that was not there. Sets *wrong when a
+// result with a positive estimate fails to decrypt.
+static double run_case(const NoiseCase *c, int *wrong) {
+  size_t n = c->n;
+  double q = ldexp(1.0, c->log_q);
+  double t = 256.0;
+  double p = q * q;
+  double w = 256.0;
+  Poly poly_mod = ring_modulus(n);
+
+  Ciphertext *work = (Ciphertext *)malloc(4 * sizeof(Ciphertext));
+  Ciphertext3 *work3 = (Ciphertext3 *)malloc(2 * sizeof(Ciphertext3));
+  Ciphertext *a = &work[0], *b = &work[1], *prod = &work[2], *acc = &work[3];
+  Ciphertext3 *term = &work3[0], *acc3 = &work3[1];
+
+  double worst = -INFINITY;
+  for (int key = 0; key < KEYS; key++) {
+    srand(1000 * (unsigned)n + 10 * (unsigned)c->kind + (unsigned)key);
+    KeyPair keys = keygen(n, q, poly_mod);
+    EvalKey rlk;
+    DigitEvalKey digit_rlk = {0, 0.0, NULL, NULL};
+    if (c->kind == CASE_MUL || c->kind == CASE_DOT)
+      rlk = evaluate_keygen(keys.sk, n, q, poly_mod, p);
+    if (c->kind == CASE_DOT_DIGITS &&
+        evaluate_keygen_digits(&digit_rlk, keys.sk, n, q, poly_mod, w) < 0) {
+      fprintf(stderr, "Failed to allocate relinearization key\n");
+      exit(1);
+    }
+
+    for (int trial = 0; trial < TRIALS; trial++) {
+      int64_t expected = 0;
+      for (int j = 0; j < c->terms; j++) {
+        int64_t x = rand() % (int64_t)t;
+        int64_t y = rand() % (int64_t)t;
+        expected = (expected + x * y) % (int64_t)t;
+        *a = encrypt(keys.pk, n, q, poly_mod, t, (double)x);
+        switch (c->kind) {
+        case CASE_SUM_PLAIN:
+          mul_plain_into(prod, a, q, t, &poly_mod, (double)y);
+          if (j == 0)
+            *acc = *prod;
+          else
+            add_cipher_into(acc, acc, prod, q, &poly_mod);
+          break;
+        case CASE_MUL:
+          *b = encrypt(keys.pk, n, q, poly_mod, t, (double)y);
+          *acc = mul_cipher(*a, *b, q, t, p, poly_mod, rlk);
+          break;
+        case CASE_DOT:
+        case CASE_DOT_DIGITS:
+          *b = encrypt(keys.pk, n, q, poly_mod, t, (double)y);
+          mul_cipher_no_relin(j == 0 ? acc3 : term, a, b, q, t, &poly_mod);
+          if (j > 0)
+            add_cipher3(acc3, term, q, &poly_mod);
+          break;
+        }
+      }
+      if (c->kind == CASE_DOT)
+        relinearize(acc, acc3, q, p, &poly_mod, &rlk);
+      if (c->kind == CASE_DOT_DIGITS)
+        relinearize_digits(acc, acc3, q, &poly_mod, &digit_rlk);
+
+      double estimated = noise_budget_estimate(*acc, q, t);
+      if (estimated > 0.0 &&
+          (int64_t)decrypt(keys.sk, n, q, poly_mod, t, *acc) != expected)
+        *wrong = 1;
+      double measured = noise_budget(keys.sk, n, q, poly_mod, t, *acc);
+      if (estimated - measured > worst)
+        worst = estimated - measured;
+    }
+    digit_eval_key_free(&digit_rlk);
+  }
+  free(work);
+  free(work3);
+  return worst;
+}
+
+// A deserialized ciphertext has no noise estimate: its budget must come out
+// unknown (NaN), not as the largest possible budget.
+static int check_deserialized_unknown(void) {
+  size_t n = 16;
+  double q = ldexp(1.0, 32);
+  double t = 256.0;
+  Poly poly_mod = ring_modulus(n);
+  srand(1);
+  KeyPair keys = keygen(n, q, poly_mod);
+
+  Ciphertext *cts = (Ciphertext *)malloc(2 * sizeof(Ciphertext));
+  uint8_t *buf = (uint8_t *)malloc(ciphertext_wire_size(n, q));
+  cts[0] = encrypt(keys.pk, n, q, poly_mod, t, 7.0);
+  serialize_ciphertexts(&cts[0], 1, n, q, buf);
+  deserialize_ciphertexts(buf, 1, n, q, &cts[1]);
+  int ok = isnan(noise_budget_estimate(cts[1], q, t)) &&
+           (int64_t)decrypt(keys.sk, n, q, poly_mod, t, cts[1]) == 7;
+  printf("[%s] deserialized ciphertext: estimate unknown\n",
+         ok ? "OK" : "FAIL");
+  free(cts);
+  free(buf);
+  return ok;
+}
+
+// The planner must accept bench_matmul's default mode-1 circuit, a 32-term
+// ct*ct dot product with t = 256, and plan the budget the evaluation then
+// reports for it.
+static int check_planner(void) {
+  CircuitSpec spec = {.t = 256.0, .depth = 1, .fan_in = 32, .margin = 1.0};
+  HEParams params;
+  if (plan_params(spec, &params) < 0) {
+    printf("[FAIL] planner: no parameters for a 32-term ct*ct dot product\n");
+    return 0;
+  }
+  size_t n = params.n;
+  double q = params.q, t = params.t;
+  Poly poly_mod = params_poly_mod(params);
+  srand(2);
+  KeyPair keys = keygen(n, q, poly_mod);
+  EvalKey rlk = evaluate_keygen(keys.sk, n, q, poly_mod, params.p);
+
+  Ciphertext *work = (Ciphertext *)malloc(3 * sizeof(Ciphertext));
+  Ciphertext3 *work3 = (Ciphertext3 *)malloc(2 * sizeof(Ciphertext3));
+  Ciphertext *a = &work[0], *b = &work[1], *acc = &work[2];
+  Ciphertext3 *term = &work3[0], *acc3 = &work3[1];
+  int64_t expected = 0;
+  for (int j = 0; j < spec.fan_in; j++) {
+    int64_t x = rand() % (int64_t)t;
+    int64_t y = rand() % (int64_t)t;
+    expected = (expected + x * y) % (int64_t)t;
+    *a = encrypt(keys.pk, n, q, poly_mod, t, (double)x);
+    *b = encrypt(keys.pk, n, q, poly_mod, t, (double)y);
+    mul_cipher_no_relin(j == 0 ? acc3 : term, a, b, q, t, &poly_mod);
+    if (j > 0)
+      add_cipher3(acc3, term, q, &poly_mod);
+  }
+  relinearize(acc, acc3, q, params.p, &poly_mod, &rlk);
+
+  double planned = plan_budget(spec, params);
+  double estimated = noise_budget_estimate(*acc, q, t);
+  int ok = fabs(planned - estimated) < 1e-9 &&
+           (int64_t)decrypt(keys.sk, n, q, poly_mod, t, *acc) == expected;
+  printf("[%s] planner: 32-term ct*ct dot product at n=%zu, q=2^%.0f, "
+         "planned %.2f bits, estimated %.2f bits\n",
+         ok ? "OK" : "FAIL", n, log2(q), planned, estimated);
+  free(work);
+  free(work3);
+  return ok;
+}
+
+int main() {
+  int failures = check_deserialized_unknown() ? 0 : 1;
+  if (!check_planner())
+    failures++;
+  for (size_t i = 0; i < NUM_CASES; i++) {
+    const NoiseCase *c = &cases[i];
+    int wrong = 0;
+    double worst = run_case(c, &wrong);
+    int ok = worst <= 0.0 && !wrong;
+    printf("[%s] %s, n=%zu, q=2^%d, %d terms: estimate %s %.2f bits %s the "
+           "measured budget%s\n",
+           ok ? "OK" : "FAIL", c->name, c->n, c->log_q, c->terms,
+           worst <= 0.0 ? "at least" : "up to", fabs(worst),
+           worst <= 0.0 ? "below" : "above",
+           wrong ? ", wrong decryption" : "");
+    if (!ok)
+      failures++;
+  }
+  return failures == 0 ? 0 : 1;
+}